@@ -0,0 +1,94 @@
+#include "acquisitionplanner.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#include "debug.h"
+
+const double AcquisitionPlanner::s_oversampling = 100.0;
+const double AcquisitionPlanner::s_minOversampling = 4.0;
+const int AcquisitionPlanner::s_minPeriods = 4;
+const double AcquisitionPlanner::s_pollInterval = 0.01;
+const double AcquisitionPlanner::s_trim = 0.8;
+const double AcquisitionPlanner::s_minSettle = 0.005;
+const double AcquisitionPlanner::s_maxSettle = 0.05;
+const double AcquisitionPlanner::s_settlePeriods = 3.0;
+
+AcquisitionPlanner::AcquisitionPlanner(Estimator estimator, double targetSnr, double maxSamplingFrequency, int bufferSize) :
+	m_estimator(estimator),
+	m_targetSnr(targetSnr),
+	m_inputSnr(40.0),
+	m_maxSamplingFrequency(maxSamplingFrequency)
+{
+	// In record mode the device buffer has to be read before it wraps, so it limits the rate as well
+	if (bufferSize > 0)
+		m_maxSamplingFrequency = std::min(m_maxSamplingFrequency, bufferSize / s_pollInterval);
+
+	Debug::verbose("AcquisitionPlanner", "Max sampling frequency " + std::to_string(m_maxSamplingFrequency) + "Hz"
+				   + " target SNR " + std::to_string(m_targetSnr) + "dB");
+}
+
+void AcquisitionPlanner::setInputSnr(double snr)
+{
+	m_inputSnr = snr;
+}
+
+double AcquisitionPlanner::maxSamplingFrequency() const
+{
+	return m_maxSamplingFrequency;
+}
+
+int AcquisitionPlanner::periodsFor(double frequency, double samplingFrequency) const
+{
+	double periods = static_cast<double>(s_minPeriods);
+
+	if (m_estimator == EstimatorSingleBin) {
+		// Noise bandwidth of a Hann windowed bin is 1.5 bins, so out of the
+		// noise spread up to nyquist only 3/N ends up in the estimate.
+		double samples = 3.0 * std::pow(10.0, (m_targetSnr - m_inputSnr) / 10.0);
+		periods = std::max(periods, samples * frequency / samplingFrequency);
+	} else {
+		// Broadband rms does not average noise away, the error left is the
+		// partial period at the end: at most 1/(4*pi*P) of the amplitude.
+		double error = std::pow(10.0, -m_targetSnr / 20.0);
+		periods = std::max(periods, 1.0 / (4.0 * M_PI * error)) / s_trim;
+	}
+
+	return static_cast<int>(std::ceil(periods));
+}
+
+AcquisitionPlan AcquisitionPlanner::plan(double frequency) const
+{
+	AcquisitionPlan ret;
+	ret.frequency = frequency;
+	ret.samplingFrequency = std::min(m_maxSamplingFrequency, s_oversampling * frequency);
+
+	if (ret.samplingFrequency < s_minOversampling * frequency)
+		Debug::warning("AcquisitionPlanner", std::to_string(frequency) + "Hz is too high for " +
+					   std::to_string(m_maxSamplingFrequency) + "Hz sampling frequency");
+
+	ret.duration = periodsFor(frequency, ret.samplingFrequency) / frequency;
+	// Whatever the DUT does, give it a few periods of the new frequency
+	ret.settle = std::max(s_minSettle, std::min(s_maxSettle, s_settlePeriods / frequency));
+
+	return ret;
+}
+
+std::vector<AcquisitionPlan> AcquisitionPlanner::plan(const std::vector<double>& frequencies) const
+{
+	std::vector<AcquisitionPlan> ret;
+	ret.reserve(frequencies.size());
+	for (auto f : frequencies)
+		ret.push_back(plan(f));
+	return ret;
+}
+
+// Static
+double AcquisitionPlanner::totalDuration(const std::vector<AcquisitionPlan>& plans)
+{
+	double ret = 0.0;
+	for (auto &p : plans)
+		ret += p.settle + p.duration;
+	return ret;
+}
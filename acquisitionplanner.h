@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+
+#include "estimator.h"
+
+// Acquisition settings for one measuring point
+struct AcquisitionPlan {
+	double frequency;
+	double samplingFrequency;
+	double duration;		// Seconds to record, settle time excluded
+	double settle;			// Seconds to wait after retuning the generator
+};
+
+// Picks sampling rate, record length and settle time per measuring point,
+// so each point gets the shortest capture that still reaches the target SNR
+// with the estimator in use, within what the device can stream.
+class AcquisitionPlanner
+{
+public:
+	// targetSnr in dB, bufferSize in samples as reported by the device
+	AcquisitionPlanner(Estimator estimator, double targetSnr, double maxSamplingFrequency, int bufferSize);
+
+	AcquisitionPlan plan(double frequency) const;
+	std::vector<AcquisitionPlan> plan(const std::vector<double>& frequencies) const;
+
+	// Settle plus record time, without any device overhead
+	static double totalDuration(const std::vector<AcquisitionPlan>& plans);
+
+	// Broadband SNR of the raw capture in dB, that the single bin gain builds on
+	void setInputSnr(double snr);
+
+	double maxSamplingFrequency() const;
+
+private:
+	Estimator m_estimator;
+	double m_targetSnr;
+	double m_inputSnr;
+	double m_maxSamplingFrequency;
+
+	int periodsFor(double frequency, double samplingFrequency) const;
+
+	const static double s_oversampling;		// Samples per period, if the device keeps up
+	const static double s_minOversampling;	// Below that, we do not measure at all
+	const static int s_minPeriods;			// Keeps the Hann windows leakage of the image away
+	const static double s_pollInterval;		// Worst case seconds between two reads of the device buffer
+	const static double s_trim;				// Part of a rms capture left after cutting 10% on both ends
+	const static double s_minSettle;
+	const static double s_maxSettle;		// What we always waited before
+	const static double s_settlePeriods;
+};
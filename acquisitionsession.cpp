@@ -0,0 +1,122 @@
+#include "acquisitionsession.h"
+
+AcquisitionSession::AcquisitionSession(SharedAnalogDiscoveryHandle handle, const std::vector<int>& channels, double range, int bufferSize) :
+	m_handle(handle),
+	m_channels(channels),
+	m_bufferSize(0),
+	m_requestedSamplingFrequency(0.0),
+	m_samplingFrequency(0.0),
+	m_requestedRecordLength(0.0),
+	m_recordLength(0.0),
+	m_triggerValid(false),
+	m_trigger(AnalogDiscovery::TriggerSourceNone),
+	m_triggerPositionSet(false),
+	m_outputFrequencyValid(false),
+	m_outputFrequency(0.0),
+	m_outputsEnabled(false)
+{
+	for (auto channel : m_channels) {
+		m_handle->setAnalogInputEnabled(channel, true);
+		m_handle->setAnalogInputRange(channel, range);
+	}
+
+	m_handle->setAnalogInputBufferSize(bufferSize);
+	m_bufferSize = m_handle->analogInputBufferSize();
+
+	m_handle->setAnalogInputAcquisitionMode(AnalogDiscovery::AcquisitionModeRecord);
+}
+
+SharedAnalogDiscoveryHandle AcquisitionSession::handle() const
+{
+	return m_handle;
+}
+
+const std::vector<int>& AcquisitionSession::channels() const
+{
+	return m_channels;
+}
+
+int AcquisitionSession::bufferSize() const
+{
+	return m_bufferSize;
+}
+
+double AcquisitionSession::setSamplingFrequency(double f)
+{
+	if (f != m_requestedSamplingFrequency) {
+		m_samplingFrequency = m_handle->setAnalogInputSamplingFreq(f);
+		m_requestedSamplingFrequency = f;
+	}
+
+	return m_samplingFrequency;
+}
+
+double AcquisitionSession::setRecordLength(double s)
+{
+	if (s != m_requestedRecordLength) {
+		m_recordLength = m_handle->setAnalogInputAcquisitionDuration(s);
+		m_requestedRecordLength = s;
+	}
+
+	return m_recordLength;
+}
+
+void AcquisitionSession::setTrigger(AnalogDiscovery::TriggerSource trigger)
+{
+	if (!m_triggerValid || trigger != m_trigger) {
+		m_handle->setAnalogInputTriggerSource(trigger);
+		m_trigger = trigger;
+		m_triggerValid = true;
+	}
+
+	if (trigger != AnalogDiscovery::TriggerSourceNone && !m_triggerPositionSet) {
+		m_handle->setAnalogInputTriggerAutoTimeout(0);
+		m_handle->setAnalogInputTriggerPosition(0);
+		m_triggerPositionSet = true;
+	}
+}
+
+void AcquisitionSession::start()
+{
+	m_handle->setAnalogInputStart(true);
+}
+
+RecordTiming AcquisitionSession::arm(double samplingFrequency, double duration, AnalogDiscovery::TriggerSource trigger)
+{
+	RecordTiming actual;
+	actual.samplingFrequency = setSamplingFrequency(samplingFrequency);
+	actual.duration = setRecordLength(duration);
+	setTrigger(trigger);
+	start();
+
+	return actual;
+}
+
+void AcquisitionSession::setOutputFrequency(double f)
+{
+	if (m_outputFrequencyValid && f == m_outputFrequency)
+		return;
+
+	for (auto channel : m_channels)
+		m_handle->setAnalogOutputFrequency(channel, f);
+
+	m_outputFrequency = f;
+	m_outputFrequencyValid = true;
+}
+
+void AcquisitionSession::startOutputs()
+{
+	if (m_outputsEnabled) {
+		// Linked channels follow their master
+		m_handle->startAnalogOutput(m_channels.front());
+		return;
+	}
+
+	for (size_t c=1; c<m_channels.size(); c++) {
+		m_handle->setAnalogOutputMaster(m_channels[c], m_channels.front());
+		m_handle->setAnalogOutputEnabled(m_channels[c], true);
+	}
+	m_handle->setAnalogOutputEnabled(m_channels.front(), true);
+
+	m_outputsEnabled = true;
+}
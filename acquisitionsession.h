@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+
+#include "analogdiscovery.h"
+
+// What the device made out of the requested record settings
+struct RecordTiming {
+	double samplingFrequency;
+	double duration;
+};
+
+// Input and generator settings of one measurement on an AnalogDiscovery.
+// Invariant settings (channels, range, buffer size, record mode) are sent once
+// on construction. After that the session remembers what the device is set to
+// and only sends what changes, so retuning a point takes a few DWF calls
+// instead of a dozen. Nothing else may change the device settings meanwhile.
+class AcquisitionSession
+{
+public:
+	AcquisitionSession(SharedAnalogDiscoveryHandle handle, const std::vector<int>& channels, double range = 5.0, int bufferSize = 8192);
+
+	SharedAnalogDiscoveryHandle handle() const;
+	const std::vector<int>& channels() const;
+	// As reported by the device
+	int bufferSize() const;
+
+	// Both return what the device actually uses
+	double setSamplingFrequency(double f);
+	double setRecordLength(double s);
+	void setTrigger(AnalogDiscovery::TriggerSource trigger);
+	void start();
+
+	// All of the above, then starts the acquisition.
+	// With a trigger other than TriggerSourceNone, the record starts once it fires.
+	RecordTiming arm(double samplingFrequency, double duration, AnalogDiscovery::TriggerSource trigger);
+
+	// Generator of all channels
+	void setOutputFrequency(double f);
+	// Starts the generator of all channels at once. The others are linked to the first one,
+	// which is started last, so a trigger on the first channel fits all of them.
+	void startOutputs();
+
+private:
+	SharedAnalogDiscoveryHandle m_handle;
+	std::vector<int> m_channels;
+	int m_bufferSize;
+
+	double m_requestedSamplingFrequency;
+	double m_samplingFrequency;
+	double m_requestedRecordLength;
+	double m_recordLength;
+	bool m_triggerValid;
+	AnalogDiscovery::TriggerSource m_trigger;
+	bool m_triggerPositionSet;
+	bool m_outputFrequencyValid;
+	double m_outputFrequency;
+	bool m_outputsEnabled;
+};
@@ -1,12 +1,14 @@
 #include "analogdiscovery.h"
-#include <iostream>
-#include <math.h>
-#include <unistd.h>
+#include "analogdiscoverysimulated.h"
+#ifdef HAVE_DWF
+#include "analogdiscoverydwf.h"
+#endif
 
-#include <chrono>
-#include <thread>
-
-using namespace std;
+#ifdef HAVE_DWF
+AnalogDiscovery::Backend AnalogDiscovery::s_backend = AnalogDiscovery::BackendDwf;
+#else
+AnalogDiscovery::Backend AnalogDiscovery::s_backend = AnalogDiscovery::BackendSimulated;
+#endif
 
 const std::vector<std::string> AnalogDiscovery::s_stateNames = {
 	"Ready",
@@ -28,379 +30,190 @@ const char* AnalogDiscoveryException::what() const noexcept
 	return basetype::what();
 }
 
-void AnalogDiscovery::throwIfNotOpened(const char* func, const char* file, int line)
-{
-	if (!m_opened)
-		throw AnalogDiscoveryException(func, file, line, 0, "Device not opened");
-}
-
-void AnalogDiscovery::checkAndThrow(bool ret, const char* func, const char* file, int line)
-{
-	if (!ret) {
-		DWFERC pdwferc;
-		FDwfGetLastError(&pdwferc);
-
-		char szError[512];
-		FDwfGetLastErrorMsg(szError);
-
-		throw AnalogDiscoveryException(func, file, line, pdwferc, szError);
-	}
-}
-
-AnalogDiscovery::AnalogDiscovery(const DeviceId &device)
-{
-	m_opened = (FDwfDeviceOpen(device.index, &m_devHandle) != 0);
-
-	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	char v[32];
-	FDwfGetVersion(v);
-	m_version = std::string(v);
-}
+AnalogDiscovery::AnalogDiscovery() :
+	m_callCount(0),
+	m_ioShadowValid(false),
+	m_ioOutputEnable(0),
+	m_ioOutput(0),
+	m_ioCommittedOutputEnable(0),
+	m_ioCommittedOutput(0),
+	m_ioHold(0)
+{}
 
 AnalogDiscovery::~AnalogDiscovery(void)
-{
-	if (isOpen())
-		FDwfDeviceClose(m_devHandle);
-}
-
-std::string AnalogDiscovery::version()
-{
-	return m_version;
-}
-
-bool AnalogDiscovery::isOpen(void) const
-{
-	return m_opened;
-}
-
-AnalogDiscovery::DeviceState AnalogDiscovery::analogOutputStatus(int channel)
-{
-	DwfState state;
-	checkAndThrow(FDwfAnalogOutStatus(m_devHandle, channel, &state),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
-	return static_cast<AnalogDiscovery::DeviceState>(state);
-}
-
-AnalogDiscovery::DeviceState AnalogDiscovery::analogInputStatus(int channel)
-{
-	DwfState state;
-	checkAndThrow(FDwfAnalogInStatus(m_devHandle, channel, &state),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
-	return static_cast<AnalogDiscovery::DeviceState>(state);
-}
+{}
 
-void AnalogDiscovery::setAnalogOutputWaveform(int channel, AnalogDiscovery::Waveform w)
+unsigned long AnalogDiscovery::callCount() const
 {
-	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	checkAndThrow(FDwfAnalogOutNodeFunctionSet(m_devHandle, channel, AnalogOutNodeCarrier, static_cast<uint8_t>(w)),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+	return m_callCount.load();
 }
 
-void AnalogDiscovery::setAnalogOutputAmplitude(int channel, double v)
+void AnalogDiscovery::countCall()
 {
-	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	checkAndThrow(FDwfAnalogOutNodeAmplitudeSet(m_devHandle, channel, AnalogOutNodeCarrier, v),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
-
+	m_callCount++;
 }
 
-void AnalogDiscovery::setAnalogOutputEnabled(int channel, bool e)
+static unsigned int pinBit(int pin)
 {
-	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	checkAndThrow(FDwfAnalogOutNodeEnableSet(m_devHandle, channel, AnalogOutNodeCarrier, e),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+	if (pin < 0 || pin > 15)
+		throw AnalogDiscoveryException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0, ("No such digital IO: " + std::to_string(pin)).c_str());
 
-	checkAndThrow(FDwfAnalogOutConfigure(m_devHandle, channel, e),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+	return 1 << pin;
 }
 
-void AnalogDiscovery::setAnalogOutputFrequency(int channel, double f)
+void AnalogDiscovery::setDigitalIoDirection(int pin, IODirection d)
 {
-	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	checkAndThrow(FDwfAnalogOutNodeFrequencySet(m_devHandle, channel, AnalogOutNodeCarrier, f),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+	setDigitalIoDirections(pinBit(pin), d == IODirectionOut ? pinBit(pin) : 0);
+	commitDigitalIoUnlessHeld();
 }
 
-
-double AnalogDiscovery::setAnalogInputSamplingFreq(double f)
+AnalogDiscovery::IODirection AnalogDiscovery::getDigitalIoDirection(int pin)
 {
-	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	checkAndThrow(FDwfAnalogInFrequencySet(m_devHandle, f),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	// Stupid API using double instead of int's in millivolts
-	double actual = analogInputSamplingFreq();
-	if (!(std::fabs(f - actual) < std::numeric_limits<double>::epsilon())) {
-		std::string dbg = "Sampling Frequency Differs: desired=" + std::to_string(f) +
-				" actual=" + std::to_string(actual);
-		Debug::verbose("AnalogDiscovery", dbg);
-	}
+	std::lock_guard<std::recursive_mutex> lock(m_ioMutex);
+	readDigitalIoShadow();
 
-	return actual;
+	return (m_ioOutputEnable & pinBit(pin)) ? IODirectionOut : IODirectionIn;
 }
 
-double AnalogDiscovery::analogInputSamplingFreq()
+void AnalogDiscovery::setDigitalIo(int pin, bool value)
 {
-	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
-	double f;
-
-	checkAndThrow(FDwfAnalogInFrequencyGet(m_devHandle, &f),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	return f;
+	setDigitalIoValues(pinBit(pin), value ? pinBit(pin) : 0);
+	commitDigitalIoUnlessHeld();
 }
 
-void AnalogDiscovery::setAnalogInputRange(int channel, double v)
+bool AnalogDiscovery::getDigitalIo(int pin)
 {
-	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+	std::lock_guard<std::recursive_mutex> lock(m_ioMutex);
+	readDigitalIoShadow();
 
-	checkAndThrow(FDwfAnalogInChannelRangeSet(m_devHandle, channel, v),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+	return m_ioOutput & pinBit(pin);
 }
 
-void AnalogDiscovery::setAnalogInputEnabled(int channel, bool e)
+void AnalogDiscovery::setDigitalIoDirections(unsigned int mask, unsigned int outputs)
 {
-	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	checkAndThrow(FDwfAnalogInChannelEnableSet(m_devHandle, channel, e),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+	std::lock_guard<std::recursive_mutex> lock(m_ioMutex);
+	readDigitalIoShadow();
 
+	m_ioOutputEnable = (m_ioOutputEnable & ~mask) | (outputs & mask);
 }
 
-void AnalogDiscovery::setAnalogInputAcquisitionMode(AcquisitionMode m)
+void AnalogDiscovery::setDigitalIoValues(unsigned int mask, unsigned int values)
 {
-	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	checkAndThrow(FDwfAnalogInAcquisitionModeSet(m_devHandle, static_cast<int>(m)),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+	std::lock_guard<std::recursive_mutex> lock(m_ioMutex);
+	readDigitalIoShadow();
 
+	m_ioOutput = (m_ioOutput & ~mask) | (values & mask);
 }
 
-double AnalogDiscovery::setAnalogInputAcquisitionDuration(double s)
+void AnalogDiscovery::commitDigitalIo()
 {
-	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	checkAndThrow(FDwfAnalogInRecordLengthSet(m_devHandle, s),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+	std::lock_guard<std::recursive_mutex> lock(m_ioMutex);
+	if (!m_ioShadowValid)
+		return;
 
-	// Stupid API using double instead of int's in milliseconds
-	double actual = analogInputAcquisitionDuration();
-	if (!(std::fabs(s - actual) < std::numeric_limits<double>::epsilon())) {
-		std::string dbg = "Acquisition Duration Differs: desired=" + std::to_string(s) +
-				" actual=" + std::to_string(actual);
-		Debug::verbose("AnalogDiscovery", dbg);
+	// Values first, so a pin turning into an output drives the new one right away
+	if (m_ioOutput != m_ioCommittedOutput) {
+		setDigitalIoOutput(m_ioOutput);
+		m_ioCommittedOutput = m_ioOutput;
 	}
-	return actual;
-}
-
-double AnalogDiscovery::analogInputAcquisitionDuration()
-{
-	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	double s;
-	checkAndThrow(FDwfAnalogInRecordLengthGet(m_devHandle, &s),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	return s;
-}
 
-void AnalogDiscovery::setAnalogInputReconfigure(bool r)
-{
-	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	checkAndThrow(FDwfAnalogInConfigure(m_devHandle, r, false),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-}
-
-void AnalogDiscovery::setAnalogInputStart(bool s)
-{
-	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	checkAndThrow(FDwfAnalogInConfigure(m_devHandle, false, s),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
-}
-
-void AnalogDiscovery::setAnalogInputBufferSize(int s)
-{
-	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	checkAndThrow(FDwfAnalogInBufferSizeSet(m_devHandle, s),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
-}
-
-void AnalogDiscovery::setAnalogInputTriggerSource(TriggerSource t)
-{
-	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	checkAndThrow(FDwfAnalogInTriggerSourceSet(m_devHandle, static_cast<unsigned char>(t)),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
-}
-
-void AnalogDiscovery::setAnalogInputTriggerAutoTimeout(double t)
-{
-	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	checkAndThrow(FDwfAnalogInTriggerAutoTimeoutSet(m_devHandle, t),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
-}
-
-void AnalogDiscovery::setAnalogInputTriggerChannel(int c)
-{
-	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	checkAndThrow(FDwfAnalogInTriggerChannelSet(m_devHandle, c),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
-}
-
-void AnalogDiscovery::setAnalogInputTriggerType(TriggerType t)
-{
-	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	checkAndThrow(FDwfAnalogInTriggerTypeSet(m_devHandle, static_cast<int>(t)),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
-}
-
-void AnalogDiscovery::setAnalogInputTriggerLevel(double l)
-{
-	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	checkAndThrow(FDwfAnalogInTriggerLevelSet(m_devHandle, l),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+	if (m_ioOutputEnable != m_ioCommittedOutputEnable) {
+		setDigitalIoOutputEnable(m_ioOutputEnable);
+		m_ioCommittedOutputEnable = m_ioOutputEnable;
+	}
 }
 
-void AnalogDiscovery::setAnalogInputTriggerCondition(TriggerCondition t)
+void AnalogDiscovery::readDigitalIoShadow()
 {
-	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+	if (m_ioShadowValid)
+		return;
 
-	checkAndThrow(FDwfAnalogInTriggerConditionSet(m_devHandle, static_cast<int>(t)),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+	m_ioOutputEnable = m_ioCommittedOutputEnable = digitalIoOutputEnable();
+	m_ioOutput = m_ioCommittedOutput = digitalIoOutput();
+	m_ioShadowValid = true;
 }
 
-void AnalogDiscovery::triggerAnalogInput()
+void AnalogDiscovery::commitDigitalIoUnlessHeld()
 {
-	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	checkAndThrow(FDwfDeviceTriggerPC(m_devHandle),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+	std::lock_guard<std::recursive_mutex> lock(m_ioMutex);
+	if (m_ioHold == 0)
+		commitDigitalIo();
 }
 
-int AnalogDiscovery::analogInputBufferSize()
+DigitalIoTransaction::DigitalIoTransaction(SharedAnalogDiscoveryHandle device) :
+	m_device(device),
+	m_open(true)
 {
-	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
-	int size;
-	checkAndThrow(FDwfAnalogInBufferSizeInfo(m_devHandle, nullptr, &size),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
-	return size;
+	std::lock_guard<std::recursive_mutex> lock(m_device->m_ioMutex);
+	m_device->m_ioHold++;
 }
 
-AnalogDiscovery::SampleState AnalogDiscovery::analogInSampleState()
+DigitalIoTransaction::~DigitalIoTransaction()
 {
-	DwfState state = 0;
-	checkAndThrow(FDwfAnalogInStatus(m_devHandle, true, &state),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	AnalogDiscovery::SampleState ret = {-1, -1, -1};
-
-	checkAndThrow(FDwfAnalogInStatusRecord(m_devHandle, &ret.available, &ret.lost, &ret.corrupted),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	return ret;
+	try {
+		commit();
+	} catch (const AnalogDiscoveryException &e) {
+		Debug::error("DigitalIoTransaction", std::string("Commit failed: ") + e.what());
+	}
 }
 
-void AnalogDiscovery::readAnalogInput(int channel, double *buffer, int size)
+void DigitalIoTransaction::commit()
 {
-	checkAndThrow(FDwfAnalogInStatusData(m_devHandle, channel, buffer, size),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
-}
+	if (!m_open)
+		return;
 
-void AnalogDiscovery::setDigitalIoDirection(int pin, IODirection d)
-{
-	unsigned int ioMask;
-	checkAndThrow(FDwfDigitalIOOutputEnableGet(m_devHandle, &ioMask),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	unsigned int newBit = 1 << pin;
-	// in = 0 / out = 1
-	if (d == IODirectionIn)
-		ioMask &= ~newBit;
-	else
-		ioMask |= newBit;
-
-	checkAndThrow(FDwfDigitalIOOutputEnableSet(m_devHandle, ioMask),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+	std::lock_guard<std::recursive_mutex> lock(m_device->m_ioMutex);
+	m_open = false;
+	m_device->m_ioHold--;
+	m_device->commitDigitalIoUnlessHeld();
 }
 
-AnalogDiscovery::IODirection AnalogDiscovery::getDigitalIoDirection(int pin)
+//Static
+void AnalogDiscovery::readSamples(SharedAnalogDiscoveryHandle handle, const std::vector<int>& channels, CaptureBuffer *target, int available)
 {
-	unsigned int ioMask;
-	checkAndThrow(FDwfDigitalIOOutputEnableGet(m_devHandle, &ioMask),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+	if (available <= 0)
+		return;
 
-	return (ioMask & (1 << pin)) ? IODirectionOut : IODirectionIn;
-}
+	for (size_t i=0; i<channels.size(); i++)
+		handle->readAnalogInput(channels[i], target->writePointer(i, available), available);
 
-void AnalogDiscovery::setDigitalIo(int pin, bool value)
-{
-	unsigned int ioMask;
-	checkAndThrow(FDwfDigitalIOOutputGet(m_devHandle, &ioMask),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	unsigned int newBit = 1 << pin;
-	if (value)
-		ioMask |= newBit;
-	else
-		ioMask &= ~newBit;
-
-	checkAndThrow(FDwfDigitalIOOutputSet(m_devHandle, ioMask),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+	target->commit(available);
 }
 
-bool AnalogDiscovery::getDigitalIo(int pin)
+//Static
+void AnalogDiscovery::setBackend(Backend b)
 {
-	unsigned int ioMask;
-	checkAndThrow(FDwfDigitalIOOutputGet(m_devHandle, &ioMask),
-				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
-
-	return ioMask & (1 << pin);
+#ifndef HAVE_DWF
+	if (b == BackendDwf)
+		throw AnalogDiscoveryException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0, "Built without DWF library, only the simulation is available");
+#endif
+	s_backend = b;
 }
 
 //Static
-std::list<AnalogDiscovery::DeviceId> AnalogDiscovery::getDevices()
+AnalogDiscovery::Backend AnalogDiscovery::backend()
 {
-	int devCount;
-	FDwfEnum(enumfilterAll, &devCount);
-
-	std::list<AnalogDiscovery::DeviceId> ret;
-	for (AnalogDiscovery::DeviceId d = {0,0,0}; d.index<devCount; d.index++) {
-		FDwfEnumDeviceType(d.index, &d.id, &d.ver);
-		ret.push_back(d);
-	}
-	return ret;
+	return s_backend;
 }
 
 //Static
-void AnalogDiscovery::readSamples(SharedAnalogDiscoveryHandle handle, int channel, double *buffer, int bufferSize, std::vector<double> *target, int available)
+std::list<AnalogDiscovery::DeviceId> AnalogDiscovery::getDevices()
 {
-	while (available) {
-		int count = available > bufferSize ? bufferSize : available;
-		handle->readAnalogInput(channel, buffer, count);
-		copy(&buffer[0], &buffer[count], back_inserter(*target));
-		available -= count;
-	}
-
+#ifdef HAVE_DWF
+	if (s_backend == BackendDwf)
+		return AnalogDiscoveryDwf::getDevices();
+#endif
+	return AnalogDiscoverySimulated::getDevices();
 }
 
 //Static
 SharedAnalogDiscoveryHandle AnalogDiscovery::createSharedAnalogDiscoveryHandle(AnalogDiscovery::DeviceId deviceId)
 {
-	return SharedAnalogDiscoveryHandle(new AnalogDiscovery(deviceId));
+#ifdef HAVE_DWF
+	if (s_backend == BackendDwf)
+		return SharedAnalogDiscoveryHandle(new AnalogDiscoveryDwf(deviceId));
+#endif
+	return SharedAnalogDiscoveryHandle(new AnalogDiscoverySimulated(deviceId));
 }
 
 //Static
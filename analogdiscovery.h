@@ -7,14 +7,15 @@
 #include <string>
 #include <memory>
 #include <atomic>
+#include <mutex>
 #include <thread>
 #include <chrono>
 #include <iostream>
 #include <cmath>
-#include <digilent/waveforms/dwf.h>
 
 #include "debug.h"
 #include "descriptiveexception.h"
+#include "capturebuffer.h"
 
 class AnalogDiscoveryException : public DescriptiveException {
 public:
@@ -27,12 +28,15 @@ public:
 class AnalogDiscovery;
 typedef std::shared_ptr<AnalogDiscovery> SharedAnalogDiscoveryHandle;
 
+// Device interface. AnalogDiscoveryDwf talks to real hardware through the DWF
+// library, AnalogDiscoverySimulated synthesizes the responses in software.
+// Which one the static factories hand out is chosen at runtime by setBackend().
 class AnalogDiscovery {
 public:
 	struct DeviceId {
 		int index;
-		DEVID id;
-		DEVVER ver;
+		int id;
+		int ver;
 	};
 
 	struct SampleState {
@@ -41,10 +45,10 @@ public:
 		int corrupted;
 	};
 
-	AnalogDiscovery(const DeviceId& device);
-	~AnalogDiscovery(void);
+	AnalogDiscovery();
+	virtual ~AnalogDiscovery(void);
 
-	std::string version();
+	virtual std::string version() = 0;
 
 	enum Waveform {
 		WaveformDc				= 0,
@@ -57,15 +61,30 @@ public:
 		WaveformCustom			= 30,
 		WaveformPlay			= 31
 	};
-	void setAnalogOutputWaveform(int channel, Waveform w);
-	void setAnalogOutputAmplitude(int channel, double v);
-	void setAnalogOutputFrequency(int channel, double f);
-	void setAnalogOutputEnabled(int channel, bool e);
-
-	double setAnalogInputSamplingFreq(double f);
-	double analogInputSamplingFreq();
-	void setAnalogInputRange(int channel, double v);
-	void setAnalogInputEnabled(int channel, bool e);
+	virtual void setAnalogOutputWaveform(int channel, Waveform w) = 0;
+	virtual void setAnalogOutputAmplitude(int channel, double v) = 0;
+	virtual void setAnalogOutputFrequency(int channel, double f) = 0;
+	virtual void setAnalogOutputEnabled(int channel, bool e) = 0;
+	// (Re)starts an enabled channel, one call instead of the two of setAnalogOutputEnabled()
+	virtual void startAnalogOutput(int channel) = 0;
+	// Samples for WaveformCustom, normalized to +-1. One buffer is one period.
+	virtual void setAnalogOutputCustomData(int channel, const std::vector<double>& data) = 0;
+	virtual int analogOutputCustomDataMaxSize(int channel) = 0;
+	//TODO: this should be using std::chrono, actually
+	virtual void setAnalogOutputRunDuration(int channel, double s) = 0;
+	virtual void setAnalogOutputRepeat(int channel, int count) = 0;
+	// WaveformPlay streaming. Prefill with setAnalogOutputCustomData(), then keep
+	// feeding as much as analogOutputPlayState().available tells after enabling.
+	virtual SampleState analogOutputPlayState(int channel) = 0;
+	virtual void writeAnalogOutputPlayData(int channel, const double *data, int size) = 0;
+	// Linked channels start, when master is enabled. Pass channel as master to unlink.
+	virtual void setAnalogOutputMaster(int channel, int master) = 0;
+
+	virtual double setAnalogInputSamplingFreq(double f) = 0;
+	virtual double analogInputSamplingFreq() = 0;
+	virtual double analogInputMaxSamplingFreq() = 0;
+	virtual void setAnalogInputRange(int channel, double v) = 0;
+	virtual void setAnalogInputEnabled(int channel, bool e) = 0;
 
 	enum AcquisitionMode {
 		AcquisitionModeSingle			= 0,
@@ -73,13 +92,13 @@ public:
 		AcquisitionModeScanScreen		= 2,
 		AcquisitionModeRecord			= 3
 	};
-	void setAnalogInputAcquisitionMode(AcquisitionMode m);
+	virtual void setAnalogInputAcquisitionMode(AcquisitionMode m) = 0;
 	//TODO: this should be using std::chrono, actually
-	double setAnalogInputAcquisitionDuration(double s);
-	double analogInputAcquisitionDuration();
-	void setAnalogInputReconfigure(bool r);
-	void setAnalogInputStart(bool s);
-	void setAnalogInputBufferSize(int s);
+	virtual double setAnalogInputAcquisitionDuration(double s) = 0;
+	virtual double analogInputAcquisitionDuration() = 0;
+	virtual void setAnalogInputReconfigure(bool r) = 0;
+	virtual void setAnalogInputStart(bool s) = 0;
+	virtual void setAnalogInputBufferSize(int s) = 0;
 
 	enum TriggerSource {
 		TriggerSourceNone               = 0,
@@ -98,29 +117,31 @@ public:
 		TriggerSourceExternal3          = 13,
 		TriggerSourceExternal4          = 14
 	};
-	void setAnalogInputTriggerSource(TriggerSource t);
+	virtual void setAnalogInputTriggerSource(TriggerSource t) = 0;
 	//TODO: use chrono::duration here
-	void setAnalogInputTriggerAutoTimeout(double t);
-	void setAnalogInputTriggerChannel(int c);
+	virtual void setAnalogInputTriggerAutoTimeout(double t) = 0;
+	virtual void setAnalogInputTriggerChannel(int c) = 0;
 	enum TriggerType {
 		TriggerTypeEdge					= 0,
 		TriggerTypePulse				= 1,
 		TriggerTypeTransistion			= 2
 	};
-	void setAnalogInputTriggerType(TriggerType t);
-	void setAnalogInputTriggerLevel(double l);
+	virtual void setAnalogInputTriggerType(TriggerType t) = 0;
+	virtual void setAnalogInputTriggerLevel(double l) = 0;
 	enum TriggerCondition {
 		TriggerConditionRising			= 0,
 		TriggerConditionFalling			= 1
 	};
-	void setAnalogInputTriggerCondition(TriggerCondition c);
-	void triggerAnalogInput();
+	virtual void setAnalogInputTriggerCondition(TriggerCondition c) = 0;
+	// Seconds, 0 puts the trigger at the first sample
+	virtual void setAnalogInputTriggerPosition(double s) = 0;
+	virtual void triggerAnalogInput() = 0;
 
-	int analogInputBufferSize();
-	bool isOpen(void) const;
+	virtual int analogInputBufferSize() = 0;
+	virtual bool isOpen(void) const = 0;
 
-	void readAnalogInput(int channel, double *buffer, int size);
-	SampleState analogInSampleState();
+	virtual void readAnalogInput(int channel, double *buffer, int size) = 0;
+	virtual SampleState analogInSampleState() = 0;
 
 	enum DeviceState {
 		DeviceStateReady				= 0,
@@ -134,31 +155,90 @@ public:
 	};
 	const static std::vector<std::string> s_stateNames;
 
-	DeviceState analogOutputStatus(int channel);
-	DeviceState analogInputStatus(int channel);
+	virtual DeviceState analogOutputStatus(int channel) = 0;
+	virtual DeviceState analogInputStatus(int channel) = 0;
+
+	enum Backend {
+		BackendDwf,
+		BackendSimulated
+	};
+	// Defaults to BackendDwf when built with the DWF library, BackendSimulated otherwise
+	static void setBackend(Backend b);
+	static Backend backend();
 
+	// Devices of the selected backend
 	static std::list<DeviceId> getDevices();
 	static SharedAnalogDiscoveryHandle createSharedAnalogDiscoveryHandle(AnalogDiscovery::DeviceId deviceId);
 	static SharedAnalogDiscoveryHandle getFirstAvailableDevice();
-	static void readSamples(SharedAnalogDiscoveryHandle handle, int channel, double *buffer, int bufferSize, std::vector<double> *target, int available);
+	// Reads available samples of every channel straight into target, channels[i] goes to target channel i
+	static void readSamples(SharedAnalogDiscoveryHandle handle, const std::vector<int>& channels, CaptureBuffer *target, int available);
 
 	// Digital IO
 	enum IODirection {
 		IODirectionIn = 0x01,
 		IODirectionOut = 0x00
 	};
+	// Work on a shadow of the output enable and output registers, read from the
+	// device once. Each call commits right away, unless a DigitalIoTransaction holds it.
 	void setDigitalIoDirection(int pin, IODirection d);
 	IODirection getDigitalIoDirection(int pin);
 	void setDigitalIo(int pin, bool value);
 	bool getDigitalIo(int pin);
 
+	// Bulk digital IO, bit n is pin n. Only pins in mask change, set bits in
+	// outputs make a pin an output.
+	void setDigitalIoDirections(unsigned int mask, unsigned int outputs);
+	void setDigitalIoValues(unsigned int mask, unsigned int values);
+	// Writes the registers that differ from the device, one call each
+	void commitDigitalIo();
+
+	// Device calls made on this device so far
+	unsigned long callCount() const;
+
+protected:
+	void countCall();
+
+	// Whole digital IO registers
+	virtual unsigned int digitalIoOutputEnable() = 0;
+	virtual void setDigitalIoOutputEnable(unsigned int mask) = 0;
+	virtual unsigned int digitalIoOutput() = 0;
+	virtual void setDigitalIoOutput(unsigned int mask) = 0;
+
 private:
-	HDWF m_devHandle;
-	bool m_opened;
-	std::string m_version;
+	friend class DigitalIoTransaction;
 
-	void throwIfNotOpened(const char *func, const char *file, int line);
-	void checkAndThrow(bool ret, const char *func, const char *file, int line);
+	std::atomic<unsigned long> m_callCount;
+	static Backend s_backend;
+
+	std::recursive_mutex m_ioMutex;
+	bool m_ioShadowValid;
+	unsigned int m_ioOutputEnable;
+	unsigned int m_ioOutput;
+	unsigned int m_ioCommittedOutputEnable;
+	unsigned int m_ioCommittedOutput;
+	int m_ioHold;
+
+	void readDigitalIoShadow();
+	void commitDigitalIoUnlessHeld();
+};
+
+// Holds back commits of digital IO changes on a device while alive, then
+// commits them at once: a dozen GPIOs cost two device calls instead of two each.
+// Holds are per device, not per thread.
+class DigitalIoTransaction
+{
+public:
+	DigitalIoTransaction(SharedAnalogDiscoveryHandle device);
+	DigitalIoTransaction(const DigitalIoTransaction&) = delete;
+	DigitalIoTransaction& operator=(const DigitalIoTransaction&) = delete;
+	~DigitalIoTransaction();
+
+	// Early commit, reports errors, which the destructor can only log
+	void commit();
+
+private:
+	SharedAnalogDiscoveryHandle m_device;
+	bool m_open;
 };
 
 std::ostream& operator<<(std::ostream& lhs, const AnalogDiscovery::DeviceState& rhs);
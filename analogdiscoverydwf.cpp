@@ -0,0 +1,445 @@
+#include "analogdiscoverydwf.h"
+#include <iostream>
+#include <math.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <thread>
+
+using namespace std;
+
+void AnalogDiscoveryDwf::throwIfNotOpened(const char* func, const char* file, int line)
+{
+	if (!m_opened)
+		throw AnalogDiscoveryException(func, file, line, 0, "Device not opened");
+}
+
+void AnalogDiscoveryDwf::checkAndThrow(bool ret, const char* func, const char* file, int line)
+{
+	countCall();
+
+	if (!ret) {
+		DWFERC pdwferc;
+		FDwfGetLastError(&pdwferc);
+
+		char szError[512];
+		FDwfGetLastErrorMsg(szError);
+
+		throw AnalogDiscoveryException(func, file, line, pdwferc, szError);
+	}
+}
+
+AnalogDiscoveryDwf::AnalogDiscoveryDwf(const DeviceId &device)
+{
+	m_opened = (FDwfDeviceOpen(device.index, &m_devHandle) != 0);
+
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	char v[32];
+	FDwfGetVersion(v);
+	m_version = std::string(v);
+}
+
+AnalogDiscoveryDwf::~AnalogDiscoveryDwf(void)
+{
+	if (isOpen())
+		FDwfDeviceClose(m_devHandle);
+}
+
+std::string AnalogDiscoveryDwf::version()
+{
+	return m_version;
+}
+
+bool AnalogDiscoveryDwf::isOpen(void) const
+{
+	return m_opened;
+}
+
+AnalogDiscovery::DeviceState AnalogDiscoveryDwf::analogOutputStatus(int channel)
+{
+	DwfState state;
+	checkAndThrow(FDwfAnalogOutStatus(m_devHandle, channel, &state),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+	return static_cast<AnalogDiscovery::DeviceState>(state);
+}
+
+AnalogDiscovery::DeviceState AnalogDiscoveryDwf::analogInputStatus(int channel)
+{
+	DwfState state;
+	checkAndThrow(FDwfAnalogInStatus(m_devHandle, channel, &state),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+	return static_cast<AnalogDiscovery::DeviceState>(state);
+}
+
+void AnalogDiscoveryDwf::setAnalogOutputWaveform(int channel, AnalogDiscovery::Waveform w)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfAnalogOutNodeFunctionSet(m_devHandle, channel, AnalogOutNodeCarrier, static_cast<uint8_t>(w)),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+void AnalogDiscoveryDwf::setAnalogOutputAmplitude(int channel, double v)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfAnalogOutNodeAmplitudeSet(m_devHandle, channel, AnalogOutNodeCarrier, v),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+}
+
+void AnalogDiscoveryDwf::setAnalogOutputEnabled(int channel, bool e)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfAnalogOutNodeEnableSet(m_devHandle, channel, AnalogOutNodeCarrier, e),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfAnalogOutConfigure(m_devHandle, channel, e),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+void AnalogDiscoveryDwf::startAnalogOutput(int channel)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfAnalogOutConfigure(m_devHandle, channel, true),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+void AnalogDiscoveryDwf::setAnalogOutputCustomData(int channel, const std::vector<double>& data)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	// API is not const correct, but does not touch the data
+	checkAndThrow(FDwfAnalogOutNodeDataSet(m_devHandle, channel, AnalogOutNodeCarrier, const_cast<double*>(data.data()), data.size()),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+int AnalogDiscoveryDwf::analogOutputCustomDataMaxSize(int channel)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+	int size;
+	checkAndThrow(FDwfAnalogOutNodeDataInfo(m_devHandle, channel, AnalogOutNodeCarrier, nullptr, &size),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+	return size;
+}
+
+void AnalogDiscoveryDwf::setAnalogOutputRunDuration(int channel, double s)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfAnalogOutRunSet(m_devHandle, channel, s),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+void AnalogDiscoveryDwf::setAnalogOutputRepeat(int channel, int count)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfAnalogOutRepeatSet(m_devHandle, channel, count),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+void AnalogDiscoveryDwf::setAnalogOutputMaster(int channel, int master)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfAnalogOutMasterSet(m_devHandle, channel, master),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+AnalogDiscovery::SampleState AnalogDiscoveryDwf::analogOutputPlayState(int channel)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	DwfState state = 0;
+	checkAndThrow(FDwfAnalogOutStatus(m_devHandle, channel, &state),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	AnalogDiscovery::SampleState ret = {-1, -1, -1};
+
+	checkAndThrow(FDwfAnalogOutNodePlayStatus(m_devHandle, channel, AnalogOutNodeCarrier, &ret.available, &ret.lost, &ret.corrupted),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	return ret;
+}
+
+void AnalogDiscoveryDwf::writeAnalogOutputPlayData(int channel, const double *data, int size)
+{
+	// API is not const correct, but does not touch the data
+	checkAndThrow(FDwfAnalogOutNodePlayData(m_devHandle, channel, AnalogOutNodeCarrier, const_cast<double*>(data), size),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+void AnalogDiscoveryDwf::setAnalogOutputFrequency(int channel, double f)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfAnalogOutNodeFrequencySet(m_devHandle, channel, AnalogOutNodeCarrier, f),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+
+double AnalogDiscoveryDwf::setAnalogInputSamplingFreq(double f)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfAnalogInFrequencySet(m_devHandle, f),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	// Stupid API using double instead of int's in millivolts
+	double actual = analogInputSamplingFreq();
+	if (!(std::fabs(f - actual) < std::numeric_limits<double>::epsilon())) {
+		std::string dbg = "Sampling Frequency Differs: desired=" + std::to_string(f) +
+				" actual=" + std::to_string(actual);
+		Debug::verbose("AnalogDiscovery", dbg);
+	}
+
+	return actual;
+}
+
+double AnalogDiscoveryDwf::analogInputSamplingFreq()
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+	double f;
+
+	checkAndThrow(FDwfAnalogInFrequencyGet(m_devHandle, &f),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	return f;
+}
+
+double AnalogDiscoveryDwf::analogInputMaxSamplingFreq()
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+	double f;
+
+	checkAndThrow(FDwfAnalogInFrequencyInfo(m_devHandle, nullptr, &f),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	return f;
+}
+
+void AnalogDiscoveryDwf::setAnalogInputRange(int channel, double v)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfAnalogInChannelRangeSet(m_devHandle, channel, v),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+void AnalogDiscoveryDwf::setAnalogInputEnabled(int channel, bool e)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfAnalogInChannelEnableSet(m_devHandle, channel, e),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+}
+
+void AnalogDiscoveryDwf::setAnalogInputAcquisitionMode(AcquisitionMode m)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfAnalogInAcquisitionModeSet(m_devHandle, static_cast<int>(m)),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+}
+
+double AnalogDiscoveryDwf::setAnalogInputAcquisitionDuration(double s)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfAnalogInRecordLengthSet(m_devHandle, s),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	// Stupid API using double instead of int's in milliseconds
+	double actual = analogInputAcquisitionDuration();
+	if (!(std::fabs(s - actual) < std::numeric_limits<double>::epsilon())) {
+		std::string dbg = "Acquisition Duration Differs: desired=" + std::to_string(s) +
+				" actual=" + std::to_string(actual);
+		Debug::verbose("AnalogDiscovery", dbg);
+	}
+	return actual;
+}
+
+double AnalogDiscoveryDwf::analogInputAcquisitionDuration()
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	double s;
+	checkAndThrow(FDwfAnalogInRecordLengthGet(m_devHandle, &s),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	return s;
+}
+
+void AnalogDiscoveryDwf::setAnalogInputReconfigure(bool r)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfAnalogInConfigure(m_devHandle, r, false),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+}
+
+void AnalogDiscoveryDwf::setAnalogInputStart(bool s)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfAnalogInConfigure(m_devHandle, false, s),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+void AnalogDiscoveryDwf::setAnalogInputBufferSize(int s)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfAnalogInBufferSizeSet(m_devHandle, s),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+void AnalogDiscoveryDwf::setAnalogInputTriggerSource(TriggerSource t)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfAnalogInTriggerSourceSet(m_devHandle, static_cast<unsigned char>(t)),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+void AnalogDiscoveryDwf::setAnalogInputTriggerAutoTimeout(double t)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfAnalogInTriggerAutoTimeoutSet(m_devHandle, t),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+void AnalogDiscoveryDwf::setAnalogInputTriggerChannel(int c)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfAnalogInTriggerChannelSet(m_devHandle, c),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+void AnalogDiscoveryDwf::setAnalogInputTriggerType(TriggerType t)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfAnalogInTriggerTypeSet(m_devHandle, static_cast<int>(t)),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+void AnalogDiscoveryDwf::setAnalogInputTriggerLevel(double l)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfAnalogInTriggerLevelSet(m_devHandle, l),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+void AnalogDiscoveryDwf::setAnalogInputTriggerCondition(TriggerCondition t)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfAnalogInTriggerConditionSet(m_devHandle, static_cast<int>(t)),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+void AnalogDiscoveryDwf::setAnalogInputTriggerPosition(double s)
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfAnalogInTriggerPositionSet(m_devHandle, s),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+void AnalogDiscoveryDwf::triggerAnalogInput()
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	checkAndThrow(FDwfDeviceTriggerPC(m_devHandle),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+int AnalogDiscoveryDwf::analogInputBufferSize()
+{
+	throwIfNotOpened(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+	int size;
+	checkAndThrow(FDwfAnalogInBufferSizeInfo(m_devHandle, nullptr, &size),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+	return size;
+}
+
+AnalogDiscovery::SampleState AnalogDiscoveryDwf::analogInSampleState()
+{
+	DwfState state = 0;
+	checkAndThrow(FDwfAnalogInStatus(m_devHandle, true, &state),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	AnalogDiscovery::SampleState ret = {-1, -1, -1};
+
+	checkAndThrow(FDwfAnalogInStatusRecord(m_devHandle, &ret.available, &ret.lost, &ret.corrupted),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	return ret;
+}
+
+void AnalogDiscoveryDwf::readAnalogInput(int channel, double *buffer, int size)
+{
+	checkAndThrow(FDwfAnalogInStatusData(m_devHandle, channel, buffer, size),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+unsigned int AnalogDiscoveryDwf::digitalIoOutputEnable()
+{
+	unsigned int ioMask;
+	checkAndThrow(FDwfDigitalIOOutputEnableGet(m_devHandle, &ioMask),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	return ioMask;
+}
+
+void AnalogDiscoveryDwf::setDigitalIoOutputEnable(unsigned int mask)
+{
+	// in = 0 / out = 1
+	checkAndThrow(FDwfDigitalIOOutputEnableSet(m_devHandle, mask),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+unsigned int AnalogDiscoveryDwf::digitalIoOutput()
+{
+	unsigned int ioMask;
+	checkAndThrow(FDwfDigitalIOOutputGet(m_devHandle, &ioMask),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	return ioMask;
+}
+
+void AnalogDiscoveryDwf::setDigitalIoOutput(unsigned int mask)
+{
+	checkAndThrow(FDwfDigitalIOOutputSet(m_devHandle, mask),
+				  __PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+//Static
+std::list<AnalogDiscovery::DeviceId> AnalogDiscoveryDwf::getDevices()
+{
+	int devCount;
+	FDwfEnum(enumfilterAll, &devCount);
+
+	std::list<AnalogDiscovery::DeviceId> ret;
+	for (AnalogDiscovery::DeviceId d = {0,0,0}; d.index<devCount; d.index++) {
+		DEVID id;
+		DEVVER ver;
+		FDwfEnumDeviceType(d.index, &id, &ver);
+		d.id = id;
+		d.ver = ver;
+		ret.push_back(d);
+	}
+	return ret;
+}
+
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <digilent/waveforms/dwf.h>
+
+#include "analogdiscovery.h"
+
+// Real device, every call goes through the DWF library
+class AnalogDiscoveryDwf : public AnalogDiscovery
+{
+public:
+	typedef AnalogDiscovery basetype;
+
+	AnalogDiscoveryDwf(const DeviceId& device);
+	virtual ~AnalogDiscoveryDwf(void);
+
+	virtual std::string version();
+	virtual void setAnalogOutputWaveform(int channel, Waveform w);
+	virtual void setAnalogOutputAmplitude(int channel, double v);
+	virtual void setAnalogOutputFrequency(int channel, double f);
+	virtual void setAnalogOutputEnabled(int channel, bool e);
+	virtual void startAnalogOutput(int channel);
+	virtual void setAnalogOutputCustomData(int channel, const std::vector<double>& data);
+	virtual int analogOutputCustomDataMaxSize(int channel);
+	virtual void setAnalogOutputRunDuration(int channel, double s);
+	virtual void setAnalogOutputRepeat(int channel, int count);
+	virtual SampleState analogOutputPlayState(int channel);
+	virtual void writeAnalogOutputPlayData(int channel, const double *data, int size);
+	virtual void setAnalogOutputMaster(int channel, int master);
+	virtual double setAnalogInputSamplingFreq(double f);
+	virtual double analogInputSamplingFreq();
+	virtual double analogInputMaxSamplingFreq();
+	virtual void setAnalogInputRange(int channel, double v);
+	virtual void setAnalogInputEnabled(int channel, bool e);
+	virtual void setAnalogInputAcquisitionMode(AcquisitionMode m);
+	virtual double setAnalogInputAcquisitionDuration(double s);
+	virtual double analogInputAcquisitionDuration();
+	virtual void setAnalogInputReconfigure(bool r);
+	virtual void setAnalogInputStart(bool s);
+	virtual void setAnalogInputBufferSize(int s);
+	virtual void setAnalogInputTriggerSource(TriggerSource t);
+	virtual void setAnalogInputTriggerAutoTimeout(double t);
+	virtual void setAnalogInputTriggerChannel(int c);
+	virtual void setAnalogInputTriggerType(TriggerType t);
+	virtual void setAnalogInputTriggerLevel(double l);
+	virtual void setAnalogInputTriggerCondition(TriggerCondition c);
+	virtual void setAnalogInputTriggerPosition(double s);
+	virtual void triggerAnalogInput();
+	virtual int analogInputBufferSize();
+	virtual bool isOpen(void) const;
+	virtual void readAnalogInput(int channel, double *buffer, int size);
+	virtual SampleState analogInSampleState();
+	virtual DeviceState analogOutputStatus(int channel);
+	virtual DeviceState analogInputStatus(int channel);
+
+	static std::list<DeviceId> getDevices();
+
+protected:
+	virtual unsigned int digitalIoOutputEnable();
+	virtual void setDigitalIoOutputEnable(unsigned int mask);
+	virtual unsigned int digitalIoOutput();
+	virtual void setDigitalIoOutput(unsigned int mask);
+
+private:
+	HDWF m_devHandle;
+	bool m_opened;
+	std::string m_version;
+
+	void throwIfNotOpened(const char *func, const char *file, int line);
+	void checkAndThrow(bool ret, const char *func, const char *file, int line);
+};
@@ -0,0 +1,722 @@
+#include "analogdiscoverysimulated.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+
+const double AnalogDiscoverySimulated::s_baseFrequency = 100e6;
+const int AnalogDiscoverySimulated::s_maxBufferSize = 8192;
+const int AnalogDiscoverySimulated::s_customDataSize = 4096;
+// Input history run through the filters before an untriggered record, so it
+// starts with the DUT settled on what the generator already plays
+const double AnalogDiscoverySimulated::s_warmUp = 0.1;
+
+AnalogDiscoverySimulated::Model AnalogDiscoverySimulated::s_defaultModel;
+
+AnalogDiscoverySimulated::Model::Model() :
+	gain(0.0),
+	highPass(40.0),
+	lowPass(16000.0),
+	noise(1e-4),
+	distortion(0.001),
+	latency(0.0005)
+{}
+
+//Static
+AnalogDiscoverySimulated::Model AnalogDiscoverySimulated::Model::fromString(const std::string& spec)
+{
+	Model ret;
+
+	std::stringstream ss(spec);
+	std::string item;
+	while (std::getline(ss, item, ',')) {
+		if (item.empty())
+			continue;
+
+		auto pos = item.find('=');
+		std::string key = item.substr(0, pos);
+		double value = 0.0;
+
+		try {
+			if (pos == std::string::npos)
+				throw std::invalid_argument(key);
+			value = std::stod(item.substr(pos + 1));
+		} catch (const std::exception&) {
+			throw AnalogDiscoveryException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
+										   ("Simulation model needs key=value, got: " + item).c_str());
+		}
+
+		if (key == "gain")
+			ret.gain = value;
+		else if (key == "hp")
+			ret.highPass = value;
+		else if (key == "lp")
+			ret.lowPass = value;
+		else if (key == "noise")
+			ret.noise = value;
+		else if (key == "hd2")
+			ret.distortion = value;
+		else if (key == "latency")
+			ret.latency = value;
+		else
+			throw AnalogDiscoveryException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
+										   ("Unknown simulation model key: " + key).c_str());
+	}
+
+	return ret;
+}
+
+//Static
+void AnalogDiscoverySimulated::setDefaultModel(const Model& m)
+{
+	s_defaultModel = m;
+}
+
+//Static
+AnalogDiscoverySimulated::Model AnalogDiscoverySimulated::defaultModel()
+{
+	return s_defaultModel;
+}
+
+AnalogDiscoverySimulated::AnalogDiscoverySimulated(const DeviceId &device) :
+	AnalogDiscoverySimulated(device, s_defaultModel)
+{}
+
+AnalogDiscoverySimulated::AnalogDiscoverySimulated(const DeviceId &device, const Model& model) :
+	m_model(model),
+	m_gain(std::pow(10.0, model.gain / 20.0)),
+	m_random(5489u + device.index),
+	m_noise(0.0, 1.0),
+	m_acquisitionMode(AcquisitionModeSingle),
+	m_samplingFrequency(s_baseFrequency / 1000),
+	m_recordLength(0.0),
+	m_bufferSize(s_maxBufferSize),
+	m_triggerSource(TriggerSourceNone),
+	m_triggerAutoTimeout(0.0),
+	m_triggerPosition(0.0),
+	m_epoch(Clock::now()),
+	m_inputState(DeviceStateReady),
+	m_armed(0.0),
+	m_recordStart(0.0),
+	m_recordSamples(0),
+	m_generated(0),
+	m_lost(0),
+	m_ioOutputEnable(0),
+	m_ioOutput(0)
+{
+	for (int c=0; c<2; c++) {
+		auto &o = m_outputs[c];
+		o.waveform = WaveformSine;
+		o.amplitude = 0.0;
+		o.frequency = 1000.0;
+		o.runDuration = 0.0;
+		o.master = c;
+		o.enabled = false;
+		o.running = false;
+		o.start = 0.0;
+		o.played = 0;
+		o.checked = 0;
+
+		auto &i = m_inputs[c];
+		i.enabled = false;
+		i.range = 5.0;
+	}
+}
+
+AnalogDiscoverySimulated::~AnalogDiscoverySimulated(void)
+{}
+
+std::string AnalogDiscoverySimulated::version()
+{
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+	return "simulated";
+}
+
+bool AnalogDiscoverySimulated::isOpen(void) const
+{
+	return true;
+}
+
+AnalogDiscovery::DeviceState AnalogDiscoverySimulated::analogOutputStatus(int channel)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__, channel);
+
+	auto &o = m_outputs[channel];
+	if (!o.running)
+		return DeviceStateReady;
+	if (o.runDuration > 0.0 && now() >= o.start + o.runDuration)
+		return DeviceStateDone;
+
+	return DeviceStateRunningTriggered;
+}
+
+AnalogDiscovery::DeviceState AnalogDiscoverySimulated::analogInputStatus(int channel)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__, channel);
+
+	update();
+	return m_inputState;
+}
+
+void AnalogDiscoverySimulated::setAnalogOutputWaveform(int channel, AnalogDiscovery::Waveform w)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__, channel);
+
+	m_outputs[channel].waveform = w;
+}
+
+void AnalogDiscoverySimulated::setAnalogOutputAmplitude(int channel, double v)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__, channel);
+
+	m_outputs[channel].amplitude = v;
+}
+
+void AnalogDiscoverySimulated::setAnalogOutputFrequency(int channel, double f)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__, channel);
+
+	m_outputs[channel].frequency = f;
+}
+
+void AnalogDiscoverySimulated::setAnalogOutputEnabled(int channel, bool e)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__, channel);
+
+	auto &o = m_outputs[channel];
+	o.enabled = e;
+
+	if (!e)
+		o.running = false;
+	else if (o.master == channel)
+		startOutput(channel, now());
+}
+
+void AnalogDiscoverySimulated::startAnalogOutput(int channel)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__, channel);
+
+	m_outputs[channel].enabled = true;
+	startOutput(channel, now());
+}
+
+void AnalogDiscoverySimulated::setAnalogOutputCustomData(int channel, const std::vector<double>& data)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__, channel);
+
+	if (data.size() > static_cast<size_t>(s_customDataSize))
+		throw AnalogDiscoveryException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
+									   ("Custom data exceeds " + std::to_string(s_customDataSize) + " samples").c_str());
+
+	auto &o = m_outputs[channel];
+	o.custom = data;
+
+	// WaveformPlay takes it as prefill
+	o.play.assign(data.begin(), data.end());
+	o.played = 0;
+	o.checked = 0;
+}
+
+int AnalogDiscoverySimulated::analogOutputCustomDataMaxSize(int channel)
+{
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__, channel);
+	return s_customDataSize;
+}
+
+void AnalogDiscoverySimulated::setAnalogOutputRunDuration(int channel, double s)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__, channel);
+
+	m_outputs[channel].runDuration = s;
+}
+
+void AnalogDiscoverySimulated::setAnalogOutputRepeat(int channel, int)
+{
+	// Every run is a single one here
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__, channel);
+}
+
+void AnalogDiscoverySimulated::setAnalogOutputMaster(int channel, int master)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__, channel);
+
+	if (master < 0 || master > 1)
+		throw AnalogDiscoveryException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0, ("No such channel: " + std::to_string(master)).c_str());
+
+	m_outputs[channel].master = master;
+}
+
+AnalogDiscovery::SampleState AnalogDiscoverySimulated::analogOutputPlayState(int channel)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__, channel);
+
+	auto &o = m_outputs[channel];
+	SampleState ret = {s_customDataSize, 0, 0};
+	if (!o.running)
+		return ret;
+
+	// What the generator has played by now, against what it got
+	size_t due = static_cast<size_t>(std::max(0.0, (now() - o.start) * o.frequency));
+	if (o.runDuration > 0.0)
+		due = std::min(due, static_cast<size_t>(o.runDuration * o.frequency));
+	size_t written = o.played + o.play.size();
+
+	if (due > std::max(written, o.checked))
+		ret.lost = static_cast<int>(due - std::max(written, o.checked));
+	o.checked = std::max(o.checked, due);
+
+	size_t queued = written > due ? written - due : 0;
+	ret.available = std::max(0, s_customDataSize - static_cast<int>(queued));
+	return ret;
+}
+
+void AnalogDiscoverySimulated::writeAnalogOutputPlayData(int channel, const double *data, int size)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__, channel);
+
+	m_outputs[channel].play.insert(m_outputs[channel].play.end(), data, data + size);
+}
+
+double AnalogDiscoverySimulated::setAnalogInputSamplingFreq(double f)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	// Rates are the base clock divided by an integer
+	double divider = std::max(1.0, std::round(s_baseFrequency / f));
+	m_samplingFrequency = s_baseFrequency / divider;
+
+	if (m_samplingFrequency != f) {
+		std::string dbg = "Sampling Frequency should be " + std::to_string(f) + " but is " + std::to_string(m_samplingFrequency);
+		Debug::verbose("AnalogDiscoverySimulated", dbg);
+	}
+
+	return m_samplingFrequency;
+}
+
+double AnalogDiscoverySimulated::analogInputSamplingFreq()
+{
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+	return m_samplingFrequency;
+}
+
+double AnalogDiscoverySimulated::analogInputMaxSamplingFreq()
+{
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+	return s_baseFrequency;
+}
+
+void AnalogDiscoverySimulated::setAnalogInputRange(int channel, double v)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__, channel);
+
+	m_inputs[channel].range = v;
+}
+
+void AnalogDiscoverySimulated::setAnalogInputEnabled(int channel, bool e)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__, channel);
+
+	m_inputs[channel].enabled = e;
+}
+
+void AnalogDiscoverySimulated::setAnalogInputAcquisitionMode(AcquisitionMode m)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	m_acquisitionMode = m;
+}
+
+double AnalogDiscoverySimulated::setAnalogInputAcquisitionDuration(double s)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	// Whole samples at the current rate
+	m_recordLength = std::round(s * m_samplingFrequency) / m_samplingFrequency;
+	return m_recordLength;
+}
+
+double AnalogDiscoverySimulated::analogInputAcquisitionDuration()
+{
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+	return m_recordLength;
+}
+
+void AnalogDiscoverySimulated::setAnalogInputReconfigure(bool)
+{
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+void AnalogDiscoverySimulated::setAnalogInputStart(bool s)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	for (auto &i : m_inputs)
+		i.pending.clear();
+	m_generated = 0;
+	m_lost = 0;
+
+	if (!s) {
+		m_inputState = DeviceStateReady;
+		return;
+	}
+
+	// The DUT model runs at the input rate
+	for (auto &i : m_inputs) {
+		i.highPass = Biquad();
+		i.lowPass = Biquad();
+		if (m_model.highPass > 0.0 && m_model.highPass < 0.45 * m_samplingFrequency)
+			i.highPass = Biquad::highPass(m_model.highPass, m_samplingFrequency);
+		if (m_model.lowPass > 0.0 && m_model.lowPass < 0.45 * m_samplingFrequency)
+			i.lowPass = Biquad::lowPass(m_model.lowPass, m_samplingFrequency);
+	}
+
+	if (m_acquisitionMode != AcquisitionModeRecord)
+		m_recordSamples = m_bufferSize;
+	else if (m_recordLength > 0.0)
+		m_recordSamples = static_cast<size_t>(std::llround(m_recordLength * m_samplingFrequency));
+	else
+		m_recordSamples = std::numeric_limits<size_t>::max();
+
+	m_armed = now();
+	m_inputState = DeviceStateArmed;
+
+	if (m_triggerSource == TriggerSourceNone)
+		trigger(m_armed);
+}
+
+void AnalogDiscoverySimulated::setAnalogInputBufferSize(int s)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	m_bufferSize = std::max(16, std::min(s, s_maxBufferSize));
+}
+
+void AnalogDiscoverySimulated::setAnalogInputTriggerSource(TriggerSource t)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	m_triggerSource = t;
+}
+
+void AnalogDiscoverySimulated::setAnalogInputTriggerAutoTimeout(double t)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	m_triggerAutoTimeout = t;
+}
+
+// The level detector is not simulated, analog and external sources only fire by auto timeout
+void AnalogDiscoverySimulated::setAnalogInputTriggerChannel(int c)
+{
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__, c);
+}
+
+void AnalogDiscoverySimulated::setAnalogInputTriggerType(TriggerType)
+{
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+void AnalogDiscoverySimulated::setAnalogInputTriggerLevel(double)
+{
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+void AnalogDiscoverySimulated::setAnalogInputTriggerCondition(TriggerCondition)
+{
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+}
+
+void AnalogDiscoverySimulated::setAnalogInputTriggerPosition(double s)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	m_triggerPosition = s;
+}
+
+void AnalogDiscoverySimulated::triggerAnalogInput()
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	if (m_inputState == DeviceStateArmed && m_triggerSource == TriggerSourcePC)
+		trigger(now());
+}
+
+int AnalogDiscoverySimulated::analogInputBufferSize()
+{
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+	return m_bufferSize;
+}
+
+AnalogDiscovery::SampleState AnalogDiscoverySimulated::analogInSampleState()
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	update();
+
+	SampleState ret = {0, m_lost, 0};
+	for (auto &i : m_inputs) {
+		if (i.enabled)
+			ret.available = static_cast<int>(i.pending.size());
+	}
+	// What is left of an overflowed buffer can not be trusted
+	if (ret.lost)
+		ret.corrupted = std::min(ret.available, ret.lost);
+
+	m_lost = 0;
+	return ret;
+}
+
+void AnalogDiscoverySimulated::readAnalogInput(int channel, double *buffer, int size)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__, channel);
+
+	auto &pending = m_inputs[channel].pending;
+	size_t count = std::min(static_cast<size_t>(std::max(size, 0)), pending.size());
+
+	std::copy(pending.begin(), pending.begin() + count, buffer);
+	std::fill(buffer + count, buffer + std::max(size, 0), 0.0);
+	pending.erase(pending.begin(), pending.begin() + count);
+}
+
+unsigned int AnalogDiscoverySimulated::digitalIoOutputEnable()
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	return m_ioOutputEnable;
+}
+
+void AnalogDiscoverySimulated::setDigitalIoOutputEnable(unsigned int mask)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	m_ioOutputEnable = mask & 0xffff;
+}
+
+unsigned int AnalogDiscoverySimulated::digitalIoOutput()
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	return m_ioOutput;
+}
+
+void AnalogDiscoverySimulated::setDigitalIoOutput(unsigned int mask)
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex);
+	call(__PRETTY_FUNCTION__, __FILE__, __LINE__);
+
+	m_ioOutput = mask & 0xffff;
+}
+
+//Static
+std::list<AnalogDiscovery::DeviceId> AnalogDiscoverySimulated::getDevices()
+{
+	return { {0, 0, 0} };
+}
+
+void AnalogDiscoverySimulated::call(const char *func, const char *file, int line, int channel)
+{
+	countCall();
+
+	if (channel < 0 || channel > 1)
+		throw AnalogDiscoveryException(func, file, line, 0, ("No such channel: " + std::to_string(channel)).c_str());
+}
+
+double AnalogDiscoverySimulated::now() const
+{
+	return std::chrono::duration<double>(Clock::now() - m_epoch).count();
+}
+
+void AnalogDiscoverySimulated::startOutput(int channel, double when)
+{
+	auto &o = m_outputs[channel];
+	o.running = true;
+	o.start = when;
+	o.checked = 0;
+
+	// Linked channels start with their master
+	for (int c=0; c<2; c++) {
+		if (c != channel && m_outputs[c].master == channel && m_outputs[c].enabled) {
+			m_outputs[c].running = true;
+			m_outputs[c].start = when;
+			m_outputs[c].checked = 0;
+		}
+	}
+
+	if (m_inputState == DeviceStateArmed && m_triggerSource == TriggerSourceAnalogOut1 + channel)
+		trigger(when);
+}
+
+void AnalogDiscoverySimulated::trigger(double when)
+{
+	m_recordStart = when + m_triggerPosition;
+	m_inputState = DeviceStateRunningTriggered;
+}
+
+void AnalogDiscoverySimulated::update()
+{
+	double t = now();
+
+	if (m_inputState == DeviceStateArmed && m_triggerAutoTimeout > 0.0 && t >= m_armed + m_triggerAutoTimeout)
+		trigger(m_armed + m_triggerAutoTimeout);
+
+	if (m_inputState != DeviceStateRunningTriggered)
+		return;
+
+	size_t due = t > m_recordStart ? static_cast<size_t>((t - m_recordStart) * m_samplingFrequency) : 0;
+	due = std::min(due, m_recordSamples);
+
+	if (due > m_generated) {
+		// More than the buffer holds would be dropped right away, skip synthesizing it
+		size_t count = due - m_generated;
+		size_t skip = count > static_cast<size_t>(m_bufferSize) ? count - m_bufferSize : 0;
+		if (skip && m_generated) {
+			m_generated += skip;
+			m_lost += static_cast<int>(skip);
+			count -= skip;
+		}
+		generate(count);
+	}
+
+	// The device overwrites the oldest samples, once the reader falls behind
+	for (auto &i : m_inputs) {
+		if (!i.enabled || i.pending.size() <= static_cast<size_t>(m_bufferSize))
+			continue;
+
+		size_t dropped = i.pending.size() - m_bufferSize;
+		i.pending.erase(i.pending.begin(), i.pending.begin() + dropped);
+		m_lost = std::max(m_lost, static_cast<int>(dropped));
+	}
+
+	bool empty = true;
+	for (auto &i : m_inputs)
+		empty = empty && i.pending.empty();
+
+	if (m_generated >= m_recordSamples && empty)
+		m_inputState = DeviceStateDone;
+}
+
+void AnalogDiscoverySimulated::generate(size_t count)
+{
+	const double dt = 1.0 / m_samplingFrequency;
+
+	for (int c=0; c<2; c++) {
+		auto &in = m_inputs[c];
+		if (!in.enabled)
+			continue;
+
+		// Let the filters settle on what was played before the record started
+		if (m_generated == 0) {
+			auto &o = m_outputs[c];
+			double first = m_recordStart - m_model.latency;
+			if (o.running && o.start < first) {
+				double from = std::max(o.start, first - s_warmUp);
+				size_t warmUp = static_cast<size_t>((first - from) * m_samplingFrequency);
+				for (size_t n=warmUp; n>0; n--)
+					respond(c, outputValue(c, first - n * dt), false);
+			}
+		}
+
+		const double limit = in.range / 2.0;
+		for (size_t n=0; n<count; n++) {
+			double t = m_recordStart + (m_generated + n) * dt - m_model.latency;
+			double y = respond(c, outputValue(c, t), true);
+			in.pending.push_back(std::max(-limit, std::min(limit, y)));
+		}
+	}
+
+	m_generated += count;
+}
+
+double AnalogDiscoverySimulated::outputValue(int channel, double t)
+{
+	auto &o = m_outputs[channel];
+	if (!o.running || t < o.start)
+		return 0.0;
+	if (o.runDuration > 0.0 && t >= o.start + o.runDuration)
+		return 0.0;
+
+	double phase = (t - o.start) * o.frequency;
+	double frac = phase - std::floor(phase);
+
+	switch (o.waveform) {
+	case WaveformDc:
+		return o.amplitude;
+	case WaveformSine:
+		return o.amplitude * std::sin(2.0 * M_PI * frac);
+	case WaveformSquare:
+		return frac < 0.5 ? o.amplitude : -o.amplitude;
+	case WaveformTriangle:
+		if (frac < 0.25)
+			return o.amplitude * 4.0 * frac;
+		if (frac < 0.75)
+			return o.amplitude * (2.0 - 4.0 * frac);
+		return o.amplitude * (4.0 * frac - 4.0);
+	case WaveformRampUp:
+		return o.amplitude * (2.0 * frac - 1.0);
+	case WaveformRampDown:
+		return o.amplitude * (1.0 - 2.0 * frac);
+	case WaveformNoise:
+		return o.amplitude * std::uniform_real_distribution<double>(-1.0, 1.0)(m_random);
+	case WaveformCustom:
+		if (o.custom.empty())
+			return 0.0;
+		return o.amplitude * o.custom[std::min(o.custom.size() - 1, static_cast<size_t>(frac * o.custom.size()))];
+	case WaveformPlay: {
+		// At frequency samples per second, each one once. Samples come in order.
+		size_t index = static_cast<size_t>(phase);
+		if (index < o.played)
+			return 0.0;
+		size_t drop = std::min(index - o.played, o.play.size());
+		o.play.erase(o.play.begin(), o.play.begin() + drop);
+		o.played += drop;
+		if (o.play.empty())
+			return 0.0;
+		return o.amplitude * o.play.front();
+	}
+	}
+
+	return 0.0;
+}
+
+double AnalogDiscoverySimulated::respond(int channel, double x, bool noise)
+{
+	auto &in = m_inputs[channel];
+
+	double y = x + 2.0 * m_model.distortion * x * x;
+	y = in.lowPass.process(in.highPass.process(y));
+	y *= m_gain;
+
+	if (noise && m_model.noise > 0.0)
+		y += m_model.noise * m_noise(m_random);
+
+	return y;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <random>
+
+#include "analogdiscovery.h"
+#include "dsp.h"
+
+// Software device for sweeps and benchmarks without hardware. Each output is wired
+// to the input of the same channel through a model of the DUT: second order
+// nonlinearity, Butterworth high- and lowpass, gain, latency and gaussian noise.
+// Time runs on the wall clock, so records fill up as fast as on the real device and
+// a reader too slow for the buffer sees lost and corrupted samples.
+// Digital IO only lives in memory.
+class AnalogDiscoverySimulated : public AnalogDiscovery
+{
+public:
+	typedef AnalogDiscovery basetype;
+
+	struct Model {
+		double gain;		// dB
+		double highPass;	// Hz, 0 disables
+		double lowPass;		// Hz, 0 disables
+		double noise;		// V rms at the input
+		double distortion;	// Second harmonic relative to the fundamental at 1V peak
+		double latency;		// Seconds from output to input
+
+		Model();
+		// Comma separated key=value list, keys: gain, hp, lp, noise, hd2, latency.
+		// Keys not mentioned keep their default.
+		static Model fromString(const std::string& spec);
+	};
+
+	// Model of devices created from now on
+	static void setDefaultModel(const Model& m);
+	static Model defaultModel();
+
+	AnalogDiscoverySimulated(const DeviceId& device);
+	AnalogDiscoverySimulated(const DeviceId& device, const Model& model);
+	virtual ~AnalogDiscoverySimulated(void);
+
+	virtual std::string version();
+	virtual void setAnalogOutputWaveform(int channel, Waveform w);
+	virtual void setAnalogOutputAmplitude(int channel, double v);
+	virtual void setAnalogOutputFrequency(int channel, double f);
+	virtual void setAnalogOutputEnabled(int channel, bool e);
+	virtual void startAnalogOutput(int channel);
+	virtual void setAnalogOutputCustomData(int channel, const std::vector<double>& data);
+	virtual int analogOutputCustomDataMaxSize(int channel);
+	virtual void setAnalogOutputRunDuration(int channel, double s);
+	virtual void setAnalogOutputRepeat(int channel, int count);
+	virtual SampleState analogOutputPlayState(int channel);
+	virtual void writeAnalogOutputPlayData(int channel, const double *data, int size);
+	virtual void setAnalogOutputMaster(int channel, int master);
+	virtual double setAnalogInputSamplingFreq(double f);
+	virtual double analogInputSamplingFreq();
+	virtual double analogInputMaxSamplingFreq();
+	virtual void setAnalogInputRange(int channel, double v);
+	virtual void setAnalogInputEnabled(int channel, bool e);
+	virtual void setAnalogInputAcquisitionMode(AcquisitionMode m);
+	virtual double setAnalogInputAcquisitionDuration(double s);
+	virtual double analogInputAcquisitionDuration();
+	virtual void setAnalogInputReconfigure(bool r);
+	virtual void setAnalogInputStart(bool s);
+	virtual void setAnalogInputBufferSize(int s);
+	virtual void setAnalogInputTriggerSource(TriggerSource t);
+	virtual void setAnalogInputTriggerAutoTimeout(double t);
+	virtual void setAnalogInputTriggerChannel(int c);
+	virtual void setAnalogInputTriggerType(TriggerType t);
+	virtual void setAnalogInputTriggerLevel(double l);
+	virtual void setAnalogInputTriggerCondition(TriggerCondition c);
+	virtual void setAnalogInputTriggerPosition(double s);
+	virtual void triggerAnalogInput();
+	virtual int analogInputBufferSize();
+	virtual bool isOpen(void) const;
+	virtual void readAnalogInput(int channel, double *buffer, int size);
+	virtual SampleState analogInSampleState();
+	virtual DeviceState analogOutputStatus(int channel);
+	virtual DeviceState analogInputStatus(int channel);
+
+	// One simulated device
+	static std::list<DeviceId> getDevices();
+
+protected:
+	virtual unsigned int digitalIoOutputEnable();
+	virtual void setDigitalIoOutputEnable(unsigned int mask);
+	virtual unsigned int digitalIoOutput();
+	virtual void setDigitalIoOutput(unsigned int mask);
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Output {
+		Waveform waveform;
+		double amplitude;
+		double frequency;
+		double runDuration;
+		int master;
+		bool enabled;
+		bool running;
+		double start;
+		std::vector<double> custom;
+		// WaveformPlay: samples not played yet, played is the index of the first one
+		std::deque<double> play;
+		size_t played;
+		// Underruns are reported up to this sample
+		size_t checked;
+	};
+
+	struct Input {
+		bool enabled;
+		double range;
+		Biquad highPass;
+		Biquad lowPass;
+		std::deque<double> pending;
+	};
+
+	Model m_model;
+	double m_gain;
+	mutable std::recursive_mutex m_mutex;
+	std::mt19937 m_random;
+	std::normal_distribution<double> m_noise;
+
+	Output m_outputs[2];
+	Input m_inputs[2];
+
+	AcquisitionMode m_acquisitionMode;
+	double m_samplingFrequency;
+	double m_recordLength;
+	int m_bufferSize;
+	TriggerSource m_triggerSource;
+	double m_triggerAutoTimeout;
+	double m_triggerPosition;
+
+	// Times are seconds since construction
+	Clock::time_point m_epoch;
+	DeviceState m_inputState;
+	double m_armed;
+	double m_recordStart;
+	size_t m_recordSamples;
+	size_t m_generated;
+	int m_lost;
+
+	unsigned int m_ioOutputEnable;
+	unsigned int m_ioOutput;
+
+	const static double s_baseFrequency;
+	const static int s_maxBufferSize;
+	const static int s_customDataSize;
+	const static double s_warmUp;
+	static Model s_defaultModel;
+
+	// Counts the call and checks the channel
+	void call(const char *func, const char *file, int line, int channel = 0);
+	double now() const;
+	void startOutput(int channel, double when);
+	void trigger(double when);
+	// Brings the record up to now
+	void update();
+	void generate(size_t count);
+	double outputValue(int channel, double t);
+	double respond(int channel, double x, bool noise);
+};
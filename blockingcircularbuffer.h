@@ -48,8 +48,9 @@ public:
 
 	bool set(T *buffer, unsigned int size, std::chrono::milliseconds timeout)
 	{
+		// One slot stays free, a full buffer would look empty
 		std::unique_lock<std::mutex> mlock(m_mutex);
-		while (availableToWrite() < size || !m_buffer) {
+		while (availableToWrite() <= size || !m_buffer) {
 			if (m_condition.wait_for(mlock, timeout) == std::cv_status::timeout)
 				return false;
 		}
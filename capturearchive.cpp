@@ -0,0 +1,148 @@
+#include "capturearchive.h"
+
+#include <string.h>
+
+#include "debug.h"
+
+extern "C" {
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+}
+
+static_assert(sizeof(CaptureArchiveHeader) == 64, "CaptureArchiveHeader is laid out without padding");
+static_assert(sizeof(CaptureChunkHeader) == 64, "CaptureChunkHeader is laid out without padding");
+
+const char CaptureArchiveHeader::s_magic[8] = {'F', 'R', 'C', 'A', 'P', 'T', 'U', 'R'};
+const uint32_t CaptureArchiveHeader::s_version = 1;
+const uint32_t CaptureChunkHeader::s_magic = 0x4b4e4843; // "CHNK"
+
+CaptureArchiveWriter::CaptureArchiveWriter(const std::string &fileName, const CaptureArchiveHeader &header) :
+	m_fd(open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)),
+	m_fileName(fileName)
+{
+	if (m_fd < 0)
+		throw ResultException(__PRETTY_FUNCTION__, __FILE__, __LINE__, errno,
+							  ("Can not create " + fileName + ": " + strerror(errno)).c_str());
+
+	try {
+		write(&header, sizeof(header), nullptr, 0);
+	} catch (...) {
+		close(m_fd);
+		throw;
+	}
+}
+
+CaptureArchiveWriter::~CaptureArchiveWriter()
+{
+	close(m_fd);
+}
+
+void CaptureArchiveWriter::append(CaptureChunkHeader header, SampleView samples)
+{
+	header.magic = CaptureChunkHeader::s_magic;
+	header.samples = samples.size();
+	write(&header, sizeof(header), samples.data(), samples.size() * sizeof(double));
+}
+
+// Static
+CaptureArchiveHeader CaptureArchiveWriter::header(double fMin, double fMax, int pointsPerDecade, int channelCount)
+{
+	CaptureArchiveHeader ret;
+	memset(&ret, 0, sizeof(ret));
+	memcpy(ret.magic, CaptureArchiveHeader::s_magic, sizeof(ret.magic));
+	ret.version = CaptureArchiveHeader::s_version;
+	ret.fMin = fMin;
+	ret.fMax = fMax;
+	ret.pointsPerDecade = pointsPerDecade;
+	ret.channelCount = channelCount;
+	return ret;
+}
+
+void CaptureArchiveWriter::write(const void *data, size_t size, const void *data2, size_t size2)
+{
+	struct iovec iov[2] = {
+		{const_cast<void*>(data), size},
+		{const_cast<void*>(data2), size2}
+	};
+	int count = size2 ? 2 : 1;
+	int i = 0;
+
+	while (i < count) {
+		ssize_t ret = TEMP_FAILURE_RETRY(writev(m_fd, &iov[i], count - i));
+		if (ret < 0)
+			throw ResultException(__PRETTY_FUNCTION__, __FILE__, __LINE__, errno,
+								  ("Can not write " + m_fileName + ": " + strerror(errno)).c_str());
+
+		// Short write, go on with what is left
+		size_t done = ret;
+		while (i < count && done >= iov[i].iov_len) {
+			done -= iov[i].iov_len;
+			i++;
+		}
+		if (i < count) {
+			iov[i].iov_base = static_cast<char*>(iov[i].iov_base) + done;
+			iov[i].iov_len -= done;
+		}
+	}
+}
+
+CaptureArchive::CaptureArchive(const std::string &fileName) :
+	m_file(fileName),
+	m_truncated(false)
+{
+	const char *data = m_file.data();
+	const size_t size = m_file.size();
+
+	if (size < sizeof(CaptureArchiveHeader) || memcmp(data, CaptureArchiveHeader::s_magic, sizeof(CaptureArchiveHeader::s_magic)) != 0)
+		throw ResultException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0, (fileName + " is no capture archive").c_str());
+
+	if (header().version != CaptureArchiveHeader::s_version)
+		throw ResultException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
+							  (fileName + " has unknown version " + std::to_string(header().version)).c_str());
+
+	size_t offset = sizeof(CaptureArchiveHeader);
+	while (offset < size) {
+		auto chunk = reinterpret_cast<const CaptureChunkHeader*>(data + offset);
+
+		if (size - offset < sizeof(CaptureChunkHeader) ||
+				(size - offset - sizeof(CaptureChunkHeader)) / sizeof(double) < chunk->samples) {
+			m_truncated = true;
+			break;
+		}
+
+		if (chunk->magic != CaptureChunkHeader::s_magic)
+			throw ResultException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
+								  (fileName + " has no chunk at offset " + std::to_string(offset)).c_str());
+
+		offset += sizeof(CaptureChunkHeader);
+		m_captures.push_back({chunk, SampleView(reinterpret_cast<const double*>(data + offset), chunk->samples)});
+		offset += chunk->samples * sizeof(double);
+	}
+
+	if (m_truncated)
+		Debug::warning("CaptureArchive", fileName + " ends within a chunk, " + std::to_string(m_captures.size()) + " complete ones");
+}
+
+const CaptureArchiveHeader &CaptureArchive::header() const
+{
+	return *reinterpret_cast<const CaptureArchiveHeader*>(m_file.data());
+}
+
+const std::vector<CaptureArchive::Capture> &CaptureArchive::captures() const
+{
+	return m_captures;
+}
+
+bool CaptureArchive::truncated() const
+{
+	return m_truncated;
+}
+
+// Static
+PointEstimate CaptureArchive::estimate(const Capture &capture, Estimator estimator)
+{
+	return estimatePoint(estimator, capture.samples, capture.header->skip, capture.header->count,
+						 capture.header->frequency, capture.header->samplingFrequency);
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "capturebuffer.h"
+#include "estimator.h"
+#include "resultwriter.h"
+
+// Raw records of a stepped sine sweep, to analyze them again without the
+// hardware. An archive is a CaptureArchiveHeader followed by one chunk per
+// record and channel: a CaptureChunkHeader, then its samples as doubles, all in
+// host byte order. Every part is a multiple of 8 bytes, so the samples of a
+// mapped archive are aligned and used in place.
+struct CaptureArchiveHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t estimator;			// Estimator of the sweep
+	uint32_t pointsPerDecade;
+	uint32_t channelCount;
+	double fMin;
+	double fMax;
+	double targetSnr;
+	double maxSettle;			// Seconds
+	double settleTolerance;		// dB
+
+	const static char s_magic[8];
+	const static uint32_t s_version;
+};
+
+struct CaptureChunkHeader {
+	uint32_t magic;				// s_magic, a chunk starts with it
+	uint32_t point;				// Index of the measuring point in the sweep
+	int32_t channel;
+	int32_t lost;				// Samples the device reported lost during the record
+	int32_t corrupted;			// and corrupted
+	uint32_t reserved;
+	double frequency;
+	double samplingFrequency;
+	uint64_t skip;				// Samples of settle time in front of the analyzed ones
+	uint64_t count;				// Samples analyzed after skip
+	uint64_t samples;			// Samples following this header
+
+	const static uint32_t s_magic;
+};
+
+// Appends chunks to a new archive. Each one goes out with a single write, so
+// an aborted sweep leaves all chunks but maybe the last one complete.
+class CaptureArchiveWriter
+{
+public:
+	// Truncates fileName. Throws, if it can not be created.
+	CaptureArchiveWriter(const std::string &fileName, const CaptureArchiveHeader &header);
+	CaptureArchiveWriter(const CaptureArchiveWriter&) = delete;
+	CaptureArchiveWriter& operator=(const CaptureArchiveWriter&) = delete;
+	~CaptureArchiveWriter();
+
+	// header.samples is set from samples
+	void append(CaptureChunkHeader header, SampleView samples);
+
+	// The header for sweep parameters, everything else zero
+	static CaptureArchiveHeader header(double fMin, double fMax, int pointsPerDecade, int channelCount);
+
+private:
+	int m_fd;
+	std::string m_fileName;
+
+	void write(const void *data, size_t size, const void *data2, size_t size2);
+};
+
+// An archive mapped read only. The records are never copied, the views point
+// into the mapping and stay valid as long as the archive does.
+class CaptureArchive
+{
+public:
+	struct Capture {
+		const CaptureChunkHeader *header;
+		SampleView samples;		// Whole record, settle time included
+	};
+
+	// Throws, if fileName is no archive. A chunk cut short at the end is left out.
+	explicit CaptureArchive(const std::string &fileName);
+
+	const CaptureArchiveHeader &header() const;
+	const std::vector<Capture> &captures() const;
+	// An incomplete chunk was found at the end
+	bool truncated() const;
+
+	// What Measurement::run() made of the record, with the given estimator
+	static PointEstimate estimate(const Capture &capture, Estimator estimator);
+
+private:
+	MappedFile m_file;
+	std::vector<Capture> m_captures;
+	bool m_truncated;
+};
@@ -0,0 +1,84 @@
+#include "capturebuffer.h"
+
+#include <algorithm>
+#include <string>
+
+#include "debug.h"
+
+SampleView SampleView::slice(size_t offset, size_t count) const
+{
+	offset = std::min(offset, m_size);
+	return SampleView(m_data + offset, std::min(count, m_size - offset));
+}
+
+SampleView SampleView::trimmed(size_t front, size_t back) const
+{
+	if (front + back >= m_size)
+		return SampleView(m_data + std::min(front, m_size), 0);
+
+	return SampleView(m_data + front, m_size - front - back);
+}
+
+std::vector<double> SampleView::toVector() const
+{
+	return std::vector<double>(begin(), end());
+}
+
+CaptureBuffer::CaptureBuffer(size_t channelCount, size_t capacity) :
+	m_channels(std::max<size_t>(1, channelCount)),
+	m_size(0),
+	m_capacity(0)
+{
+	reserve(capacity);
+}
+
+void CaptureBuffer::reserve(size_t capacity)
+{
+	if (capacity <= m_capacity)
+		return;
+
+	for (auto &c : m_channels)
+		c.resize(capacity);
+	m_capacity = capacity;
+}
+
+size_t CaptureBuffer::capacity() const
+{
+	return m_capacity;
+}
+
+size_t CaptureBuffer::channelCount() const
+{
+	return m_channels.size();
+}
+
+size_t CaptureBuffer::size() const
+{
+	return m_size;
+}
+
+void CaptureBuffer::clear()
+{
+	m_size = 0;
+}
+
+double *CaptureBuffer::writePointer(size_t channel, size_t count)
+{
+	if (m_size + count > m_capacity) {
+		// The device delivered more than planned, should not happen in a sweep
+		Debug::verbose("CaptureBuffer", "Growing from " + std::to_string(m_capacity) + " samples per channel");
+		reserve(std::max(2 * m_capacity, m_size + count));
+	}
+
+	return m_channels[channel].data() + m_size;
+}
+
+void CaptureBuffer::commit(size_t count)
+{
+	m_size = std::min(m_size + count, m_capacity);
+}
+
+SampleView CaptureBuffer::view(size_t channel) const
+{
+	return SampleView(m_channels[channel].data(), m_size);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+// Non-owning view of samples, only valid as long as the buffer behind it is not
+// cleared or grown. Trimming moves offsets, the samples are never touched.
+class SampleView
+{
+public:
+	SampleView() : m_data(nullptr), m_size(0) {}
+	SampleView(const double *data, size_t size) : m_data(data), m_size(size) {}
+
+	const double *data() const { return m_data; }
+	size_t size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+
+	const double *begin() const { return m_data; }
+	const double *end() const { return m_data + m_size; }
+	double operator[](size_t i) const { return m_data[i]; }
+
+	// count samples from offset on, clamped to what is there
+	SampleView slice(size_t offset, size_t count) const;
+	// Drops front samples at the start and back samples at the end
+	SampleView trimmed(size_t front, size_t back) const;
+
+	std::vector<double> toVector() const;
+
+private:
+	const double *m_data;
+	size_t m_size;
+};
+
+// Preallocated storage for records of one or more channels. The device writes
+// straight into it, clear() keeps the memory, so a buffer sized once for the
+// longest record is reused for every point of a sweep without allocating.
+class CaptureBuffer
+{
+public:
+	explicit CaptureBuffer(size_t channelCount = 1, size_t capacity = 0);
+
+	// Samples per channel the storage holds. Only ever grows.
+	void reserve(size_t capacity);
+	size_t capacity() const;
+
+	size_t channelCount() const;
+	// Samples per channel written so far
+	size_t size() const;
+
+	// Forgets the samples, keeps the storage
+	void clear();
+
+	// Room for count more samples of channel. Write all channels, then commit(count).
+	// Grows the storage if needed, which invalidates all views.
+	double *writePointer(size_t channel, size_t count);
+	void commit(size_t count);
+
+	SampleView view(size_t channel) const;
+
+private:
+	std::vector<std::vector<double>> m_channels;
+	size_t m_size;
+	size_t m_capacity;
+};
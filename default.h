@@ -1,6 +1,7 @@
 #pragma once
 
 #include "speaker.h"
+#include "measurement.h"
 
 // Command Line Parameters
 const char paramHelp[] = "help";
@@ -9,9 +10,19 @@ const char paramDebugLevel[] = "debug";
 const char paramSelfTest[] = "self-test";
 const char paramManualGpio[] = "manual-gpio";
 const char paramCalibrate[] = "calibrate";
+const char paramBenchmarkGpio[] = "benchmark-gpio";
+const char paramTestGpioChip[] = "test-gpiochip";
+const char paramBenchmarkGpioWatcher[] = "benchmark-gpio-watcher";
+const char paramTestDspKernels[] = "test-dsp-kernels";
+const char paramBenchmarkDspKernels[] = "benchmark-dsp-kernels";
+const char paramReanalyze[] = "reanalyze";
+const char paramBenchmarkCircularBuffers[] = "benchmark-circular-buffers";
+const char paramTestMethodLevels[] = "test-method-levels";
 
 const char paramListGpios[] = "list-gpios";
 const char paramSetGpios[] = "set-gpios";
+const char paramGpioMapping[] = "gpio-mapping";
+const char paramGpioProfile[] = "gpio-profile";
 
 
 const char paramChannel[] = "channel";
@@ -21,8 +32,16 @@ const char paramfMin[] = "fmin";
 const char paramfMax[] = "fmax";
 const char paramPointsPerDecade[] = "points-per-decade";
 const char paramOutputCalibration[] = "output-calibration";
+const char paramMethod[] = "method";
+const char paramEstimator[] = "estimator";
+const char paramTargetSnr[] = "target-snr";
+const char paramMaxSettle[] = "max-settle";
+const char paramSettleTolerance[] = "settle-tolerance";
 
 const char paramOutputFile[] = "output";
+const char paramOutputFormat[] = "output-format";
+const char paramArchiveCaptures[] = "archive-captures";
+const char paramSimulate[] = "simulate";
 
 
 int channel = -1;
@@ -32,4 +51,11 @@ double fMax = 20000;		// Default is 20kHz
 int pointsPerDecade = 20;	// 20 measurements per decade
 
 double outputCalibration = 0.0; // Default 0.0V to have 0dBu @ 1kHz
+Measurement::Method method = Measurement::MethodSteppedSine;
+Estimator estimator = EstimatorRms;
+double targetSnr = 40.0;	// dB per measuring point
+double maxSettle = 50.0;	// ms, what we always waited before
+double settleTolerance = 0.1;	// dB
 std::string  outputName = "MyMeasurement";
+ResultFormat outputFormat = ResultFormatText;
+bool archiveCaptures = false;
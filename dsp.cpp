@@ -0,0 +1,218 @@
+#include "dsp.h"
+
+#include <cmath>
+#include <string>
+
+#include "dspkernels.h"
+
+DSPException::DSPException(const char* func, const char* file, int line, int errorNumber, const char *what) :
+	basetype(func, file, line, errorNumber, what)
+{}
+
+const char* DSPException::what() const noexcept
+{
+	return basetype::what();
+}
+
+FFT::FFT(size_t size) :
+	m_size(size),
+	m_twiddles(size / 2),
+	m_bitReverse(size)
+{
+	if (!isPowerOfTwo(m_size))
+		throw DSPException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
+						   ("FFT size must be a power of two: " + std::to_string(m_size)).c_str());
+
+	for (size_t i=0; i<m_twiddles.size(); i++)
+		m_twiddles[i] = std::polar(1.0, -2.0 * M_PI * i / m_size);
+
+	int bits = 0;
+	while ((size_t(1) << bits) < m_size) bits++;
+
+	for (size_t i=0; i<m_size; i++) {
+		size_t r = 0;
+		for (int b=0; b<bits; b++)
+			if (i & (size_t(1) << b))
+				r |= size_t(1) << (bits - 1 - b);
+		m_bitReverse[i] = r;
+	}
+}
+
+size_t FFT::size() const
+{
+	return m_size;
+}
+
+void FFT::forward(ComplexVector *data) const
+{
+	transform(data, false);
+}
+
+void FFT::inverse(ComplexVector *data) const
+{
+	transform(data, true);
+
+	const double scale = 1.0 / m_size;
+	for (auto &v : *data)
+		v *= scale;
+}
+
+ComplexVector FFT::forward(const std::vector<double>& data) const
+{
+	ComplexVector ret(m_size);
+	size_t count = data.size() < m_size ? data.size() : m_size;
+	for (size_t i=0; i<count; i++)
+		ret[i] = Complex(data[i], 0.0);
+
+	transform(&ret, false);
+	return ret;
+}
+
+void FFT::transform(ComplexVector *data, bool inverse) const
+{
+	if (data->size() != m_size)
+		throw DSPException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
+						   ("FFT size mismatch: expected " + std::to_string(m_size) +
+							" got " + std::to_string(data->size())).c_str());
+
+	ComplexVector &d = *data;
+
+	for (size_t i=0; i<m_size; i++) {
+		size_t r = m_bitReverse[i];
+		if (r > i)
+			std::swap(d[i], d[r]);
+	}
+
+	for (size_t len=2; len<=m_size; len <<= 1) {
+		size_t half = len / 2;
+		size_t step = m_size / len;
+		for (size_t start=0; start<m_size; start+=len) {
+			for (size_t k=0; k<half; k++) {
+				Complex w = m_twiddles[k * step];
+				if (inverse)
+					w = std::conj(w);
+				Complex u = d[start + k];
+				Complex v = d[start + k + half] * w;
+				d[start + k] = u + v;
+				d[start + k + half] = u - v;
+			}
+		}
+	}
+}
+
+// Static
+bool FFT::isPowerOfTwo(size_t n)
+{
+	return n != 0 && (n & (n - 1)) == 0;
+}
+
+// Static
+size_t FFT::nextPowerOfTwo(size_t n)
+{
+	size_t ret = 1;
+	while (ret < n) ret <<= 1;
+	return ret;
+}
+
+double dBuForVolts(double v) {
+	static const double Uref = 0.7746;
+	return 20 * log(v / Uref);
+}
+
+double dBvForVolts(double v) {
+	static const double Uref = 1.0;
+	return 20 * log (v / Uref);
+}
+
+std::vector<double> hannWindow(size_t size)
+{
+	// Periodic Hann, so coherently sampled tones stay on their bins
+	std::vector<double> ret(size);
+	for (size_t i=0; i<size; i++)
+		ret[i] = 0.5 - 0.5 * std::cos(2.0 * M_PI * i / size);
+	return ret;
+}
+
+double coherentGain(const std::vector<double>& window)
+{
+	if (window.empty())
+		return 0.0;
+
+	return DSPKernels::mean(SampleView(window.data(), window.size()));
+}
+
+Complex dftAt(const double *x, size_t size, double frequency, double samplingFrequency)
+{
+	// Rotate a phasor instead of calling sin/cos per sample
+	const Complex step = std::polar(1.0, -2.0 * M_PI * frequency / samplingFrequency);
+	Complex phasor(1.0, 0.0);
+	Complex ret(0.0, 0.0);
+
+	for (size_t i=0; i<size; i++) {
+		ret += x[i] * phasor;
+		phasor *= step;
+		// Renormalize now and then, so rounding does not let the phasor drift
+		if ((i & 0x3ff) == 0x3ff)
+			phasor /= std::abs(phasor);
+	}
+
+	return ret;
+}
+
+double binAmplitude(const ComplexVector& spectrum, size_t bin, double windowCoherentGain)
+{
+	if (bin >= spectrum.size() || windowCoherentGain <= 0.0)
+		return 0.0;
+
+	// Single sided spectrum: half of the energy lives in the mirrored bin
+	return 2.0 * std::abs(spectrum[bin]) / (spectrum.size() * windowCoherentGain);
+}
+
+Biquad::Biquad() :
+	m_b0(1.0), m_b1(0.0), m_b2(0.0), m_a1(0.0), m_a2(0.0),
+	m_z1(0.0), m_z2(0.0)
+{}
+
+Biquad Biquad::lowPass(double cutoff, double samplingFrequency)
+{
+	const double w0 = 2.0 * M_PI * cutoff / samplingFrequency;
+	const double alpha = std::sin(w0) / std::sqrt(2.0);
+	const double a0 = 1.0 + alpha;
+
+	Biquad ret;
+	ret.m_b0 = (1.0 - std::cos(w0)) / 2.0 / a0;
+	ret.m_b1 = (1.0 - std::cos(w0)) / a0;
+	ret.m_b2 = ret.m_b0;
+	ret.m_a1 = -2.0 * std::cos(w0) / a0;
+	ret.m_a2 = (1.0 - alpha) / a0;
+	return ret;
+}
+
+Biquad Biquad::highPass(double cutoff, double samplingFrequency)
+{
+	const double w0 = 2.0 * M_PI * cutoff / samplingFrequency;
+	const double alpha = std::sin(w0) / std::sqrt(2.0);
+	const double a0 = 1.0 + alpha;
+
+	Biquad ret;
+	ret.m_b0 = (1.0 + std::cos(w0)) / 2.0 / a0;
+	ret.m_b1 = -(1.0 + std::cos(w0)) / a0;
+	ret.m_b2 = ret.m_b0;
+	ret.m_a1 = -2.0 * std::cos(w0) / a0;
+	ret.m_a2 = (1.0 - alpha) / a0;
+	return ret;
+}
+
+double Biquad::process(double x)
+{
+	const double y = m_b0 * x + m_z1;
+	m_z1 = m_b1 * x - m_a1 * y + m_z2;
+	m_z2 = m_b2 * x - m_a2 * y;
+	return y;
+}
+
+void Biquad::reset()
+{
+	m_z1 = 0.0;
+	m_z2 = 0.0;
+}
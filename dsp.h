@@ -0,0 +1,78 @@
+#pragma once
+
+#include <complex>
+#include <vector>
+
+#include "descriptiveexception.h"
+
+class DSPException : public DescriptiveException {
+public:
+	typedef DescriptiveException basetype;
+
+	DSPException(const char* func, const char* file, int line, int errorNumber, const char* what);
+	virtual const char* what() const noexcept;
+};
+
+typedef std::complex<double> Complex;
+typedef std::vector<Complex> ComplexVector;
+
+// Iterative radix-2 FFT. Twiddles and the bit reversal table are computed once
+// in the constructor, so keep the object around if you transform often.
+class FFT
+{
+public:
+	FFT(size_t size);
+
+	size_t size() const;
+
+	void forward(ComplexVector *data) const;
+	// Includes the 1/N scaling, so inverse(forward(x)) == x
+	void inverse(ComplexVector *data) const;
+
+	// Real input is zero padded (or truncated) to size()
+	ComplexVector forward(const std::vector<double>& data) const;
+
+	static bool isPowerOfTwo(size_t n);
+	static size_t nextPowerOfTwo(size_t n);
+
+private:
+	size_t m_size;
+	std::vector<Complex> m_twiddles;
+	std::vector<size_t> m_bitReverse;
+
+	void transform(ComplexVector *data, bool inverse) const;
+};
+
+// Levels of rms volts
+double dBuForVolts(double v);
+double dBvForVolts(double v);
+
+// Windows
+std::vector<double> hannWindow(size_t size);
+// Sum of window / size, to undo the amplitude loss of a window
+double coherentGain(const std::vector<double>& window);
+
+// DFT of x at one arbitrary frequency, phase referenced to x[0]
+Complex dftAt(const double *x, size_t size, double frequency, double samplingFrequency);
+
+// Peak amplitude of a sine hitting bin exactly, out of a windowed FFT
+double binAmplitude(const ComplexVector& spectrum, size_t bin, double windowCoherentGain);
+
+// Second order IIR section, direct form II transposed. The factories design
+// Butterworth (Q = 1/sqrt(2)) filters through the bilinear transform.
+class Biquad
+{
+public:
+	// Passes everything through
+	Biquad();
+
+	static Biquad lowPass(double cutoff, double samplingFrequency);
+	static Biquad highPass(double cutoff, double samplingFrequency);
+
+	double process(double x);
+	void reset();
+
+private:
+	double m_b0, m_b1, m_b2, m_a1, m_a2;
+	double m_z1, m_z2;
+};
@@ -0,0 +1,408 @@
+#include "dspkernels.h"
+
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DSP_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#define DSP_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+// Built with -ffp-contract=off: a multiply and add fused into one instruction
+// rounds differently, and the versions would not match the reference anymore.
+
+// Enough independent sums to hide the latency of the compensation
+static const size_t lanes = 16;
+
+struct Lanes {
+	double sum[lanes];
+	double compensation[lanes];
+};
+
+static inline void kahanAdd(double *sum, double *compensation, double value)
+{
+	double y = value - *compensation;
+	double t = *sum + y;
+	*compensation = (t - *sum) - y;
+	*sum = t;
+}
+
+// Adds samples from start on to their lanes, then the lanes to one sum in a fixed
+// order. Every version ends here, the vector ones with start past their last block.
+template <bool Square>
+static double finish(Lanes *l, const double *x, size_t start, size_t size, double offset)
+{
+	for (size_t i=start; i<size; i++) {
+		double v = x[i];
+		if (Square) {
+			v = v - offset;
+			v = v * v;
+		}
+		kahanAdd(&l->sum[i % lanes], &l->compensation[i % lanes], v);
+	}
+
+	double sum = 0.0;
+	double compensation = 0.0;
+	for (size_t i=0; i<lanes; i++)
+		kahanAdd(&sum, &compensation, l->sum[i]);
+	for (size_t i=0; i<lanes; i++)
+		kahanAdd(&sum, &compensation, -l->compensation[i]);
+
+	return sum - compensation;
+}
+
+template <bool Square>
+static double reduceScalar(const double *x, size_t size, double offset)
+{
+	Lanes l;
+	for (size_t i=0; i<lanes; i++) {
+		l.sum[i] = 0.0;
+		l.compensation[i] = 0.0;
+	}
+	return finish<Square>(&l, x, 0, size, offset);
+}
+
+static void subtractScalar(const double *x, double offset, double *out, size_t size)
+{
+	for (size_t i=0; i<size; i++)
+		out[i] = x[i] - offset;
+}
+
+static void multiplyScalar(const double *x, const double *window, double *out, size_t size)
+{
+	for (size_t i=0; i<size; i++)
+		out[i] = x[i] * window[i];
+}
+
+#ifdef DSP_KERNELS_X86
+
+// Two lanes per register
+template <bool Square>
+__attribute__((target("sse2")))
+static double reduceSse2(const double *x, size_t size, double offset)
+{
+	const size_t registers = lanes / 2;
+	__m128d s[registers], c[registers];
+	for (size_t r=0; r<registers; r++) {
+		s[r] = _mm_setzero_pd();
+		c[r] = _mm_setzero_pd();
+	}
+	const __m128d o = _mm_set1_pd(offset);
+
+	size_t blocks = size / lanes;
+	for (size_t b=0; b<blocks; b++) {
+		for (size_t r=0; r<registers; r++) {
+			__m128d v = _mm_loadu_pd(x + b * lanes + 2 * r);
+			if (Square) {
+				v = _mm_sub_pd(v, o);
+				v = _mm_mul_pd(v, v);
+			}
+
+			__m128d y = _mm_sub_pd(v, c[r]);
+			__m128d t = _mm_add_pd(s[r], y);
+			c[r] = _mm_sub_pd(_mm_sub_pd(t, s[r]), y);
+			s[r] = t;
+		}
+	}
+
+	Lanes l;
+	for (size_t r=0; r<registers; r++) {
+		_mm_storeu_pd(l.sum + 2 * r, s[r]);
+		_mm_storeu_pd(l.compensation + 2 * r, c[r]);
+	}
+	return finish<Square>(&l, x, blocks * lanes, size, offset);
+}
+
+__attribute__((target("sse2")))
+static void subtractSse2(const double *x, double offset, double *out, size_t size)
+{
+	const __m128d o = _mm_set1_pd(offset);
+	size_t i = 0;
+	for (; i + 2 <= size; i += 2)
+		_mm_storeu_pd(out + i, _mm_sub_pd(_mm_loadu_pd(x + i), o));
+	subtractScalar(x + i, offset, out + i, size - i);
+}
+
+__attribute__((target("sse2")))
+static void multiplySse2(const double *x, const double *window, double *out, size_t size)
+{
+	size_t i = 0;
+	for (; i + 2 <= size; i += 2)
+		_mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(window + i)));
+	multiplyScalar(x + i, window + i, out + i, size - i);
+}
+
+// Four lanes per register
+template <bool Square>
+__attribute__((target("avx2")))
+static double reduceAvx2(const double *x, size_t size, double offset)
+{
+	const size_t registers = lanes / 4;
+	__m256d s[registers], c[registers];
+	for (size_t r=0; r<registers; r++) {
+		s[r] = _mm256_setzero_pd();
+		c[r] = _mm256_setzero_pd();
+	}
+	const __m256d o = _mm256_set1_pd(offset);
+
+	size_t blocks = size / lanes;
+	for (size_t b=0; b<blocks; b++) {
+		for (size_t r=0; r<registers; r++) {
+			__m256d v = _mm256_loadu_pd(x + b * lanes + 4 * r);
+			if (Square) {
+				v = _mm256_sub_pd(v, o);
+				v = _mm256_mul_pd(v, v);
+			}
+
+			__m256d y = _mm256_sub_pd(v, c[r]);
+			__m256d t = _mm256_add_pd(s[r], y);
+			c[r] = _mm256_sub_pd(_mm256_sub_pd(t, s[r]), y);
+			s[r] = t;
+		}
+	}
+
+	Lanes l;
+	for (size_t r=0; r<registers; r++) {
+		_mm256_storeu_pd(l.sum + 4 * r, s[r]);
+		_mm256_storeu_pd(l.compensation + 4 * r, c[r]);
+	}
+	return finish<Square>(&l, x, blocks * lanes, size, offset);
+}
+
+__attribute__((target("avx2")))
+static void subtractAvx2(const double *x, double offset, double *out, size_t size)
+{
+	const __m256d o = _mm256_set1_pd(offset);
+	size_t i = 0;
+	for (; i + 4 <= size; i += 4)
+		_mm256_storeu_pd(out + i, _mm256_sub_pd(_mm256_loadu_pd(x + i), o));
+	subtractScalar(x + i, offset, out + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static void multiplyAvx2(const double *x, const double *window, double *out, size_t size)
+{
+	size_t i = 0;
+	for (; i + 4 <= size; i += 4)
+		_mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(window + i)));
+	multiplyScalar(x + i, window + i, out + i, size - i);
+}
+
+#endif
+
+#ifdef DSP_KERNELS_NEON
+
+// Two lanes per register
+template <bool Square>
+static double reduceNeon(const double *x, size_t size, double offset)
+{
+	const size_t registers = lanes / 2;
+	float64x2_t s[registers], c[registers];
+	for (size_t r=0; r<registers; r++) {
+		s[r] = vdupq_n_f64(0.0);
+		c[r] = vdupq_n_f64(0.0);
+	}
+	const float64x2_t o = vdupq_n_f64(offset);
+
+	size_t blocks = size / lanes;
+	for (size_t b=0; b<blocks; b++) {
+		for (size_t r=0; r<registers; r++) {
+			float64x2_t v = vld1q_f64(x + b * lanes + 2 * r);
+			if (Square) {
+				v = vsubq_f64(v, o);
+				v = vmulq_f64(v, v);
+			}
+
+			float64x2_t y = vsubq_f64(v, c[r]);
+			float64x2_t t = vaddq_f64(s[r], y);
+			c[r] = vsubq_f64(vsubq_f64(t, s[r]), y);
+			s[r] = t;
+		}
+	}
+
+	Lanes l;
+	for (size_t r=0; r<registers; r++) {
+		vst1q_f64(l.sum + 2 * r, s[r]);
+		vst1q_f64(l.compensation + 2 * r, c[r]);
+	}
+	return finish<Square>(&l, x, blocks * lanes, size, offset);
+}
+
+static void subtractNeon(const double *x, double offset, double *out, size_t size)
+{
+	const float64x2_t o = vdupq_n_f64(offset);
+	size_t i = 0;
+	for (; i + 2 <= size; i += 2)
+		vst1q_f64(out + i, vsubq_f64(vld1q_f64(x + i), o));
+	subtractScalar(x + i, offset, out + i, size - i);
+}
+
+static void multiplyNeon(const double *x, const double *window, double *out, size_t size)
+{
+	size_t i = 0;
+	for (; i + 2 <= size; i += 2)
+		vst1q_f64(out + i, vmulq_f64(vld1q_f64(x + i), vld1q_f64(window + i)));
+	multiplyScalar(x + i, window + i, out + i, size - i);
+}
+
+#endif
+
+static DSPKernels::Isa best()
+{
+	for (auto isa : {DSPKernels::IsaAvx2, DSPKernels::IsaSse2, DSPKernels::IsaNeon}) {
+		if (DSPKernels::isSupported(isa))
+			return isa;
+	}
+	return DSPKernels::IsaScalar;
+}
+
+static DSPKernels::Isa &selected()
+{
+	static DSPKernels::Isa isa = best();
+	return isa;
+}
+
+template <bool Square>
+static double reduce(const double *x, size_t size, double offset)
+{
+	switch (selected()) {
+#ifdef DSP_KERNELS_X86
+	case DSPKernels::IsaAvx2:
+		return reduceAvx2<Square>(x, size, offset);
+	case DSPKernels::IsaSse2:
+		return reduceSse2<Square>(x, size, offset);
+#endif
+#ifdef DSP_KERNELS_NEON
+	case DSPKernels::IsaNeon:
+		return reduceNeon<Square>(x, size, offset);
+#endif
+	default:
+		return reduceScalar<Square>(x, size, offset);
+	}
+}
+
+DSPKernels::Isa DSPKernels::isa()
+{
+	return selected();
+}
+
+bool DSPKernels::isSupported(Isa isa)
+{
+	switch (isa) {
+	case IsaScalar:
+		return true;
+#ifdef DSP_KERNELS_X86
+	case IsaSse2:
+		return __builtin_cpu_supports("sse2");
+	case IsaAvx2:
+		return __builtin_cpu_supports("avx2");
+#endif
+#ifdef DSP_KERNELS_NEON
+	case IsaNeon:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+bool DSPKernels::setIsa(Isa isa)
+{
+	if (!isSupported(isa))
+		return false;
+
+	selected() = isa;
+	return true;
+}
+
+std::string DSPKernels::isaName(Isa isa)
+{
+	switch (isa) {
+	case IsaScalar: return "scalar";
+	case IsaSse2: return "sse2";
+	case IsaAvx2: return "avx2";
+	case IsaNeon: return "neon";
+	}
+	return "unknown";
+}
+
+double DSPKernels::sum(SampleView x)
+{
+	return reduce<false>(x.data(), x.size(), 0.0);
+}
+
+double DSPKernels::sumOfSquares(SampleView x)
+{
+	return reduce<true>(x.data(), x.size(), 0.0);
+}
+
+double DSPKernels::sumOfSquaredDeviations(SampleView x, double offset)
+{
+	return reduce<true>(x.data(), x.size(), offset);
+}
+
+double DSPKernels::mean(SampleView x)
+{
+	return x.empty() ? 0.0 : sum(x) / x.size();
+}
+
+double DSPKernels::rms(SampleView x)
+{
+	return x.empty() ? 0.0 : std::sqrt(sumOfSquares(x) / x.size());
+}
+
+double DSPKernels::acRms(SampleView x)
+{
+	return x.empty() ? 0.0 : std::sqrt(sumOfSquaredDeviations(x, mean(x)) / x.size());
+}
+
+void DSPKernels::subtract(const double *x, double offset, double *out, size_t size)
+{
+	switch (selected()) {
+#ifdef DSP_KERNELS_X86
+	case IsaAvx2:
+		subtractAvx2(x, offset, out, size);
+		return;
+	case IsaSse2:
+		subtractSse2(x, offset, out, size);
+		return;
+#endif
+#ifdef DSP_KERNELS_NEON
+	case IsaNeon:
+		subtractNeon(x, offset, out, size);
+		return;
+#endif
+	default:
+		subtractScalar(x, offset, out, size);
+	}
+}
+
+void DSPKernels::removeMean(double *x, size_t size)
+{
+	subtract(x, mean(SampleView(x, size)), x, size);
+}
+
+void DSPKernels::multiply(const double *x, const double *window, double *out, size_t size)
+{
+	switch (selected()) {
+#ifdef DSP_KERNELS_X86
+	case IsaAvx2:
+		multiplyAvx2(x, window, out, size);
+		return;
+	case IsaSse2:
+		multiplySse2(x, window, out, size);
+		return;
+#endif
+#ifdef DSP_KERNELS_NEON
+	case IsaNeon:
+		multiplyNeon(x, window, out, size);
+		return;
+#endif
+	default:
+		multiplyScalar(x, window, out, size);
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "capturebuffer.h"
+
+// The loops of the analysis, that run over whole captures. Each kernel has a
+// scalar reference and SSE2, AVX2 and NEON versions, the best the CPU supports
+// is picked at the first call.
+//
+// Reductions keep 16 Kahan compensated partial sums, sample i goes to lane
+// i % 16, and combine them in a fixed order. The vector versions do exactly the
+// same operations per lane, so all versions give bit identical results, which
+// testDSPKernels() checks against the reference.
+class DSPKernels
+{
+public:
+	enum Isa {
+		IsaScalar,
+		IsaSse2,
+		IsaAvx2,
+		IsaNeon
+	};
+
+	static Isa isa();
+	static bool isSupported(Isa isa);
+	// For comparisons and benchmarks. False, if the CPU lacks it.
+	static bool setIsa(Isa isa);
+	static std::string isaName(Isa isa);
+
+	static double sum(SampleView x);
+	static double sumOfSquares(SampleView x);
+	// Sum of (x[i] - offset)^2
+	static double sumOfSquaredDeviations(SampleView x, double offset);
+
+	// All 0.0 for an empty view
+	static double mean(SampleView x);
+	static double rms(SampleView x);
+	// rms around the mean, without DC
+	static double acRms(SampleView x);
+
+	// out[i] = x[i] - offset, out may be x
+	static void subtract(const double *x, double offset, double *out, size_t size);
+	static void removeMean(double *x, size_t size);
+	// out[i] = x[i] * window[i], out may be x
+	static void multiply(const double *x, const double *window, double *out, size_t size);
+};
@@ -0,0 +1,133 @@
+#include "estimator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+
+#include "dspkernels.h"
+
+ToneEstimate estimateTone(const double *samples, size_t size, double frequency, double samplingFrequency)
+{
+	ToneEstimate ret = {0.0, 0.0};
+	if (size == 0)
+		return ret;
+
+	// Four independent lanes, each owning every fourth sample with its own phasors
+	// for the DFT kernel and the window. No loop carried dependency between lanes,
+	// so the compiler can keep them in vector registers.
+	const int lanes = 4;
+	const std::complex<double> step = std::polar(1.0, -2.0 * M_PI * frequency / samplingFrequency);
+	const std::complex<double> windowStep = std::polar(1.0, 2.0 * M_PI / size);
+	const std::complex<double> step4 = std::pow(step, lanes);
+	const std::complex<double> windowStep4 = std::pow(windowStep, lanes);
+
+	double kernelRe[lanes], kernelIm[lanes];
+	double windowRe[lanes], windowIm[lanes];
+	double accRe[lanes], accIm[lanes];
+
+	for (int l=0; l<lanes; l++) {
+		auto k = std::pow(step, l);
+		auto w = std::pow(windowStep, l);
+		kernelRe[l] = k.real();
+		kernelIm[l] = k.imag();
+		windowRe[l] = w.real();
+		windowIm[l] = w.imag();
+		accRe[l] = 0.0;
+		accIm[l] = 0.0;
+	}
+
+	const double sRe = step4.real(), sIm = step4.imag();
+	const double wsRe = windowStep4.real(), wsIm = windowStep4.imag();
+
+	size_t blocks = size / lanes;
+	for (size_t b=0; b<blocks; b++) {
+		const double *x = samples + b * lanes;
+
+		for (int l=0; l<lanes; l++) {
+			// Periodic Hann: 0.5 - 0.5 * cos
+			double v = x[l] * (0.5 - 0.5 * windowRe[l]);
+			accRe[l] += v * kernelRe[l];
+			accIm[l] += v * kernelIm[l];
+
+			double kr = kernelRe[l] * sRe - kernelIm[l] * sIm;
+			double ki = kernelRe[l] * sIm + kernelIm[l] * sRe;
+			kernelRe[l] = kr;
+			kernelIm[l] = ki;
+
+			double wr = windowRe[l] * wsRe - windowIm[l] * wsIm;
+			double wi = windowRe[l] * wsIm + windowIm[l] * wsRe;
+			windowRe[l] = wr;
+			windowIm[l] = wi;
+		}
+
+		// Renormalize now and then, so rounding does not let the phasors drift
+		if ((b & 0xff) == 0xff) {
+			for (int l=0; l<lanes; l++) {
+				double k = 1.0 / std::sqrt(kernelRe[l] * kernelRe[l] + kernelIm[l] * kernelIm[l]);
+				double w = 1.0 / std::sqrt(windowRe[l] * windowRe[l] + windowIm[l] * windowIm[l]);
+				kernelRe[l] *= k;
+				kernelIm[l] *= k;
+				windowRe[l] *= w;
+				windowIm[l] *= w;
+			}
+		}
+	}
+
+	double re = 0.0, im = 0.0;
+	for (int l=0; l<lanes; l++) {
+		re += accRe[l];
+		im += accIm[l];
+	}
+
+	// Remaining samples
+	for (size_t i=blocks * lanes; i<size; i++) {
+		double w = 0.5 - 0.5 * std::cos(2.0 * M_PI * i / size);
+		double a = -2.0 * M_PI * frequency * i / samplingFrequency;
+		re += samples[i] * w * std::cos(a);
+		im += samples[i] * w * std::sin(a);
+	}
+
+	// Coherent gain of the periodic Hann is exactly 0.5, single sided spectrum doubles
+	ret.amplitude = 2.0 * std::sqrt(re * re + im * im) / (0.5 * size);
+	ret.phase = std::atan2(im, re);
+
+	return ret;
+}
+
+ToneEstimate estimateTone(const std::vector<double>& samples, double frequency, double samplingFrequency)
+{
+	return estimateTone(samples.data(), samples.size(), frequency, samplingFrequency);
+}
+
+double wrapPhase(double phase)
+{
+	phase = std::fmod(phase + M_PI, 2.0 * M_PI);
+	if (phase < 0.0)
+		phase += 2.0 * M_PI;
+	return phase - M_PI;
+}
+
+PointEstimate estimatePoint(Estimator estimator, SampleView record, size_t skip, size_t count,
+							double frequency, double samplingFrequency)
+{
+	PointEstimate ret = {0.0, 0.0};
+
+	skip = std::min(record.size(), skip);
+	auto samples = record.slice(skip, count);
+
+	if (estimator == EstimatorSingleBin) {
+		auto tone = estimateTone(samples.data(), samples.size(), frequency, samplingFrequency);
+
+		// Phase of a sine at sample 0
+		double phase = tone.phase - 2.0 * M_PI * frequency * skip / samplingFrequency + M_PI / 2.0;
+
+		ret.rms = tone.amplitude / sqrt(2);
+		ret.phase = wrapPhase(phase) * 180.0 / M_PI;
+	} else {
+		// Remove upper and lower 10% leads to better results
+		size_t removeCount = samples.size() * 0.1;
+		ret.rms = DSPKernels::rms(samples.trimmed(removeCount, removeCount));
+	}
+
+	return ret;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+#include "capturebuffer.h"
+
+// How the level of a single measuring point is taken out of its capture
+enum Estimator {
+	EstimatorRms,			// Broadband, noise and harmonics included
+	EstimatorSingleBin		// Hann windowed DFT at the stimulus frequency. Gives phase as well
+};
+
+// Level and phase of one known tone in a capture.
+// Hann windowed single bin DFT: only energy around the stimulus frequency counts,
+// so noise and harmonics stay out and a few periods are enough.
+struct ToneEstimate {
+	double amplitude;	// Peak, in the unit of the samples
+	double phase;		// Radians of the cosine at the first sample, -pi..pi
+};
+
+// Works for any frequency, it does not need to hit a bin. Keep at least
+// a few periods of frequency in the capture, or the windows leakage of the
+// negative frequency image biases the result.
+ToneEstimate estimateTone(const double *samples, size_t size, double frequency, double samplingFrequency);
+ToneEstimate estimateTone(const std::vector<double>& samples, double frequency, double samplingFrequency);
+
+// Wrap radians into -pi..pi
+double wrapPhase(double phase);
+
+// Level and phase of one stepped sine point
+struct PointEstimate {
+	double rms;		// Of the stimulus, in the unit of the samples
+	double phase;	// Degrees of a sine at the first sample of the record, -180..180. 0.0 for EstimatorRms
+};
+
+// What Measurement::run() takes out of each record: count samples after the
+// skip samples of settle time. Offline re-analysis of archived records uses it
+// as well, so both give the same numbers.
+PointEstimate estimatePoint(Estimator estimator, SampleView record, size_t skip, size_t count,
+							double frequency, double samplingFrequency);
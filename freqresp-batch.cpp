@@ -0,0 +1,415 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <dirent.h>
+#include <sys/stat.h>
+}
+
+#include "capturearchive.h"
+#include "debug.h"
+#include "dsp.h"
+#include "estimator.h"
+#include "resultwriter.h"
+#include "workstealingpool.h"
+
+#include <boost/program_options.hpp>
+
+using namespace boost::program_options;
+
+// Offline re-analysis of many sweeps
+//
+//   freqresp-batch [--threads n] [--estimator rms|dft] [--limits file] <file or directory> ...
+//
+// Takes capture archives (*.captures, see --archive-captures of FreqResp) and
+// level results of either format, directories are searched recursively.
+// Archives are analyzed again with --estimator, or the one they were measured
+// with. Every channel of every sweep is checked against the limits, then a line
+// per channel and a summary per frequency go to stdout, the throughput to stderr.
+// Exits with 1, if any sweep failed or could not be read.
+
+const char paramHelp[] = "help";
+const char paramDebugLevel[] = "debug";
+const char paramInput[] = "input";
+const char paramThreads[] = "threads";
+const char paramEstimator[] = "estimator";
+const char paramLimits[] = "limits";
+const char paramAllowLost[] = "allow-lost";
+
+// Points from fLow to fHigh have to be within min and max
+struct LimitBand {
+	double fLow;	// Hz
+	double fHigh;
+	double min;		// dBu
+	double max;
+};
+
+// One channel of one sweep
+struct SweepReport {
+	int channel;				// -1, if the file does not tell
+	std::vector<double> frequencies;
+	std::vector<double> levels;	// dBu, NaN where not measured
+	std::vector<bool> failed;	// Per point, outside the limits
+	size_t failedCount;
+	size_t lostRecords;			// Records with samples lost or corrupted
+	double worstMargin;			// dB to the closest limit, negative outside
+	double worstFrequency;
+};
+
+struct FileReport {
+	std::string fileName;
+	bool skipped;				// No level result, like a .phase file
+	std::string error;			// Empty, if it was read
+	size_t bytes;
+	std::vector<SweepReport> sweeps;
+};
+
+struct FrequencySummary {
+	size_t count;
+	double sum;
+	double min;
+	double max;
+	size_t failed;
+};
+
+// Text results carry frequencies rounded to six digits, archives and binary
+// results exact ones, so the same point differs slightly between them
+static const double s_frequencyTolerance = 1e-5;
+
+// The summary of the point within s_frequencyTolerance (relative) of frequency,
+// keyed by the frequency it was first seen with. Created, if there is none.
+static FrequencySummary &summaryAt(std::map<double, FrequencySummary> *summary, double frequency, double level)
+{
+	auto it = summary->lower_bound(frequency * (1.0 - s_frequencyTolerance));
+	if (it == summary->end() || it->first > frequency * (1.0 + s_frequencyTolerance))
+		it = summary->insert(it, std::make_pair(frequency, FrequencySummary{0, 0.0, level, level, 0}));
+
+	return it->second;
+}
+
+static bool endsWith(const std::string &s, const std::string &suffix)
+{
+	return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// "<fLow>,<fHigh>,<min>,<max>" per line, # starts a comment
+static bool loadLimits(const std::string &fileName, std::vector<LimitBand> *limits)
+{
+	std::ifstream in(fileName);
+	if (!in.is_open())
+		return false;
+
+	int lineNumber = 0;
+	for (std::string line; std::getline(in, line);) {
+		lineNumber++;
+		line = line.substr(0, line.find('#'));
+		if (line.find_first_not_of(" \t\r") == std::string::npos)
+			continue;
+
+		LimitBand band;
+		if (sscanf(line.c_str(), "%lf,%lf,%lf,%lf", &band.fLow, &band.fHigh, &band.min, &band.max) != 4) {
+			Debug::error("freqresp-batch", fileName + ":" + std::to_string(lineNumber) + ": expected fLow,fHigh,min,max");
+			return false;
+		}
+		limits->push_back(band);
+	}
+
+	return true;
+}
+
+// Regular files below path, sorted, so the report comes out in the same order every time
+static void findInputs(const std::string &path, std::vector<std::string> *files)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) < 0) {
+		Debug::warning("freqresp-batch", "Can not stat " + path);
+		return;
+	}
+
+	if (!S_ISDIR(st.st_mode)) {
+		files->push_back(path);
+		return;
+	}
+
+	DIR *dir = opendir(path.c_str());
+	if (!dir) {
+		Debug::warning("freqresp-batch", "Can not open " + path);
+		return;
+	}
+
+	std::vector<std::string> names;
+	while (struct dirent *entry = readdir(dir)) {
+		std::string name = entry->d_name;
+		if (name != "." && name != "..")
+			names.push_back(name);
+	}
+	closedir(dir);
+
+	std::sort(names.begin(), names.end());
+	for (auto &name : names)
+		findInputs(path + "/" + name, files);
+}
+
+static void check(SweepReport *sweep, const std::vector<LimitBand> &limits)
+{
+	sweep->failed.assign(sweep->levels.size(), false);
+	sweep->failedCount = 0;
+	sweep->worstMargin = std::numeric_limits<double>::infinity();
+	sweep->worstFrequency = 0.0;
+
+	for (size_t i=0; i<sweep->levels.size(); i++) {
+		double f = sweep->frequencies[i];
+		double level = sweep->levels[i];
+		if (std::isnan(level))
+			continue;
+
+		for (auto &band : limits) {
+			if (f < band.fLow || f > band.fHigh)
+				continue;
+
+			double margin = std::min(level - band.min, band.max - level);
+			if (margin < sweep->worstMargin) {
+				sweep->worstMargin = margin;
+				sweep->worstFrequency = f;
+			}
+			if (margin < 0.0 && !sweep->failed[i]) {
+				sweep->failed[i] = true;
+				sweep->failedCount++;
+			}
+		}
+	}
+}
+
+static void analyzeArchive(FileReport *report, const Estimator *estimator)
+{
+	CaptureArchive archive(report->fileName);
+	Estimator e = estimator ? *estimator : static_cast<Estimator>(archive.header().estimator);
+
+	// Chunks of a point follow each other, one per channel
+	std::map<int, SweepReport> channels;
+	for (auto &capture : archive.captures()) {
+		auto &sweep = channels[capture.header->channel];
+		sweep.channel = capture.header->channel;
+
+		auto estimate = CaptureArchive::estimate(capture, e);
+		sweep.frequencies.push_back(capture.header->frequency);
+		sweep.levels.push_back(dBuForVolts(estimate.rms));
+		if (capture.header->lost || capture.header->corrupted)
+			sweep.lostRecords++;
+	}
+
+	for (auto &c : channels)
+		report->sweeps.push_back(c.second);
+
+	if (archive.truncated())
+		Debug::verbose("freqresp-batch", report->fileName + " is cut short, analyzed what is complete");
+}
+
+static void analyzeResult(FileReport *report)
+{
+	// The other quantities FreqResp writes next to the levels
+	for (auto suffix : {".phase", ".settle", ".thd", ".txt"}) {
+		if (endsWith(report->fileName, suffix)) {
+			report->skipped = true;
+			return;
+		}
+	}
+
+	ResultHeader header;
+	SweepReport sweep = SweepReport();
+	if (!readResult(report->fileName, &header, &sweep.frequencies, &sweep.levels)) {
+		report->error = "no result";
+		return;
+	}
+
+	if (header.quantity != ResultQuantityLevel) {
+		report->skipped = true;
+		return;
+	}
+
+	sweep.channel = header.channel;
+	report->sweeps.push_back(sweep);
+}
+
+static void analyze(FileReport *report, const Estimator *estimator, const std::vector<LimitBand> &limits)
+{
+	struct stat st;
+	report->bytes = stat(report->fileName.c_str(), &st) == 0 ? st.st_size : 0;
+
+	try {
+		if (endsWith(report->fileName, ".captures"))
+			analyzeArchive(report, estimator);
+		else
+			analyzeResult(report);
+	} catch (const ResultException &e) {
+		report->error = e.what();
+	}
+
+	if (report->error.empty() && !report->skipped && report->sweeps.empty())
+		report->error = "no records";
+
+	for (auto &sweep : report->sweeps)
+		check(&sweep, limits);
+}
+
+static void printUsage(const options_description &desc, const std::string& extraMsg)
+{
+	std::cout << desc << std::endl << extraMsg << std::endl;
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	try {
+		std::string debugLevelDesc;
+		for (int i = Debug::LevelNone; i < Debug::LevelLast; i++)
+			debugLevelDesc += std::to_string(i) + " = " + Debug::name(static_cast<Debug::Level>(i)) + "\n";
+
+		options_description desc("Usage: freqresp-batch [options] <file or directory> ...");
+		desc.add_options()
+				(paramHelp, "print this message")
+				(paramDebugLevel, value<int>(), debugLevelDesc.c_str())
+				(paramThreads, value<unsigned>(), "arg=n Threads to analyze on (default one per core)")
+				(paramEstimator, value<std::string>(), "arg=(rms|dft) Level per point of capture archives (default the one measured with)")
+				(paramLimits, value<std::string>(), "arg=file Lines of fLow,fHigh,min,max [Hz, dBu]. Every point within a band has to be within its levels")
+				(paramAllowLost, "Pass archived sweeps with lost or corrupted samples");
+
+		options_description hidden;
+		hidden.add_options()
+				(paramInput, value<std::vector<std::string>>());
+
+		options_description all;
+		all.add(desc).add(hidden);
+
+		positional_options_description positional;
+		positional.add(paramInput, -1);
+
+		variables_map varMap;
+		store(command_line_parser(argc, argv).options(all).positional(positional).run(), varMap);
+		notify(varMap);
+
+		if (varMap.count(paramHelp))
+			printUsage(desc, "");
+
+		if (varMap.count(paramDebugLevel))
+			Debug::setDebugLevel(static_cast<Debug::Level>(varMap[paramDebugLevel].as<int>()));
+
+		if (!varMap.count(paramInput))
+			printUsage(desc, "No input given!");
+
+		Estimator estimator = EstimatorRms;
+		bool overrideEstimator = varMap.count(paramEstimator);
+		if (overrideEstimator) {
+			auto e = varMap[paramEstimator].as<std::string>();
+
+			if (e == "rms") estimator = EstimatorRms;
+			else if (e == "dft") estimator = EstimatorSingleBin;
+			else printUsage(desc, "Invalid value for estimator");
+		}
+
+		std::vector<LimitBand> limits;
+		if (varMap.count(paramLimits) && !loadLimits(varMap[paramLimits].as<std::string>(), &limits))
+			printUsage(desc, "Can not read limits from " + varMap[paramLimits].as<std::string>());
+
+		const bool allowLost = varMap.count(paramAllowLost);
+
+		std::vector<std::string> files;
+		for (auto &path : varMap[paramInput].as<std::vector<std::string>>())
+			findInputs(path, &files);
+
+		// Each task fills its own report, they are only read once all are done
+		std::vector<FileReport> reports(files.size());
+		auto start = std::chrono::steady_clock::now();
+		size_t steals;
+		unsigned threads;
+
+		{
+			WorkStealingPool pool(varMap.count(paramThreads) ? varMap[paramThreads].as<unsigned>() : 0);
+			threads = pool.threadCount();
+
+			for (size_t i=0; i<files.size(); i++) {
+				reports[i].fileName = files[i];
+				pool.submit([&reports, i, &estimator, overrideEstimator, &limits]() {
+					analyze(&reports[i], overrideEstimator ? &estimator : nullptr, limits);
+				});
+			}
+
+			pool.wait();
+			steals = pool.steals();
+		}
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		// Report
+		size_t sweeps = 0, channels = 0, failed = 0, unreadable = 0, bytes = 0;
+		std::map<double, FrequencySummary> summary;
+
+		std::cout << "file,channel,points,failed points,worst margin,at,lost records,result" << std::endl;
+
+		for (auto &report : reports) {
+			if (report.skipped)
+				continue;
+
+			sweeps++;
+			bytes += report.bytes;
+
+			if (!report.error.empty()) {
+				unreadable++;
+				std::cout << report.fileName << ",,,,,,," << "unreadable: " << report.error << std::endl;
+				continue;
+			}
+
+			bool sweepFailed = false;
+			for (auto &sweep : report.sweeps) {
+				channels++;
+				bool pass = sweep.failedCount == 0 && (allowLost || sweep.lostRecords == 0);
+				sweepFailed = sweepFailed || !pass;
+
+				std::cout << report.fileName << "," << sweep.channel << "," << sweep.levels.size() << ","
+						  << sweep.failedCount << ",";
+				if (std::isinf(sweep.worstMargin))
+					std::cout << ",,";
+				else
+					std::cout << sweep.worstMargin << "," << sweep.worstFrequency << ",";
+				std::cout << sweep.lostRecords << "," << (pass ? "pass" : "fail") << std::endl;
+
+				for (size_t i=0; i<sweep.levels.size(); i++) {
+					if (std::isnan(sweep.levels[i]))
+						continue;
+
+					auto &s = summaryAt(&summary, sweep.frequencies[i], sweep.levels[i]);
+					s.count++;
+					s.sum += sweep.levels[i];
+					s.min = std::min(s.min, sweep.levels[i]);
+					s.max = std::max(s.max, sweep.levels[i]);
+					s.failed += sweep.failed[i];
+				}
+			}
+
+			failed += sweepFailed;
+		}
+
+		std::cout << std::endl << "frequency,channels,mean,min,max,failed" << std::endl;
+		for (auto &s : summary)
+			std::cout << s.first << "," << s.second.count << "," << s.second.sum / s.second.count << ","
+					  << s.second.min << "," << s.second.max << "," << s.second.failed << std::endl;
+
+		std::cerr << sweeps << " sweeps (" << channels << " channels): " << sweeps - failed - unreadable << " passed, "
+				  << failed << " failed, " << unreadable << " unreadable" << std::endl
+				  << seconds << "s on " << threads << " threads, " << sweeps / seconds << " sweeps/s, "
+				  << bytes / seconds / 1e6 << " MB/s, " << steals << " tasks stolen" << std::endl;
+
+		return failed || unreadable ? EXIT_FAILURE : EXIT_SUCCESS;
+
+	} catch (const std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}
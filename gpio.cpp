@@ -1,11 +1,21 @@
 #include "gpio.h"
 #include "analogdiscovery.h"
 
+#include <algorithm>
 #include <fstream>
 #include <thread>
 
 #include <string.h>
 
+extern "C" {
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+}
+
 GPIOException::GPIOException(const char* func, const char* file, int line, int errorNumber, const char *what) :
 	basetype(func, file, line, errorNumber, what)
 {}
@@ -23,11 +33,88 @@ GPIO::GPIO(const std::string &name) :
 GPIO::~GPIO()
 {}
 
+int GPIO::enableEdgeEvents(bool *)
+{
+	return -1;
+}
+
+void GPIO::clearEdgeEvents()
+{}
+
+GPIO *GPIO::target()
+{
+	return this;
+}
+
 std::string GPIO::getName() const
 {
 	return m_name;
 }
 
+// Lazy
+GPIOLazy::GPIOLazy(const std::string &name, Factory factory) :
+	basetype(name),
+	m_factory(factory)
+{}
+
+GPIOLazy::~GPIOLazy()
+{}
+
+void GPIOLazy::setDirection(Direction d)
+{
+	bind()->setDirection(d);
+}
+
+void GPIOLazy::setValue(bool v)
+{
+	bind()->setValue(v);
+}
+
+GPIO::Direction GPIOLazy::getDirection() const
+{
+	return bind()->getDirection();
+}
+
+bool GPIOLazy::getValue() const
+{
+	return bind()->getValue();
+}
+
+int GPIOLazy::enableEdgeEvents(bool *priority)
+{
+	return bind()->enableEdgeEvents(priority);
+}
+
+void GPIOLazy::clearEdgeEvents()
+{
+	bind()->clearEdgeEvents();
+}
+
+GPIO *GPIOLazy::target()
+{
+	return bind();
+}
+
+bool GPIOLazy::isBound() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_gpio != nullptr;
+}
+
+GPIO *GPIOLazy::bind() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (!m_gpio) {
+		m_gpio = m_factory();
+		if (!m_gpio)
+			throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0, ("Can not bind " + getName()).c_str());
+		m_factory = nullptr;
+	}
+
+	return m_gpio.get();
+}
+
 // Analog Discovery
 GPIOAnalogDiscovery::GPIOAnalogDiscovery(const std::string &name, std::shared_ptr<AnalogDiscovery> ad, unsigned int gpioNumber) :
 	basetype(name),
@@ -42,6 +129,7 @@ GPIOAnalogDiscovery::GPIOAnalogDiscovery(const std::string &name, std::shared_pt
 GPIOAnalogDiscovery::GPIOAnalogDiscovery(const std::string &name, std::shared_ptr<AnalogDiscovery> ad, unsigned int gpioNumber, Direction d, bool value) :
 	GPIOAnalogDiscovery(name, ad, gpioNumber)
 {
+	DigitalIoTransaction io(m_sharedAdHandle);
 	setDirection(d);
 	setValue(value);
 }
@@ -69,21 +157,29 @@ bool GPIOAnalogDiscovery::getValue() const
 	return m_sharedAdHandle->getDigitalIo(m_gpioNumber);
 }
 
+std::shared_ptr<AnalogDiscovery> GPIOAnalogDiscovery::device() const
+{
+	return m_sharedAdHandle;
+}
+
 SharedGPIOHandle createGPIO(const std::string &name, std::shared_ptr<AnalogDiscovery> ad, unsigned int gpioNumber, GPIO::Direction d, bool value)
 {
 	return  std::unique_ptr<GPIO>(new GPIOAnalogDiscovery(name, ad, gpioNumber, d, value));
 }
 
 // SYS FS
-const std::string GPIOSysFs::s_basePath = "/sys/class/gpio";
+const std::string GPIOSysFs::s_defaultBasePath = "/sys/class/gpio";
 
 
-GPIOSysFs::GPIOSysFs(const std::string &name, int gpioNumber) :
+GPIOSysFs::GPIOSysFs(const std::string &name, int gpioNumber, const std::string &basePath) :
 	basetype(name),
-	m_gpioNumber(gpioNumber)
+	m_gpioNumber(gpioNumber),
+	m_basePath(basePath),
+	m_valueFd(-1),
+	m_directionFd(-1)
 {
 	std::ofstream fileExport;
-	std::string fileExportPath = s_basePath + "/export";
+	std::string fileExportPath = m_basePath + "/export";
 	fileExport.open(fileExportPath);
 	if (!fileExport.is_open())
 		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
@@ -91,10 +187,18 @@ GPIOSysFs::GPIOSysFs(const std::string &name, int gpioNumber) :
 
 	fileExport << m_gpioNumber << std::endl;
 	fileExport.flush();
+
+	m_valueFd = openAttribute("value");
+	try {
+		m_directionFd = openAttribute("direction");
+	} catch (...) {
+		close(m_valueFd);
+		throw;
+	}
 }
 
-GPIOSysFs::GPIOSysFs(const std::string &name, int gpioNumber, Direction d, bool value) :
-	GPIOSysFs(name, gpioNumber)
+GPIOSysFs::GPIOSysFs(const std::string &name, int gpioNumber, Direction d, bool value, const std::string &basePath) :
+	GPIOSysFs(name, gpioNumber, basePath)
 {
 	setDirection(d);
 	setValue(value);
@@ -102,8 +206,11 @@ GPIOSysFs::GPIOSysFs(const std::string &name, int gpioNumber, Direction d, bool
 
 GPIOSysFs::~GPIOSysFs()
 {
+	close(m_valueFd);
+	close(m_directionFd);
+
 	std::ofstream fileUnexport;
-	std::string fileUnexportPath = s_basePath + "/unexport";
+	std::string fileUnexportPath = m_basePath + "/unexport";
 	fileUnexport.open(fileUnexportPath);
 	fileUnexport << m_gpioNumber << std::endl;
 	fileUnexport.flush();
@@ -111,41 +218,21 @@ GPIOSysFs::~GPIOSysFs()
 
 void GPIOSysFs::setDirection(Direction d)
 {
-	std::ofstream fileDirection;
-	std::string fileDirectionPath = s_basePath + "/gpio" + std::to_string(m_gpioNumber) + "/direction";
-	fileDirection.open(fileDirectionPath);
-	if (!fileDirection.is_open())
-		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
-							("Can not open file: " + fileDirectionPath + " to set direction for GPIO" + std::to_string(m_gpioNumber)).c_str());
-
-	fileDirection << (d == DirectionIn ? "in" : "out") << std::endl;
-	fileDirection.flush();
+	if (d == DirectionIn)
+		writeAttribute(m_directionFd, "in\n", 3, "direction");
+	else
+		writeAttribute(m_directionFd, "out\n", 4, "direction");
 }
 
 void GPIOSysFs::setValue(bool v)
 {
-	std::ofstream fileValue;
-	std::string fileValuePath = s_basePath + "/gpio" + std::to_string(m_gpioNumber) + "/value";
-	fileValue.open(fileValuePath);
-	if (!fileValue.is_open())
-		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
-							("Can not open file: " + fileValuePath + " to set value for GPIO" + std::to_string(m_gpioNumber)).c_str());
-
-	fileValue << (v ? "1" : "0") << std::endl;
-	fileValue.flush();
+	writeAttribute(m_valueFd, v ? "1\n" : "0\n", 2, "value");
 }
 
 GPIO::Direction GPIOSysFs::getDirection() const
 {
-	std::ifstream fileDirection;
-	std::string fileDirectionPath = s_basePath + "/gpio" + std::to_string(m_gpioNumber) + "/direction";
-	fileDirection.open(fileDirectionPath);
-	if (!fileDirection.is_open())
-		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
-							("Can not open file: " + fileDirectionPath + " to get direction for GPIO" + std::to_string(m_gpioNumber)).c_str());
-
-	std::string line;
-	std::getline(fileDirection, line);
+	char buffer[8];
+	std::string line(buffer, readAttribute(m_directionFd, buffer, sizeof(buffer), "direction"));
 
 	if (line != "in" && line != "out")
 		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
@@ -156,30 +243,496 @@ GPIO::Direction GPIOSysFs::getDirection() const
 
 bool GPIOSysFs::getValue() const
 {
-	std::ifstream fileValue;
-	std::string fileValuePath = s_basePath + "/gpio" + std::to_string(m_gpioNumber) + "/value";
-	fileValue.open(fileValuePath);
-	if (!fileValue.is_open())
+	char buffer[4];
+	size_t size = readAttribute(m_valueFd, buffer, sizeof(buffer), "value");
+
+	if (size != 1 || (buffer[0] != '1' && buffer[0] != '0'))
 		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
-							("Can not open file: " + fileValuePath + " to get value for GPIO" + std::to_string(m_gpioNumber)).c_str());
+							("Invalid value (" + std::string(buffer, size) + ") while reading value for GPIO" + std::to_string(m_gpioNumber)).c_str());
 
-	std::string line;
-	std::getline(fileValue, line);
+	return buffer[0] == '1';
+}
 
-	if (line != "1" && line != "0")
-		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
-							("Invalid value (" + line + ") while reading dvaliue for GPIO" + std::to_string(m_gpioNumber)).c_str());
+int GPIOSysFs::enableEdgeEvents(bool *priority)
+{
+	// The value file signals POLLPRI on both edges from now on
+	int edgeFd = openAttribute("edge");
+	try {
+		writeAttribute(edgeFd, "both\n", 5, "edge");
+	} catch (...) {
+		close(edgeFd);
+		throw;
+	}
+	close(edgeFd);
+
+	// Without a read first, the fd signals right away
+	clearEdgeEvents();
+
+	*priority = true;
+	return m_valueFd;
+}
+
+void GPIOSysFs::clearEdgeEvents()
+{
+	char buffer[4];
+	readAttribute(m_valueFd, buffer, sizeof(buffer), "value");
+}
+
+int GPIOSysFs::openAttribute(const std::string &attribute)
+{
+	std::string path = m_basePath + "/gpio" + std::to_string(m_gpioNumber) + "/" + attribute;
+	int fd = TEMP_FAILURE_RETRY(open(path.c_str(), O_RDWR | O_CLOEXEC));
+	if (fd < 0)
+		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, errno,
+							("Can not open file: " + path + " for GPIO" + std::to_string(m_gpioNumber) + ": " + strerror(errno)).c_str());
+
+	return fd;
+}
+
+void GPIOSysFs::writeAttribute(int fd, const char *value, size_t size, const char *attribute)
+{
+	if (TEMP_FAILURE_RETRY(pwrite(fd, value, size, 0)) != static_cast<ssize_t>(size))
+		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, errno,
+							("Can not set " + std::string(attribute) + " for GPIO" + std::to_string(m_gpioNumber) + ": " + strerror(errno)).c_str());
+}
+
+size_t GPIOSysFs::readAttribute(int fd, char *buffer, size_t size, const char *attribute) const
+{
+	ssize_t ret = TEMP_FAILURE_RETRY(pread(fd, buffer, size, 0));
+	if (ret < 0)
+		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, errno,
+							("Can not get " + std::string(attribute) + " for GPIO" + std::to_string(m_gpioNumber) + ": " + strerror(errno)).c_str());
 
-	return (line == "1" ? true : false);
+	size_t len = 0;
+	while (len < static_cast<size_t>(ret) && buffer[len] != '\n')
+		len++;
+
+	return len;
 }
 
 SharedGPIOHandle createGPIO(const std::string &name, int gpioNumber, GPIO::Direction d, bool value)
 {
+	if (hostGPIOSimulated())
+		return std::unique_ptr<GPIO>(new GPIOMemory(name, d, value));
+
 	return std::unique_ptr<GPIO>(new GPIOSysFs(name, gpioNumber, d, value));
 }
 
+// Memory
+static bool s_hostGPIOSimulated = false;
+
+GPIOMemory::GPIOMemory(const std::string &name, Direction d, bool value) :
+	basetype(name),
+	m_direction(d),
+	m_value(value),
+	m_eventFd(-1)
+{}
+
+GPIOMemory::~GPIOMemory()
+{
+	if (m_eventFd >= 0)
+		close(m_eventFd);
+}
+
+void GPIOMemory::setDirection(Direction d)
+{
+	m_direction = d;
+}
+
+void GPIOMemory::setValue(bool v)
+{
+	if (m_value.exchange(v) != v && m_eventFd >= 0) {
+		uint64_t one = 1;
+		TEMP_FAILURE_RETRY(write(m_eventFd, &one, sizeof(one)));
+	}
+}
+
+GPIO::Direction GPIOMemory::getDirection() const
+{
+	return m_direction;
+}
+
+bool GPIOMemory::getValue() const
+{
+	return m_value;
+}
+
+int GPIOMemory::enableEdgeEvents(bool *priority)
+{
+	if (m_eventFd < 0)
+		m_eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (m_eventFd < 0)
+		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, errno,
+							("Can not create eventfd for " + getName() + ": " + strerror(errno)).c_str());
+
+	*priority = false;
+	return m_eventFd;
+}
+
+void GPIOMemory::clearEdgeEvents()
+{
+	uint64_t count;
+	TEMP_FAILURE_RETRY(read(m_eventFd, &count, sizeof(count)));
+}
+
+void setHostGPIOSimulated(bool s)
+{
+	s_hostGPIOSimulated = s;
+}
+
+bool hostGPIOSimulated()
+{
+	return s_hostGPIOSimulated;
+}
+
+// Character device
+GPIOLineRequest::GPIOLineRequest(const std::string &chipPath, const std::vector<unsigned int> &offsets, const std::string &consumer,
+								 GPIO::Direction d, bool value) :
+	m_chipPath(chipPath),
+	m_offsets(offsets),
+	m_directions(offsets.size(), d),
+	m_values(value ? ~uint64_t(0) : 0),
+	m_edges(0),
+	m_fd(-1)
+{
+	if (m_offsets.empty() || m_offsets.size() > GPIO_V2_LINES_MAX)
+		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
+							("Can not request " + std::to_string(m_offsets.size()) + " lines of " + m_chipPath).c_str());
+
+	int chipFd = TEMP_FAILURE_RETRY(open(m_chipPath.c_str(), O_RDWR | O_CLOEXEC));
+	if (chipFd < 0)
+		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, errno,
+							("Can not open " + m_chipPath + ": " + strerror(errno)).c_str());
+
+	struct gpio_v2_line_request request;
+	memset(&request, 0, sizeof(request));
+	for (size_t i=0; i<m_offsets.size(); i++)
+		request.offsets[i] = m_offsets[i];
+	request.num_lines = m_offsets.size();
+	strncpy(request.consumer, consumer.c_str(), sizeof(request.consumer) - 1);
+	request.config.flags = (d == GPIO::DirectionIn ? GPIO_V2_LINE_FLAG_INPUT : GPIO_V2_LINE_FLAG_OUTPUT);
+	if (d == GPIO::DirectionOut) {
+		request.config.num_attrs = 1;
+		request.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+		request.config.attrs[0].attr.values = m_values;
+		request.config.attrs[0].mask = ~uint64_t(0) >> (64 - m_offsets.size());
+	}
+
+	int ret = ioctl(chipFd, GPIO_V2_GET_LINE_IOCTL, &request);
+	int error = errno;
+	close(chipFd);
+
+	if (ret < 0)
+		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, error,
+							("Can not request lines of " + m_chipPath + ": " + strerror(error)).c_str());
+
+	m_fd = request.fd;
+}
+
+GPIOLineRequest::~GPIOLineRequest()
+{
+	close(m_fd);
+}
+
+std::string GPIOLineRequest::chipPath() const
+{
+	return m_chipPath;
+}
+
+size_t GPIOLineRequest::size() const
+{
+	return m_offsets.size();
+}
+
+unsigned int GPIOLineRequest::offset(size_t index) const
+{
+	return m_offsets.at(index);
+}
+
+void GPIOLineRequest::setValues(uint64_t mask, uint64_t values)
+{
+	struct gpio_v2_line_values lineValues;
+	lineValues.mask = mask;
+	lineValues.bits = values;
+
+	if (ioctl(m_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &lineValues) < 0)
+		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, errno,
+							("Can not set values of " + m_chipPath + ": " + strerror(errno)).c_str());
+
+	m_values = (m_values & ~mask) | (values & mask);
+}
+
+uint64_t GPIOLineRequest::getValues(uint64_t mask) const
+{
+	struct gpio_v2_line_values lineValues;
+	lineValues.mask = mask;
+	lineValues.bits = 0;
+
+	if (ioctl(m_fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &lineValues) < 0)
+		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, errno,
+							("Can not get values of " + m_chipPath + ": " + strerror(errno)).c_str());
+
+	return lineValues.bits & mask;
+}
+
+void GPIOLineRequest::setDirection(size_t index, GPIO::Direction d)
+{
+	if (m_directions.at(index) == d)
+		return;
+
+	m_directions[index] = d;
+	configure();
+}
+
+GPIO::Direction GPIOLineRequest::getDirection(size_t index) const
+{
+	return m_directions.at(index);
+}
+
+int GPIOLineRequest::enableEdgeEvents(size_t index)
+{
+	uint64_t bit = uint64_t(1) << index;
+	if (!(m_edges & bit)) {
+		m_edges |= bit;
+		configure();
+	}
+
+	return m_fd;
+}
+
+void GPIOLineRequest::clearEdgeEvents()
+{
+	// The kernel only hands out whole events, any number of them
+	struct gpio_v2_line_event events[16];
+	TEMP_FAILURE_RETRY(read(m_fd, events, sizeof(events)));
+}
+
+void GPIOLineRequest::configure()
+{
+	uint64_t outputs = 0;
+	for (size_t i=0; i<m_directions.size(); i++) {
+		if (m_directions[i] == GPIO::DirectionOut)
+			outputs |= uint64_t(1) << i;
+	}
+	uint64_t edges = m_edges & ~outputs;
+
+	// Inputs by default, outputs and edge detection by attribute
+	struct gpio_v2_line_config config;
+	memset(&config, 0, sizeof(config));
+	config.flags = GPIO_V2_LINE_FLAG_INPUT;
+	if (outputs) {
+		auto &flags = config.attrs[config.num_attrs++];
+		flags.attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+		flags.attr.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+		flags.mask = outputs;
+
+		auto &values = config.attrs[config.num_attrs++];
+		values.attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+		values.attr.values = m_values;
+		values.mask = outputs;
+	}
+	if (edges) {
+		auto &flags = config.attrs[config.num_attrs++];
+		flags.attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+		flags.attr.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+		flags.mask = edges;
+	}
+
+	if (ioctl(m_fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config) < 0)
+		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, errno,
+							("Can not configure lines of " + m_chipPath + ": " + strerror(errno)).c_str());
+}
+
+GPIOCharDev::GPIOCharDev(const std::string &name, SharedGPIOLineRequest request, size_t index) :
+	basetype(name),
+	m_request(request),
+	m_index(index)
+{
+	if (!m_request || m_index >= m_request->size())
+		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
+							("No line " + std::to_string(index) + " in request for " + name).c_str());
+}
+
+GPIOCharDev::~GPIOCharDev()
+{}
+
+void GPIOCharDev::setDirection(Direction d)
+{
+	m_request->setDirection(m_index, d);
+}
+
+void GPIOCharDev::setValue(bool v)
+{
+	uint64_t bit = uint64_t(1) << m_index;
+	m_request->setValues(bit, v ? bit : 0);
+}
+
+GPIO::Direction GPIOCharDev::getDirection() const
+{
+	return m_request->getDirection(m_index);
+}
+
+bool GPIOCharDev::getValue() const
+{
+	return m_request->getValues(uint64_t(1) << m_index) != 0;
+}
+
+int GPIOCharDev::enableEdgeEvents(bool *priority)
+{
+	*priority = false;
+	return m_request->enableEdgeEvents(m_index);
+}
+
+void GPIOCharDev::clearEdgeEvents()
+{
+	m_request->clearEdgeEvents();
+}
+
+SharedGPIOLineRequest GPIOCharDev::request() const
+{
+	return m_request;
+}
+
+size_t GPIOCharDev::index() const
+{
+	return m_index;
+}
+
+std::list<SharedGPIOHandle> createGPIOs(const std::vector<std::string> &names, const std::string &chipPath,
+										 const std::vector<unsigned int> &offsets, GPIO::Direction d, bool value)
+{
+	if (names.size() != offsets.size())
+		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0, "Need one name per line");
+
+	std::list<SharedGPIOHandle> ret;
+
+	if (hostGPIOSimulated()) {
+		for (auto &name : names)
+			ret.push_back(std::unique_ptr<GPIO>(new GPIOMemory(name, d, value)));
+		return ret;
+	}
+
+	auto request = std::make_shared<GPIOLineRequest>(chipPath, offsets, "FreqResp", d, value);
+	for (size_t i=0; i<names.size(); i++)
+		ret.push_back(std::unique_ptr<GPIO>(new GPIOCharDev(names[i], request, i)));
+
+	return ret;
+}
+
+void GPIOBatch::clear()
+{
+	m_values.clear();
+	m_directions.clear();
+}
+
+void GPIOBatch::add(const SharedGPIOHandle &gpio, bool value)
+{
+	m_values.emplace_back(gpio, value);
+}
+
+void GPIOBatch::add(const SharedGPIOHandle &gpio, GPIO::Direction direction, bool value)
+{
+	m_directions.emplace_back(gpio.get(), direction);
+	m_values.emplace_back(gpio, value);
+}
+
+const GPIOValues &GPIOBatch::values() const
+{
+	return m_values;
+}
+
+void GPIOBatch::apply()
+{
+	m_devices.clear();
+	for (auto &v : m_values) {
+		auto line = dynamic_cast<GPIOAnalogDiscovery*>(v.first->target());
+		if (!line)
+			continue;
+
+		auto device = line->device();
+		if (std::find(m_devices.begin(), m_devices.end(), device) == m_devices.end())
+			m_devices.push_back(device);
+	}
+
+	holdDevicesAndApply(0);
+	m_devices.clear();
+}
+
+void GPIOBatch::holdDevicesAndApply(size_t device)
+{
+	// One transaction per device on the stack, held until all values are set
+	if (device < m_devices.size()) {
+		DigitalIoTransaction io(m_devices[device]);
+		holdDevicesAndApply(device + 1);
+		// Here, not in the destructor, which can only log a failure
+		io.commit();
+		return;
+	}
+
+	for (auto &d : m_directions)
+		d.first->setDirection(d.second);
+
+	// Collect the lines of each request, in order of first appearance
+	m_requests.clear();
+	for (auto &v : m_values) {
+		auto line = dynamic_cast<GPIOCharDev*>(v.first->target());
+		if (!line) {
+			v.first->setValue(v.second);
+			continue;
+		}
+
+		auto request = line->request().get();
+		auto batch = std::find_if(m_requests.begin(), m_requests.end(),
+								  [request](const decltype(m_requests)::value_type &b) { return b.first == request; });
+		if (batch == m_requests.end())
+			batch = m_requests.insert(m_requests.end(), std::make_pair(request, std::make_pair(uint64_t(0), uint64_t(0))));
+
+		uint64_t bit = uint64_t(1) << line->index();
+		batch->second.first |= bit;
+		if (v.second)
+			batch->second.second |= bit;
+		else
+			batch->second.second &= ~bit;
+	}
+
+	for (auto &b : m_requests)
+		b.first->setValues(b.second.first, b.second.second);
+}
+
+void setGPIOValues(const GPIOValues &values)
+{
+	GPIOBatch batch;
+	for (auto &v : values)
+		batch.add(v.first, v.second);
+	batch.apply();
+}
+
+bool setAtomically(const GPIOValues &values)
+{
+	// Either one line request, set in one ioctl, or one Analog Discovery,
+	// whose transaction commits the whole output register at once
+	GPIOLineRequest *request = nullptr;
+	AnalogDiscovery *device = nullptr;
+
+	for (auto &v : values) {
+		if (auto line = dynamic_cast<GPIOCharDev*>(v.first->target())) {
+			if (device || (request && line->request().get() != request))
+				return false;
+			request = line->request().get();
+		} else if (auto line = dynamic_cast<GPIOAnalogDiscovery*>(v.first->target())) {
+			if (request || (device && line->device().get() != device))
+				return false;
+			device = line->device().get();
+		} else {
+			return false;
+		}
+	}
+
+	return true;
+}
+
 // Helpers
-SharedGPIOHandle getGPIOForName(std::list<SharedGPIOHandle> gpios, const std::string &name)
+SharedGPIOHandle getGPIOForName(const std::list<SharedGPIOHandle> &gpios, const std::string &name)
 {
 	for (auto it=gpios.begin(); it!=gpios.end(); ++it) {
 		if ((*it)->getName() == name)
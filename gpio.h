@@ -5,6 +5,12 @@
 #include <fstream>
 #include <list>
 #include <chrono>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <atomic>
+#include <functional>
+#include <mutex>
 
 #include "descriptiveexception.h"
 
@@ -33,6 +39,15 @@ public:
 	virtual Direction getDirection() const = 0;
 	virtual bool getValue() const = 0;
 
+	// Edge events for GPIOWatcher. Backends that can signal edges return a fd, which
+	// turns readable after each edge (priority data, if priority is set), -1 otherwise.
+	virtual int enableEdgeEvents(bool *priority);
+	// Clears what the fd signalled, so it can signal the next edge
+	virtual void clearEdgeEvents();
+
+	// The GPIO doing the work. Stand-ins return the one behind them.
+	virtual GPIO *target();
+
 	std::string getName() const;
 
 private:
@@ -40,6 +55,37 @@ private:
 };
 
 typedef std::shared_ptr<GPIO> SharedGPIOHandle;
+
+// Stands in for the GPIO factory creates, which is called on first use, so
+// holding one costs no hardware access until then
+class GPIOLazy : public GPIO
+{
+public:
+	typedef GPIO basetype;
+	typedef std::function<SharedGPIOHandle()> Factory;
+
+	GPIOLazy(const std::string &name, Factory factory);
+	virtual ~GPIOLazy();
+
+	virtual void setDirection(Direction d);
+	virtual void setValue(bool v);
+
+	virtual Direction getDirection() const;
+	virtual bool getValue() const;
+
+	virtual int enableEdgeEvents(bool *priority);
+	virtual void clearEdgeEvents();
+
+	virtual GPIO *target();
+	bool isBound() const;
+
+private:
+	mutable std::mutex m_mutex;
+	mutable Factory m_factory;
+	mutable SharedGPIOHandle m_gpio;
+
+	GPIO *bind() const;
+};
 class AnalogDiscovery;
 
 class GPIOAnalogDiscovery : public GPIO
@@ -57,6 +103,8 @@ public:
 	virtual Direction getDirection() const;
 	virtual bool getValue() const;
 
+	std::shared_ptr<AnalogDiscovery> device() const;
+
 private:
 	std::shared_ptr<AnalogDiscovery> m_sharedAdHandle;
 	unsigned int m_gpioNumber;
@@ -64,13 +112,17 @@ private:
 
 SharedGPIOHandle createGPIO(const std::string &name, std::shared_ptr<AnalogDiscovery> ad, unsigned int gpioNumber, GPIO::Direction d, bool value);
 
+// Exports the GPIO and keeps its value and direction files open, so each
+// access is a single pread()/pwrite() at offset 0.
 class GPIOSysFs : public GPIO
 {
 public:
 	typedef GPIO basetype;
 
-	GPIOSysFs(const std::string &name, int gpioNumber);
-	GPIOSysFs(const std::string &name, int gpioNumber, Direction d, bool value);
+	GPIOSysFs(const std::string &name, int gpioNumber, const std::string &basePath = s_defaultBasePath);
+	GPIOSysFs(const std::string &name, int gpioNumber, Direction d, bool value, const std::string &basePath = s_defaultBasePath);
+	GPIOSysFs(const GPIOSysFs&) = delete;
+	GPIOSysFs& operator=(const GPIOSysFs&) = delete;
 	virtual ~GPIOSysFs();
 
 	virtual void setDirection(Direction d);
@@ -78,15 +130,162 @@ public:
 
 	virtual Direction getDirection() const;
 	virtual bool getValue() const;
+
+	virtual int enableEdgeEvents(bool *priority);
+	virtual void clearEdgeEvents();
+
+	const static std::string s_defaultBasePath;
 private:
 	int m_gpioNumber;
-	const static std::string s_basePath;
+	std::string m_basePath;
+	int m_valueFd;
+	int m_directionFd;
+
+	int openAttribute(const std::string &attribute);
+	void writeAttribute(int fd, const char *value, size_t size, const char *attribute);
+	// Reads the first line, returns its length
+	size_t readAttribute(int fd, char *buffer, size_t size, const char *attribute) const;
 };
 
+// Returns a GPIOMemory instead, while host GPIOs are simulated
 SharedGPIOHandle createGPIO(const std::string &name, int gpioNumber, GPIO::Direction d, bool value);
 
+// Keeps direction and value in memory, stands in for host GPIOs in simulation
+class GPIOMemory : public GPIO
+{
+public:
+	typedef GPIO basetype;
+
+	GPIOMemory(const std::string &name, Direction d, bool value);
+	virtual ~GPIOMemory();
+
+	virtual void setDirection(Direction d);
+	virtual void setValue(bool v);
+
+	virtual Direction getDirection() const;
+	virtual bool getValue() const;
+
+	// An eventfd, signalled by setValue() on each change
+	virtual int enableEdgeEvents(bool *priority);
+	virtual void clearEdgeEvents();
+private:
+	Direction m_direction;
+	std::atomic<bool> m_value;
+	int m_eventFd;
+};
+
+void setHostGPIOSimulated(bool s);
+bool hostGPIOSimulated();
+
+// Lines of one gpiochip character device (/dev/gpiochipN), requested together
+// through the v2 uAPI. They share one handle, so any subset of them changes in a
+// single ioctl and never passes through intermediate states.
+class GPIOLineRequest
+{
+public:
+	// All lines start with direction d and value
+	GPIOLineRequest(const std::string &chipPath, const std::vector<unsigned int> &offsets, const std::string &consumer,
+					GPIO::Direction d, bool value);
+	GPIOLineRequest(const GPIOLineRequest&) = delete;
+	GPIOLineRequest& operator=(const GPIOLineRequest&) = delete;
+	~GPIOLineRequest();
+
+	std::string chipPath() const;
+	size_t size() const;
+	unsigned int offset(size_t index) const;
+
+	// Bit i of mask and values stands for the line at index i
+	void setValues(uint64_t mask, uint64_t values);
+	uint64_t getValues(uint64_t mask) const;
+
+	void setDirection(size_t index, GPIO::Direction d);
+	GPIO::Direction getDirection(size_t index) const;
+
+	// Edge events of all lines come in on one fd, the request itself
+	int enableEdgeEvents(size_t index);
+	void clearEdgeEvents();
+
+private:
+	std::string m_chipPath;
+	std::vector<unsigned int> m_offsets;
+	std::vector<GPIO::Direction> m_directions;
+	// Last values set, outputs start with them after a direction change
+	uint64_t m_values;
+	// Inputs reporting both edges
+	uint64_t m_edges;
+	int m_fd;
+
+	void configure();
+};
+
+typedef std::shared_ptr<GPIOLineRequest> SharedGPIOLineRequest;
+
+// One line of a GPIOLineRequest
+class GPIOCharDev : public GPIO
+{
+public:
+	typedef GPIO basetype;
+
+	GPIOCharDev(const std::string &name, SharedGPIOLineRequest request, size_t index);
+	virtual ~GPIOCharDev();
+
+	virtual void setDirection(Direction d);
+	virtual void setValue(bool v);
+
+	virtual Direction getDirection() const;
+	virtual bool getValue() const;
+
+	virtual int enableEdgeEvents(bool *priority);
+	virtual void clearEdgeEvents();
+
+	SharedGPIOLineRequest request() const;
+	size_t index() const;
+
+private:
+	SharedGPIOLineRequest m_request;
+	size_t m_index;
+};
+
+// Requests lines offsets of chipPath in one handle, names[i] goes to offsets[i]
+std::list<SharedGPIOHandle> createGPIOs(const std::vector<std::string> &names, const std::string &chipPath,
+										 const std::vector<unsigned int> &offsets, GPIO::Direction d, bool value);
+
+typedef std::vector<std::pair<SharedGPIOHandle, bool>> GPIOValues;
+
+// Values to set at once, each optionally with a direction, which changes first.
+// Analog Discovery lines go out in one commit per device, lines sharing a
+// GPIOLineRequest in one ioctl, everything else one by one, in order.
+// Its buffers are only ever cleared, so a batch kept around and applied over
+// and over stops allocating, once they have grown to the largest one.
+class GPIOBatch
+{
+public:
+	// Drops the values, keeps the buffers
+	void clear();
+	void add(const SharedGPIOHandle &gpio, bool value);
+	void add(const SharedGPIOHandle &gpio, GPIO::Direction direction, bool value);
+	const GPIOValues &values() const;
+
+	// Throws GPIOException or AnalogDiscoveryException, if setting a line or
+	// committing a device fails. Lines before it may be set by then.
+	void apply();
+
+private:
+	GPIOValues m_values;
+	std::vector<std::pair<GPIO*, GPIO::Direction>> m_directions;
+	std::vector<std::shared_ptr<AnalogDiscovery>> m_devices;
+	std::vector<std::pair<GPIOLineRequest*, std::pair<uint64_t, uint64_t>>> m_requests;
+
+	void holdDevicesAndApply(size_t device);
+};
+
+// Sets all of them through a GPIOBatch of its own
+void setGPIOValues(const GPIOValues &values);
+// True, if setGPIOValues() changes all of them at once
+bool setAtomically(const GPIOValues &values);
+
 // Helpers
-SharedGPIOHandle getGPIOForName(std::list<SharedGPIOHandle> gpios, const std::string &name);
+SharedGPIOHandle getGPIOForName(const std::list<SharedGPIOHandle> &gpios, const std::string &name);
 
 
 
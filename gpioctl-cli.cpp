@@ -0,0 +1,141 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <stdlib.h>
+}
+
+#include "gpioctlclient.h"
+
+using namespace std;
+
+/* Native gpioctl, talking the binary protocol on one connection
+ *
+ *   gpioctl-cli [--socket path] [--window n] <GPIO NAME> <on|off|get> [, <GPIO NAME> <on|off|get> ...]
+ *
+ * sets or reads the GPIOs in one transaction, like gpioctl. With "-" instead,
+ * each line of stdin is such a request. They go out pipelined, up to
+ * --window of them in flight, and the responses come out in the same order.
+ * The socket defaults to $GPIOCTLD_SOCKET, then /run/gpioctld.socket.
+ */
+
+/* Parse "<GPIO NAME> <on|off|get> [, ...]", false if malformed */
+bool parse_request(const string &text, vector<GpioctlClient::Line> *lines)
+{
+	istringstream ss(text);
+	for (string part; getline(ss, part, ',');) {
+		auto begin = part.find_first_not_of(" \t");
+		auto end = part.find_last_not_of(" \t");
+		if (begin == string::npos)
+			return false;
+		part = part.substr(begin, end - begin + 1);
+
+		size_t word_sep = part.rfind(' ');
+		if (word_sep == string::npos)
+			return false;
+
+		GpioctlClient::Line l;
+		l.name = part.substr(0, word_sep);
+		string value = part.substr(word_sep + 1);
+		l.op = value == "get" ? GpioctlProtocol::OpGet : GpioctlProtocol::OpSet;
+		l.value = value == "on";
+		if (value != "on" && value != "off" && value != "get")
+			return false;
+
+		lines->push_back(l);
+	}
+
+	return !lines->empty();
+}
+
+/* Prints one line per GPIO, false if gpioctld rejected or failed the request */
+bool print_response(const vector<GpioctlClient::Line> &lines, const GpioctlProtocol::Response &r)
+{
+	if (r.status == GpioctlProtocol::StatusFailed) {
+		cerr << "Failed: " << r.error << endl;
+		return false;
+	}
+
+	if (r.status != GpioctlProtocol::StatusOk) {
+		cerr << "Invalid request: line " << r.errorLine + 1 << ": " << r.error << endl;
+		return false;
+	}
+
+	for (size_t i=0; i<lines.size() && i<r.values.size(); i++)
+		cout << lines[i].name << (r.values[i] ? " on" : " off") << "\n";
+
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *env = getenv("GPIOCTLD_SOCKET");
+	string path = env ? env : GpioctlClient::s_defaultSocket;
+	size_t window = 32;
+	string request;
+
+	for (int i=1; i<argc; i++) {
+		string arg(argv[i]);
+		if (arg == "--socket" && i + 1 < argc) {
+			path = argv[++i];
+		} else if (arg == "--window" && i + 1 < argc) {
+			window = max(1, atoi(argv[++i]));
+		} else {
+			request += (request.empty() ? "" : " ") + arg;
+		}
+	}
+
+	if (request.empty()) {
+		cerr << "Usage: " << argv[0] << " [--socket path] [--window n] <GPIO NAME> <on|off|get> [, ...] | -" << endl;
+		return EXIT_FAILURE;
+	}
+
+	try {
+		GpioctlClient client(path);
+
+		if (request != "-") {
+			vector<GpioctlClient::Line> lines;
+			if (!parse_request(request, &lines)) {
+				cerr << "Invalid request: " << request << endl;
+				return EXIT_FAILURE;
+			}
+
+			client.send(lines);
+			return print_response(lines, client.receive()) ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+
+		bool ok = true;
+		deque<vector<GpioctlClient::Line>> inFlight;
+
+		for (string text; getline(cin, text);) {
+			vector<GpioctlClient::Line> lines;
+			if (text.empty())
+				continue;
+			if (!parse_request(text, &lines)) {
+				cerr << "Invalid request: " << text << endl;
+				ok = false;
+				continue;
+			}
+
+			client.send(lines);
+			inFlight.push_back(lines);
+
+			if (client.inFlight() >= window) {
+				ok &= print_response(inFlight.front(), client.receive());
+				inFlight.pop_front();
+			}
+		}
+
+		while (client.inFlight()) {
+			ok &= print_response(inFlight.front(), client.receive());
+			inFlight.pop_front();
+		}
+
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	} catch (const GpioctlException &e) {
+		cerr << e.what() << endl;
+		return EXIT_FAILURE;
+	}
+}
@@ -0,0 +1,123 @@
+#include "gpioctlclient.h"
+
+extern "C" {
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+}
+
+const std::string GpioctlClient::s_defaultSocket = "/run/gpioctld.socket";
+// Header, 65535 values or an error naming a GPIO of up to 65535 characters
+const size_t GpioctlClient::s_bufferSize = 128 * 1024;
+
+GpioctlException::GpioctlException(const char* func, const char* file, int line, int errorNumber, const char *what) :
+	basetype(func, file, line, errorNumber, what)
+{}
+
+const char* GpioctlException::what() const noexcept
+{
+	return basetype::what();
+}
+
+GpioctlClient::GpioctlClient(const std::string &socketPath) :
+	m_fd(socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)),
+	m_nextId(1),
+	m_buffer(s_bufferSize, '\0')
+{
+	if (m_fd < 0)
+		throw GpioctlException(__PRETTY_FUNCTION__, __FILE__, __LINE__, errno,
+							   (std::string("Can not create socket: ") + strerror(errno)).c_str());
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+	if (connect(m_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+		int e = errno;
+		close(m_fd);
+		throw GpioctlException(__PRETTY_FUNCTION__, __FILE__, __LINE__, e,
+							   ("Can not connect to " + socketPath + ": " + strerror(e)).c_str());
+	}
+}
+
+GpioctlClient::~GpioctlClient()
+{
+	close(m_fd);
+}
+
+void GpioctlClient::set(const std::string &name, bool value)
+{
+	apply({{GpioctlProtocol::OpSet, value, name}});
+}
+
+bool GpioctlClient::get(const std::string &name)
+{
+	return apply({{GpioctlProtocol::OpGet, false, name}}).front();
+}
+
+std::vector<bool> GpioctlClient::apply(const std::vector<Line> &lines)
+{
+	uint32_t id = send(lines);
+
+	// Responses to requests sent earlier are dropped
+	GpioctlProtocol::Response r;
+	do {
+		r = receive();
+	} while (r.id != id);
+
+	if (r.status == GpioctlProtocol::StatusFailed)
+		throw GpioctlException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0, ("gpioctld failed: " + r.error).c_str());
+
+	if (r.status != GpioctlProtocol::StatusOk)
+		throw GpioctlException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
+							   ("gpioctld rejected line " + std::to_string(r.errorLine + 1) + ": " + r.error).c_str());
+
+	return r.values;
+}
+
+uint32_t GpioctlClient::send(const std::vector<Line> &lines)
+{
+	GpioctlProtocol::Request r;
+	r.id = m_nextId++;
+	r.lines = lines;
+
+	auto message = GpioctlProtocol::encode(r);
+	if (TEMP_FAILURE_RETRY(::send(m_fd, message.data(), message.size(), MSG_NOSIGNAL)) < 0)
+		throw GpioctlException(__PRETTY_FUNCTION__, __FILE__, __LINE__, errno,
+							   (std::string("Can not send request: ") + strerror(errno)).c_str());
+
+	m_inFlight.push_back(r.id);
+	return r.id;
+}
+
+GpioctlProtocol::Response GpioctlClient::receive()
+{
+	if (m_inFlight.empty())
+		throw GpioctlException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0, "No request in flight");
+
+	// Whole message in one call, into a buffer for the largest response there is.
+	// MSG_TRUNC returns the real length, should it be longer anyway.
+	ssize_t ret = TEMP_FAILURE_RETRY(recv(m_fd, &m_buffer[0], m_buffer.size(), MSG_TRUNC));
+	if (ret < 0)
+		throw GpioctlException(__PRETTY_FUNCTION__, __FILE__, __LINE__, errno,
+							   (std::string("Can not receive response: ") + strerror(errno)).c_str());
+	if (ret == 0)
+		throw GpioctlException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0, "gpioctld disconnected without a response");
+	if (static_cast<size_t>(ret) > m_buffer.size())
+		throw GpioctlException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0, "Response from gpioctld too long");
+
+	GpioctlProtocol::Response r;
+	if (!GpioctlProtocol::decode(m_buffer.substr(0, ret), &r) || r.id != m_inFlight.front())
+		throw GpioctlException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0, "Malformed response from gpioctld");
+
+	m_inFlight.pop_front();
+	return r;
+}
+
+size_t GpioctlClient::inFlight() const
+{
+	return m_inFlight.size();
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "descriptiveexception.h"
+#include "gpioctlprotocol.h"
+
+class GpioctlException : public DescriptiveException {
+public:
+	typedef DescriptiveException basetype;
+
+	GpioctlException(const char* func, const char* file, int line, int errorNumber, const char* what);
+	virtual const char* what() const noexcept;
+};
+
+// Connection to gpioctld in the binary protocol, kept open for any number of
+// requests. set(), get() and apply() wait for their response. send() and
+// receive() keep many requests in flight at once, receive() returns responses
+// in the order of the requests, with the id send() gave out.
+class GpioctlClient
+{
+public:
+	typedef GpioctlProtocol::Line Line;
+
+	GpioctlClient(const std::string &socketPath = s_defaultSocket);
+	GpioctlClient(const GpioctlClient&) = delete;
+	GpioctlClient& operator=(const GpioctlClient&) = delete;
+	~GpioctlClient();
+
+	void set(const std::string &name, bool value);
+	bool get(const std::string &name);
+	// All lines in one transaction, returns the value of each afterwards.
+	// Throws, if gpioctld rejects them.
+	std::vector<bool> apply(const std::vector<Line> &lines);
+
+	// Returns the id of the request
+	uint32_t send(const std::vector<Line> &lines);
+	// Response to the oldest request in flight, rejected ones included
+	GpioctlProtocol::Response receive();
+	size_t inFlight() const;
+
+	const static std::string s_defaultSocket;
+
+private:
+	int m_fd;
+	uint32_t m_nextId;
+	std::deque<uint32_t> m_inFlight;
+	std::string m_buffer;
+
+	const static size_t s_bufferSize;
+};
@@ -0,0 +1,316 @@
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+}
+
+#include "gpioctlclient.h"
+
+using namespace std;
+
+/* Load test for gpioctld
+ *
+ * Starts clients in parallel, each toggling a GPIO with requests of its own,
+ * and prints throughput and latency percentiles over all of them.
+ *
+ * --socket path      gpioctld socket (/run/gpioctld.socket)
+ * --spawn gpioctld   Start this gpioctld with --simulate on a socket of our own
+ * --clients n        Parallel clients (8)
+ * --requests n       Requests per client (1000)
+ * --gpio name        GPIO to toggle (Relais_Power)
+ * --batch n          Lines per request, all toggling the GPIO (1)
+ * --reconnect        Connect for each request, as clients of old gpioctld had to
+ * --binary           Use the binary protocol through GpioctlClient
+ * --pipeline n       Binary requests in flight per client (1)
+ * --script gpioctl   Run this client script for each request instead, like CI does
+ */
+
+typedef chrono::steady_clock clock_type;
+
+struct result {
+	vector<double> latencies; /* Seconds */
+	int errors;
+};
+
+int connect_to(const string &path)
+{
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path.c_str(), sizeof addr.sun_path - 1);
+
+	if (connect(fd, (struct sockaddr*)&addr, sizeof addr) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Sends request, true if the response is a success */
+bool transact(int fd, const string &request)
+{
+	if (TEMP_FAILURE_RETRY(send(fd, request.data(), request.size(), MSG_NOSIGNAL)) < 0)
+		return false;
+
+	char response[4096];
+	ssize_t ret = TEMP_FAILURE_RETRY(recv(fd, response, sizeof response, 0));
+
+	return ret >= 8 && strncmp(response, "Success:", 8) == 0;
+}
+
+void run_client(const string &path, const string &gpio, int requests, int batch, bool reconnect, result *r)
+{
+	r->latencies.reserve(requests);
+	r->errors = 0;
+
+	int fd = reconnect ? -1 : connect_to(path);
+
+	for (int i=0; i<requests; i++) {
+		string request;
+		for (int b=0; b<batch; b++)
+			request += (b ? "\n" : "") + gpio + ((i + b) % 2 ? " off" : " on");
+
+		auto start = clock_type::now();
+		if (reconnect)
+			fd = connect_to(path);
+
+		bool ok = fd >= 0 && transact(fd, request);
+
+		if (reconnect && fd >= 0) {
+			close(fd);
+			fd = -1;
+		}
+		r->latencies.push_back(chrono::duration<double>(clock_type::now() - start).count());
+
+		if (!ok) {
+			r->errors++;
+			if (!reconnect) {
+				/* Connection is lost, start over */
+				if (fd >= 0)
+					close(fd);
+				fd = connect_to(path);
+			}
+		}
+	}
+
+	if (fd >= 0)
+		close(fd);
+}
+
+void run_binary_client(const string &path, const string &gpio, int requests, int batch, size_t pipeline, result *r)
+{
+	r->latencies.reserve(requests);
+	r->errors = 0;
+
+	try {
+		GpioctlClient client(path);
+		deque<clock_type::time_point> sent;
+
+		for (int i=0; i<requests || client.inFlight(); i++) {
+			if (i < requests) {
+				vector<GpioctlClient::Line> lines;
+				for (int b=0; b<batch; b++)
+					lines.push_back({GpioctlProtocol::OpSet, (i + b) % 2 == 0, gpio});
+
+				sent.push_back(clock_type::now());
+				client.send(lines);
+				if (client.inFlight() < pipeline)
+					continue;
+			}
+
+			auto response = client.receive();
+			r->latencies.push_back(chrono::duration<double>(clock_type::now() - sent.front()).count());
+			sent.pop_front();
+			if (response.status != GpioctlProtocol::StatusOk)
+				r->errors++;
+		}
+	} catch (const GpioctlException &e) {
+		cerr << e.what() << endl;
+		r->errors += requests - r->latencies.size();
+	}
+}
+
+/* Runs the script for each request, with GPIOCTLD_SOCKET pointing at path */
+void run_script_client(const string &path, const string &script, const string &gpio, int requests, result *r)
+{
+	r->latencies.reserve(requests);
+	r->errors = 0;
+
+	for (int i=0; i<requests; i++) {
+		auto start = clock_type::now();
+
+		pid_t pid = fork();
+		if (pid == 0) {
+			setenv("GPIOCTLD_SOCKET", path.c_str(), 1);
+			if (!freopen("/dev/null", "w", stdout))
+				_exit(EXIT_FAILURE);
+			execl(script.c_str(), script.c_str(), gpio.c_str(), i % 2 ? "off" : "on", (char*)NULL);
+			_exit(EXIT_FAILURE);
+		}
+
+		int status = -1;
+		if (pid > 0)
+			waitpid(pid, &status, 0);
+		r->latencies.push_back(chrono::duration<double>(clock_type::now() - start).count());
+
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			r->errors++;
+	}
+}
+
+/* Runs gpioctld --simulate with a fresh listening socket at path as stdin */
+pid_t spawn(const string &gpioctld, const string &path)
+{
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path.c_str(), sizeof addr.sun_path - 1);
+
+	unlink(path.c_str());
+	if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof addr) < 0 || listen(fd, 128) < 0) {
+		cerr << "Can not listen on " << path << ": " << strerror(errno) << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		dup2(fd, STDIN_FILENO);
+		execl(gpioctld.c_str(), gpioctld.c_str(), "--simulate", (char*)NULL);
+		cerr << "Can not start " << gpioctld << ": " << strerror(errno) << endl;
+		_exit(EXIT_FAILURE);
+	}
+	close(fd);
+
+	/* Wait for it to serve */
+	for (int i=0; i<100; i++) {
+		int probe = connect_to(path);
+		if (probe >= 0) {
+			bool ok = transact(probe, "Relais_Power off");
+			close(probe);
+			if (ok)
+				break;
+		}
+		this_thread::sleep_for(chrono::milliseconds(50));
+	}
+
+	return pid;
+}
+
+double percentile(const vector<double> &sorted, double p)
+{
+	if (sorted.empty())
+		return 0.0;
+
+	return sorted[min(sorted.size() - 1, size_t(p * sorted.size()))];
+}
+
+int main(int argc, char *argv[])
+{
+	string path = "/run/gpioctld.socket";
+	string gpioctld;
+	string gpio = "Relais_Power";
+	int clients = 8;
+	int requests = 1000;
+	int batch = 1;
+	bool reconnect = false;
+	bool binary = false;
+	size_t pipeline = 1;
+	string script;
+
+	for (int i=1; i<argc; i++) {
+		string arg(argv[i]);
+		if (arg == "--socket" && i + 1 < argc) {
+			path = argv[++i];
+		} else if (arg == "--spawn" && i + 1 < argc) {
+			gpioctld = argv[++i];
+		} else if (arg == "--clients" && i + 1 < argc) {
+			clients = atoi(argv[++i]);
+		} else if (arg == "--requests" && i + 1 < argc) {
+			requests = atoi(argv[++i]);
+		} else if (arg == "--gpio" && i + 1 < argc) {
+			gpio = argv[++i];
+		} else if (arg == "--batch" && i + 1 < argc) {
+			batch = max(1, atoi(argv[++i]));
+		} else if (arg == "--reconnect") {
+			reconnect = true;
+		} else if (arg == "--binary") {
+			binary = true;
+		} else if (arg == "--pipeline" && i + 1 < argc) {
+			pipeline = max(1, atoi(argv[++i]));
+		} else if (arg == "--script" && i + 1 < argc) {
+			script = argv[++i];
+		} else {
+			cerr << "Usage: " << argv[0] << " [--socket path | --spawn gpioctld] [--clients n] [--requests n] [--gpio name] [--batch n] [--reconnect | --binary [--pipeline n] | --script gpioctl]" << endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	pid_t pid = -1;
+	if (!gpioctld.empty()) {
+		path = "/tmp/gpioctld-loadtest." + to_string(getpid()) + ".socket";
+		pid = spawn(gpioctld, path);
+	}
+
+	vector<result> results(clients);
+	vector<thread> threads;
+
+	auto start = clock_type::now();
+	for (int c=0; c<clients; c++) {
+		if (!script.empty())
+			threads.emplace_back(run_script_client, path, script, gpio, requests, &results[c]);
+		else if (binary)
+			threads.emplace_back(run_binary_client, path, gpio, requests, batch, pipeline, &results[c]);
+		else
+			threads.emplace_back(run_client, path, gpio, requests, batch, reconnect, &results[c]);
+	}
+	for (auto &t : threads)
+		t.join();
+	double seconds = chrono::duration<double>(clock_type::now() - start).count();
+
+	if (pid > 0) {
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+		unlink(path.c_str());
+	}
+
+	vector<double> latencies;
+	int errors = 0;
+	for (auto &r : results) {
+		latencies.insert(latencies.end(), r.latencies.begin(), r.latencies.end());
+		errors += r.errors;
+	}
+	sort(latencies.begin(), latencies.end());
+
+	cout << fixed << setprecision(1);
+	string how = !script.empty() ? " through " + script :
+				 binary ? " binary, " + to_string(pipeline) + " in flight" :
+				 reconnect ? " with a connection each" : "";
+	cout << clients << " clients, " << latencies.size() << " requests of " << batch << " lines" << how
+		 << " in " << seconds << "s, " << errors << " failed" << endl;
+	cout << "Throughput: " << latencies.size() / seconds << " requests/s" << endl;
+	cout << "Latency: p50 " << percentile(latencies, 0.5) * 1e6 << "us, p99 " << percentile(latencies, 0.99) * 1e6
+		 << "us, max " << (latencies.empty() ? 0.0 : latencies.back() * 1e6) << "us" << endl;
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
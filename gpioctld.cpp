@@ -1,9 +1,19 @@
 #include <iostream>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <sstream>
+#include <vector>
 #include <thread>
 
 extern "C" {
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h> /* For memcmp, memrchr */
+#include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/socket.h> /* For accept */
+#include <sys/stat.h> /* For mkdir */
 #include <unistd.h> /* For read, errno, STDIN_FILENO */
 #include <limits.h> /* For PIPE_BUF */
 }
@@ -11,6 +21,9 @@ extern "C" {
 #include "measurement.h"
 #include "analogdiscovery.h"
 #include "gpio.h"
+#include "gpioregistry.h"
+#include "gpioctlprotocol.h"
+#include "measurementservice.h"
 #include "default.h"
 #include "tests.h"
 #include "debug.h"
@@ -24,10 +37,12 @@ using namespace std;
  * and we don't know ahead of time how large the result will be,
  * we use MSG_PEEK|MSG_TRUNC to find out how large the message is,
  * so we can ensure we have a buffer large enough, then read into it.
+ *
+ * Never blocks, returns -1 with errno EAGAIN if there is no message.
  */
 int read_request(int request_fd, string &result)
 {
-	ssize_t ret = TEMP_FAILURE_RETRY(recv(request_fd, NULL, 0, MSG_PEEK|MSG_TRUNC));
+	ssize_t ret = TEMP_FAILURE_RETRY(recv(request_fd, NULL, 0, MSG_PEEK|MSG_TRUNC|MSG_DONTWAIT));
 	if (ret <= 0) {
 		return ret;
 	}
@@ -35,94 +50,672 @@ int read_request(int request_fd, string &result)
 	ssize_t msglen = ret;
 	result.resize(msglen);
 
-	ret = TEMP_FAILURE_RETRY(read(request_fd, &result[0], msglen));
+	ret = TEMP_FAILURE_RETRY(recv(request_fd, &result[0], msglen, MSG_DONTWAIT));
 
 	return ret;
 }
 
-/* Handle requests of the form "<GPIO NAME> <on|off>"
+/* One line of a request */
+struct assignment {
+	GPIORegistry::Id id;
+	bool query;
+	bool value;
+};
+
+/* Points line at the next non-empty line of text from *pos on, without its
+ * line end, and moves *pos past it. False if there is none.
+ */
+bool next_line(const string &text, size_t *pos, const char **line, size_t *length)
+{
+	while (*pos < text.size()) {
+		size_t end = text.find('\n', *pos);
+		if (end == string::npos)
+			end = text.size();
+
+		*line = text.data() + *pos;
+		*length = end - *pos;
+		*pos = end + 1;
+		if (*length > 0)
+			return true;
+	}
+
+	return false;
+}
+
+/* Whether the length characters at text are word */
+bool is_word(const char *text, size_t length, const char *word)
+{
+	return length == strlen(word) && memcmp(text, word, length) == 0;
+}
+
+/* Parse "<GPIO NAME> <on|off|get>" from line, returns why it is invalid or ""
+ *
+ * Both words are looked at in place, only an error copies them.
+ */
+string parse_line(const char *line, size_t length, GPIORegistry const &gpios, assignment &a)
+{
+	auto word_sep = static_cast<const char*>(memrchr(line, ' ', length));
+	if (!word_sep) {
+		/* No space found, malformed */
+		return "missing word separator";
+	}
+
+	a.id = gpios.find(line, word_sep - line);
+	if (a.id == GPIORegistry::npos) {
+		/* No gpio by that name found */
+		return "found no GPIO called: " + string(line, word_sep);
+	}
+
+	const char *value = word_sep + 1;
+	size_t value_length = line + length - value;
+	a.query = is_word(value, value_length, "get");
+	a.value = is_word(value, value_length, "on");
+	if (!a.query && !a.value && !is_word(value, value_length, "off")) {
+		/* Invalid value to set */
+		return "invalid value: " + string(value, value_length);
+	}
+
+	return "";
+}
+
+/* Buffers of a server, reused from request to request. Once they have grown
+ * to the largest request, applying one does not allocate any more.
+ */
+struct scratch {
+	vector<assignment> assignments;
+	GPIOBatch batch;
+	GpioctlProtocol::Request request;
+	GpioctlProtocol::Response response;
+};
+
+/* Sets all assignments at once through batch, then reads back the value of each query.
+ * Throws GPIOException or AnalogDiscoveryException, if the hardware fails.
+ */
+void apply(vector<assignment> &assignments, GPIORegistry const &gpios, GPIOBatch &batch)
+{
+	batch.clear();
+	for (auto &a : assignments) {
+		if (!a.query)
+			batch.add(gpios.gpio(a.id), a.value);
+	}
+	batch.apply();
+
+	for (auto &a : assignments) {
+		if (a.query)
+			a.value = gpios.gpio(a.id)->getValue();
+	}
+}
+
+/* Handle requests of the form "<GPIO NAME> <on|off|get>"
  *
  * The client writes one message before of the name of the GPIO
- * and whether to set the state to "on" or "off".
+ * and whether to set the state to "on" or "off", or to "get" it.
  *
  * The client will wait for a response or a disconnect without response.
+ * It may send further requests on the same connection afterwards.
  *
  * Responses either start "Invalid request: " for incorrect input,
+ * "Failed: " if the hardware failed, with some lines possibly set already,
  * or "Success: " for a successful call.
+ *
+ * A request of several lines is a batch. It is applied only if all of its
+ * lines are valid, then all at once: Analog Discovery lines in one device
+ * commit, lines of one gpiochip request in one ioctl. Queries are answered
+ * after that. The response holds one line per request line after "Success:",
+ * or names the first invalid line.
  */
-void handle_request(int request_fd, list<shared_ptr<GPIO> > const &gpios)
+string handle_request(const string &request, GPIORegistry const &gpios, scratch &s)
 {
-	string request;
-	int ret = read_request(request_fd, request);
-	if (ret < 0) {
-		cerr << "Reading request failed" << endl;
-		return;
+	const char *line;
+	size_t length;
+	size_t count = 0;
+	for (size_t pos = 0; next_line(request, &pos, &line, &length);)
+		count++;
+	bool batch = count > 1;
+
+	if (count == 0) {
+		char response[] = "Invalid request: missing word separator";
+		return string(response, sizeof response);
 	}
 
-	if (ret == 0) {
-		/* Client connected then disconnected without sending message */
-		return;
+	auto &assignments = s.assignments;
+	assignments.resize(count);
+	size_t i = 0;
+	for (size_t pos = 0; next_line(request, &pos, &line, &length); i++) {
+		string error = parse_line(line, length, gpios, assignments[i]);
+		if (error.empty())
+			continue;
+
+		if (batch)
+			return "Invalid request: line " + to_string(i + 1) + ": " + error;
+		if (error == "missing word separator") {
+			char response[] = "Invalid request: missing word separator";
+			return string(response, sizeof response);
+		}
+		return "Invalid request: " + error;
 	}
 
-	size_t word_sep = request.rfind(' ');
-	if (word_sep == string::npos) {
-		/* No space found, malformed */
-		char response[] = "Invalid request: missing word separator";
-		TEMP_FAILURE_RETRY(write(request_fd, response, sizeof response));
-		return;
+	/* A failing device is answered, the daemon keeps serving everyone else */
+	try {
+		apply(assignments, gpios, s.batch);
+	} catch (const GPIOException &e) {
+		return string("Failed: ") + e.what();
+	} catch (const AnalogDiscoveryException &e) {
+		return string("Failed: ") + e.what();
+	}
+
+	string response(batch ? "Success:" : "Success: ");
+	for (auto &a : assignments) {
+		if (batch)
+			response += "\n";
+
+		if (a.query) {
+			response += gpios.name(a.id);
+			response += a.value ? " is on" : " is off";
+		} else {
+			response += "set ";
+			response += gpios.name(a.id);
+			response += a.value ? " to on" : " to off";
+		}
+	}
+	return response;
+}
+
+/* Handle binary requests, see gpioctlprotocol.h
+ *
+ * Same as a text batch, but the response holds the value of each line.
+ */
+string handle_binary_request(const string &request, GPIORegistry const &gpios, scratch &s)
+{
+	auto &r = s.request;
+	r.id = 0;
+	auto &response = s.response;
+	response.status = GpioctlProtocol::StatusInvalid;
+	response.errorLine = 0;
+	response.error.clear();
+	response.values.clear();
+
+	if (!GpioctlProtocol::decode(request, &r)) {
+		/* Still the right one, if the header was intact */
+		response.id = r.id;
+		response.error = "malformed request";
+		return GpioctlProtocol::encode(response);
 	}
+	response.id = r.id;
+
+	auto &assignments = s.assignments;
+	assignments.resize(r.lines.size());
+	for (size_t i=0; i<r.lines.size(); i++) {
+		auto &a = assignments[i];
+		a.id = gpios.find(r.lines[i].name);
+		a.query = r.lines[i].op == GpioctlProtocol::OpGet;
+		a.value = r.lines[i].value;
 
-	string gpio_name = request.substr(0, word_sep);
-	string value = request.substr(word_sep + 1, string::npos);
+		if (a.id == GPIORegistry::npos) {
+			response.errorLine = i;
+			response.error = "found no GPIO called: " + r.lines[i].name;
+			return GpioctlProtocol::encode(response);
+		}
+	}
 
-	SharedGPIOHandle gpio;
 	try {
-		gpio = getGPIOForName(gpios, gpio_name);
-	} catch (GPIOException e) {
-		/* No gpio by that name found */
-		string response("Invalid request: found no GPIO called: ");
-		response += gpio_name;
-		TEMP_FAILURE_RETRY(write(request_fd, response.c_str(), response.length()));
-		return;
+		apply(assignments, gpios, s.batch);
+	} catch (const GPIOException &e) {
+		response.status = GpioctlProtocol::StatusFailed;
+		response.error = e.what();
+		return GpioctlProtocol::encode(response);
+	} catch (const AnalogDiscoveryException &e) {
+		response.status = GpioctlProtocol::StatusFailed;
+		response.error = e.what();
+		return GpioctlProtocol::encode(response);
 	}
 
-	if (value == "on") {
-		gpio->setValue(true);
-	} else if (value == "off") {
-		gpio->setValue(false);
-	} else {
-		/* Invalid value to set */
-		string response("Invalid request: invalid value: ");
-		response += value;
-		TEMP_FAILURE_RETRY(write(request_fd, response.c_str(), response.length()));
-		return;
+	response.status = GpioctlProtocol::StatusOk;
+	for (auto &a : assignments)
+		response.values.push_back(a.value);
+
+	return GpioctlProtocol::encode(response);
+}
+
+/* Requests starting with "measure" control measurements */
+bool is_measure_request(const string &request)
+{
+	return request.compare(0, 8, "measure ") == 0 || request == "measure";
+}
+
+/* Whole string as a number, false if it is none */
+bool parse_number(const string &text, double *value)
+{
+	char *end = NULL;
+	*value = strtod(text.c_str(), &end);
+	return !text.empty() && *end == '\0';
+}
+
+/* Parse "<option>=<value>" words into job, returns why they are invalid or ""
+ *
+ * Options are named like those of FreqResp, the defaults are the same.
+ */
+string parse_job(const vector<string> &words, MeasurementService::Job &job)
+{
+	job.fMin = fMin;
+	job.fMax = fMax;
+	job.pointsPerDecade = pointsPerDecade;
+	job.channel = channel < 0 ? 'l' : channel;
+	job.method = method;
+	job.estimator = estimator;
+	job.targetSnr = targetSnr;
+	job.maxSettle = maxSettle / 1000.0;
+	job.settleTolerance = settleTolerance;
+	job.outputCalibration = outputCalibration;
+	job.selectSpeaker = false;
+	job.speaker = speakerChannel;
+
+	for (auto &word : words) {
+		size_t sep = word.find('=');
+		if (sep == string::npos)
+			return "missing value: " + word;
+
+		string key = word.substr(0, sep);
+		string value = word.substr(sep + 1);
+		double number = 0.0;
+		bool numeric = parse_number(value, &number);
+
+		if (key == paramfMin && numeric && number > 0.0) {
+			job.fMin = number;
+		} else if (key == paramfMax && numeric && number > 0.0) {
+			job.fMax = number;
+		} else if (key == paramPointsPerDecade && numeric && number >= 1.0 && number <= 1000.0) {
+			job.pointsPerDecade = static_cast<int>(number);
+		} else if (key == paramChannel && (value == "l" || value == "r" || value == "s")) {
+			job.channel = value[0];
+		} else if (key == paramSpeakerChannel && (value == "lo" || value == "mid" || value == "hi")) {
+			job.selectSpeaker = true;
+			job.speaker = value == "lo" ? Speaker::Lo : value == "mid" ? Speaker::Mid : Speaker::Hi;
+		} else if (key == paramMethod && (value == "sine" || value == "multitone" || value == "sweep")) {
+			job.method = value == "sine" ? Measurement::MethodSteppedSine :
+						 value == "multitone" ? Measurement::MethodMultitone : Measurement::MethodExponentialSweep;
+		} else if (key == paramEstimator && (value == "rms" || value == "dft")) {
+			job.estimator = value == "rms" ? EstimatorRms : EstimatorSingleBin;
+		} else if (key == paramTargetSnr && numeric) {
+			job.targetSnr = number;
+		} else if (key == paramMaxSettle && numeric && number >= 0.0) {
+			job.maxSettle = number / 1000.0;
+		} else if (key == paramSettleTolerance && numeric && number > 0.0) {
+			job.settleTolerance = number;
+		} else if (key == paramOutputCalibration && numeric) {
+			job.outputCalibration = number;
+		} else {
+			return "invalid option: " + word;
+		}
 	}
 
-	string response("Success: set ");
-	response += gpio_name;
-	response += " to ";
-	response += value;
-	TEMP_FAILURE_RETRY(write(request_fd, response.c_str(), response.length()));
+	if (job.fMax <= job.fMin)
+		return "fmax must be above fmin";
+
+	return "";
 }
 
-int main(int argc, char *argv[])
+/* "job <id> <state> <points done>/<points total>" */
+string format_status(const MeasurementService::Status &s)
 {
-	auto sharedDev = AnalogDiscovery::getFirstAvailableDevice();
-	auto gpios = loadDefaultGPIOMapping(sharedDev);
-
-	for (;;) {
-		/* Listening UNIX socket fd is passed as stdin */
-		int ret = TEMP_FAILURE_RETRY(accept(STDIN_FILENO, NULL, NULL));
-		if (ret < 0) {
-			cerr << "Accepting request failed" << endl;
-			return 1;
+	return "job " + to_string(s.id) + " " + MeasurementService::stateName(s.state) + " "
+		+ to_string(s.pointsDone) + "/" + to_string(s.pointsTotal);
+}
+
+/* Largest "Result: " response. AF_UNIX refuses SEQPACKET messages beyond
+ * its send buffer, about 212 KiB by default.
+ */
+const size_t result_chunk_size = 64 * 1024;
+
+/* Queues "Result: # <file>" responses with content, split at line ends so
+ * none exceeds result_chunk_size. Joining their lines after the first gives
+ * the file again, without its last line end.
+ */
+void queue_result(const string &file, const string &content, deque<string> &responses)
+{
+	string header = "Result: # " + file + "\n";
+	size_t room = result_chunk_size - header.size();
+	size_t begin = 0;
+
+	do {
+		size_t end = content.size();
+		if (end - begin > room) {
+			end = content.rfind('\n', begin + room - 1);
+			/* A line longer than a whole response is cut */
+			end = end == string::npos || end < begin ? begin + room : end + 1;
+		}
+
+		responses.push_back(header);
+		responses.back().append(content, begin, end - begin);
+		if (responses.back().back() == '\n')
+			responses.back().pop_back();
+		begin = end;
+	} while (begin < content.size());
+}
+
+/* A connected client and the responses it has not taken yet */
+struct client {
+	int fd;
+	deque<string> pending;
+	bool waiting;
+	/* Job whose progress it is sent, 0 for none, and the last one sent */
+	unsigned int watching;
+	string progress;
+};
+
+/* Serves all clients from one epoll loop.
+ *
+ * Clients stay connected for as many requests as they like. Requests are
+ * handled one at a time on this thread, which is all the serialization the
+ * GPIOs need, but no client can hold up the others: sockets never block,
+ * and responses a client does not take in time wait in its queue. Until that
+ * is empty, further requests of that client are left in its socket.
+ *
+ * Measurements run on the thread of the measurement service and only share
+ * the device with GPIO requests, its digital IO is locked on its own. The
+ * service wakes this loop on progress, which is passed on to watching clients.
+ */
+class server
+{
+public:
+	server(int listen_fd, GPIORegistry const &gpios, MeasurementService &measurements) :
+		m_listen_fd(listen_fd),
+		m_epoll_fd(epoll_create1(EPOLL_CLOEXEC)),
+		m_gpios(gpios),
+		m_measurements(measurements)
+	{
+		fcntl(m_listen_fd, F_SETFL, fcntl(m_listen_fd, F_GETFL) | O_NONBLOCK);
+		watch(m_listen_fd, EPOLLIN, EPOLL_CTL_ADD);
+		watch(m_measurements.eventFd(), EPOLLIN, EPOLL_CTL_ADD);
+	}
+
+	~server()
+	{
+		for (auto &c : m_clients)
+			TEMP_FAILURE_RETRY(close(c.first));
+		TEMP_FAILURE_RETRY(close(m_epoll_fd));
+	}
+
+	int run()
+	{
+		struct epoll_event events[64];
+
+		for (;;) {
+			int n = epoll_wait(m_epoll_fd, events, 64, -1);
+			if (n < 0 && errno != EINTR) {
+				cerr << "Waiting for requests failed" << endl;
+				return 1;
+			}
+
+			for (int i=0; i<n; i++) {
+				int fd = events[i].data.fd;
+
+				if (fd == m_listen_fd) {
+					if (!accept_clients())
+						return 1;
+					continue;
+				}
+
+				if (fd == m_measurements.eventFd()) {
+					report_progress();
+					continue;
+				}
+
+				auto it = m_clients.find(fd);
+				if (it == m_clients.end())
+					continue;
+
+				if ((it->second.waiting || it->second.watching) && (events[i].events & (EPOLLHUP | EPOLLERR)))
+					/* Gone without taking its responses */
+					disconnect(fd);
+				else if ((events[i].events & EPOLLOUT) && !flush(it->second))
+					disconnect(fd);
+				else if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !serve(it->second))
+					disconnect(fd);
+			}
+		}
+	}
+
+private:
+	int m_listen_fd;
+	int m_epoll_fd;
+	GPIORegistry const &m_gpios;
+	MeasurementService &m_measurements;
+	map<int, client> m_clients;
+	scratch m_scratch;
+
+	void watch(int fd, uint32_t events, int op)
+	{
+		struct epoll_event ev;
+		ev.events = events;
+		ev.data.fd = fd;
+		epoll_ctl(m_epoll_fd, op, fd, &ev);
+	}
+
+	bool accept_clients()
+	{
+		for (;;) {
+			int fd = TEMP_FAILURE_RETRY(accept4(m_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC));
+			if (fd < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED)
+					return true;
+				cerr << "Accepting request failed" << endl;
+				return false;
+			}
+
+			m_clients[fd] = client{fd, {}, false, 0, ""};
+			watch(fd, EPOLLIN, EPOLL_CTL_ADD);
 		}
-		int request_fd = ret;
+	}
+
+	/* Handles all requests waiting, false if the client is gone */
+	bool serve(client &c)
+	{
+		string request;
+
+		while (c.pending.empty() && !c.watching) {
+			int ret = read_request(c.fd, request);
+			if (ret < 0)
+				return errno == EAGAIN || errno == EWOULDBLOCK;
+			if (ret == 0)
+				/* Client disconnected */
+				return false;
 
-		handle_request(request_fd, gpios);
+			if (GpioctlProtocol::isBinary(request))
+				c.pending.push_back(handle_binary_request(request, m_gpios, m_scratch));
+			else if (is_measure_request(request))
+				c.pending.push_back(handle_measure_request(request, c));
+			else
+				c.pending.push_back(handle_request(request, m_gpios, m_scratch));
+			if (!flush(c))
+				return false;
+		}
 
-		TEMP_FAILURE_RETRY(close(request_fd));
+		return true;
 	}
 
-	return 0;
+	/* Sends queued responses, false if the client is gone */
+	bool flush(client &c)
+	{
+		while (!c.pending.empty()) {
+			auto &response = c.pending.front();
+			ssize_t ret = TEMP_FAILURE_RETRY(send(c.fd, response.data(), response.size(), MSG_DONTWAIT | MSG_NOSIGNAL));
+			if (ret < 0) {
+				if (errno != EAGAIN && errno != EWOULDBLOCK)
+					return false;
+
+				/* Wait until it takes them, stop reading meanwhile */
+				if (!c.waiting) {
+					c.waiting = true;
+					update_events(c);
+				}
+				return true;
+			}
+			c.pending.pop_front();
+		}
+
+		/* Requests queued up meanwhile are reported right away again */
+		if (c.waiting) {
+			c.waiting = false;
+			update_events(c);
+		}
+
+		return true;
+	}
+
+	/* Clients are not read from while responses wait or they watch a job */
+	void update_events(client &c)
+	{
+		watch(c.fd, c.waiting ? EPOLLOUT : c.watching ? 0u : uint32_t(EPOLLIN), EPOLL_CTL_MOD);
+	}
+
+	/* Handle requests of the form "measure <command> [arguments]"
+	 *
+	 *   measure start [<option>=<value> ...]  queues a measurement, options as
+	 *                                         of FreqResp: fmin, fmax,
+	 *                                         points-per-decade, channel,
+	 *                                         speakerchannel, method, ...
+	 *   measure status <id>                   "job <id> <state> <done>/<total>"
+	 *   measure list                          the status of each job
+	 *   measure watch <id>                    a "Progress: " response on each
+	 *                                         change, until the job has ended
+	 *   measure result <id>                   "Result: # <file>" responses with
+	 *                                         the content of each result file
+	 *                                         of a done job, then "Success: "
+	 *   measure cancel <id>                   stops or dequeues the job
+	 */
+	string handle_measure_request(const string &request, client &c)
+	{
+		vector<string> words;
+		istringstream ss(request);
+		for (string word; ss >> word;)
+			words.push_back(word);
+
+		string command = words.size() > 1 ? words[1] : "";
+
+		if (command == "start") {
+			MeasurementService::Job job;
+			string error = parse_job(vector<string>(words.begin() + 2, words.end()), job);
+			if (!error.empty())
+				return "Invalid request: " + error;
+
+			MeasurementService::Status status;
+			m_measurements.status(m_measurements.submit(job), &status);
+			return "Success: " + format_status(status);
+		}
+
+		if (command == "list" && words.size() == 2) {
+			string response("Success:");
+			for (auto &status : m_measurements.statuses())
+				response += "\n" + format_status(status);
+			return response;
+		}
+
+		if (words.size() != 3 || (command != "status" && command != "watch" && command != "result" && command != "cancel"))
+			return "Invalid request: unknown measure command";
+
+		char *end = NULL;
+		unsigned long id = strtoul(words[2].c_str(), &end, 10);
+		MeasurementService::Status status;
+		if (*end != '\0' || !m_measurements.status(id, &status))
+			return "Invalid request: found no job: " + words[2];
+
+		if (command == "cancel") {
+			if (!m_measurements.cancel(id))
+				return "Invalid request: job " + words[2] + " has ended";
+			m_measurements.status(id, &status);
+		} else if (command == "watch" && !MeasurementService::hasEnded(status.state)) {
+			c.watching = id;
+			c.progress = format_status(status);
+			update_events(c);
+			return "Progress: " + c.progress;
+		} else if (command == "result") {
+			if (status.state != MeasurementService::StateDone)
+				return "Invalid request: " + format_status(status);
+
+			/* Queued ahead of the "Success: " returned below */
+			for (auto &result : m_measurements.results(id))
+				queue_result(result.first, result.second, c.pending);
+		}
+
+		return "Success: " + format_status(status);
+	}
+
+	/* Passes progress of measurements on to the clients watching them */
+	void report_progress()
+	{
+		m_measurements.clearEvent();
+
+		vector<int> gone;
+		for (auto &entry : m_clients) {
+			client &c = entry.second;
+			MeasurementService::Status status;
+			if (!c.watching || !m_measurements.status(c.watching, &status))
+				continue;
+
+			string progress = format_status(status);
+			if (MeasurementService::hasEnded(status.state)) {
+				c.pending.push_back("Success: " + progress);
+				c.watching = 0;
+				if (!c.waiting)
+					update_events(c);
+			} else if (progress != c.progress) {
+				c.pending.push_back("Progress: " + progress);
+			}
+			c.progress = progress;
+
+			if (!flush(c))
+				gone.push_back(c.fd);
+		}
+
+		for (int fd : gone)
+			disconnect(fd);
+	}
+
+	void disconnect(int fd)
+	{
+		epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+		TEMP_FAILURE_RETRY(close(fd));
+		m_clients.erase(fd);
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	// --simulate runs without hardware, e.g. to try clients
+	string mappingFile;
+	string profile = GPIOMapping::s_defaultProfile;
+	string jobsDirectory = "/var/lib/gpioctld";
+	for (int i=1; i<argc; i++) {
+		string arg(argv[i]);
+		if (arg == "--simulate") {
+			AnalogDiscovery::setBackend(AnalogDiscovery::BackendSimulated);
+			setHostGPIOSimulated(true);
+		} else if (arg == "--gpio-mapping" && i + 1 < argc) {
+			mappingFile = argv[++i];
+		} else if (arg == "--gpio-profile" && i + 1 < argc) {
+			profile = argv[++i];
+		} else if (arg == "--jobs-dir" && i + 1 < argc) {
+			jobsDirectory = argv[++i];
+		}
+	}
+
+	try {
+		GPIOMapping::setDefault(mappingFile.empty() ? GPIOMapping::builtIn(profile) : GPIOMapping::fromFile(mappingFile, profile));
+	} catch (const GPIOException &e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+
+	auto sharedDev = AnalogDiscovery::getFirstAvailableDevice();
+	GPIORegistry gpios(loadDefaultGPIOMapping(sharedDev));
+
+	/* Measurement results go here */
+	if (mkdir(jobsDirectory.c_str(), 0755) < 0 && errno != EEXIST)
+		cerr << "Can not create " << jobsDirectory << ", measurements will not be saved" << endl;
+	MeasurementService measurements(sharedDev, gpios, jobsDirectory);
+
+	/* Listening UNIX socket fd is passed as stdin */
+	server s(STDIN_FILENO, gpios, measurements);
+	return s.run();
 }
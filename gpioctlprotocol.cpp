@@ -0,0 +1,128 @@
+#include "gpioctlprotocol.h"
+
+#include <string.h>
+
+const uint8_t GpioctlProtocol::s_magic = 0xb7;
+const uint8_t GpioctlProtocol::s_version = 1;
+
+static const size_t requestHeaderSize = 8;
+static const size_t lineHeaderSize = 4;
+static const size_t responseHeaderSize = 12;
+
+template <class T>
+static void put(std::string *s, T value)
+{
+	s->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <class T>
+static T get(const std::string &s, size_t offset)
+{
+	T ret;
+	memcpy(&ret, s.data() + offset, sizeof(ret));
+	return ret;
+}
+
+bool GpioctlProtocol::isBinary(const std::string &message)
+{
+	return !message.empty() && static_cast<uint8_t>(message[0]) == s_magic;
+}
+
+std::string GpioctlProtocol::encode(const Request &r)
+{
+	std::string ret;
+	put<uint8_t>(&ret, s_magic);
+	put<uint8_t>(&ret, s_version);
+	put<uint16_t>(&ret, r.lines.size());
+	put<uint32_t>(&ret, r.id);
+
+	for (auto &l : r.lines) {
+		put<uint8_t>(&ret, l.op);
+		put<uint8_t>(&ret, l.value);
+		put<uint16_t>(&ret, l.name.size());
+		ret += l.name;
+	}
+
+	return ret;
+}
+
+std::string GpioctlProtocol::encode(const Response &r)
+{
+	std::string ret;
+	put<uint8_t>(&ret, s_magic);
+	put<uint8_t>(&ret, s_version);
+	put<uint8_t>(&ret, r.status);
+	put<uint8_t>(&ret, 0);
+	put<uint16_t>(&ret, r.status == StatusOk ? r.values.size() : 0);
+	put<uint16_t>(&ret, r.errorLine);
+	put<uint32_t>(&ret, r.id);
+
+	if (r.status == StatusOk) {
+		for (bool v : r.values)
+			put<uint8_t>(&ret, v);
+	} else {
+		ret += r.error;
+	}
+
+	return ret;
+}
+
+bool GpioctlProtocol::decode(const std::string &message, Request *r)
+{
+	if (message.size() < requestHeaderSize || !isBinary(message) || get<uint8_t>(message, 1) != s_version)
+		return false;
+
+	size_t count = get<uint16_t>(message, 2);
+	r->id = get<uint32_t>(message, 4);
+	r->lines.resize(count);
+
+	size_t offset = requestHeaderSize;
+	for (auto &l : r->lines) {
+		if (message.size() < offset + lineHeaderSize)
+			return false;
+
+		uint8_t op = get<uint8_t>(message, offset);
+		if (op != OpSet && op != OpGet)
+			return false;
+		l.op = static_cast<Op>(op);
+		l.value = get<uint8_t>(message, offset + 1);
+
+		size_t length = get<uint16_t>(message, offset + 2);
+		offset += lineHeaderSize;
+		if (message.size() < offset + length)
+			return false;
+		l.name.assign(message, offset, length);
+		offset += length;
+	}
+
+	return offset == message.size();
+}
+
+bool GpioctlProtocol::decode(const std::string &message, Response *r)
+{
+	if (message.size() < responseHeaderSize || !isBinary(message) || get<uint8_t>(message, 1) != s_version)
+		return false;
+
+	uint8_t status = get<uint8_t>(message, 2);
+	if (status != StatusOk && status != StatusInvalid && status != StatusFailed)
+		return false;
+	r->status = static_cast<Status>(status);
+
+	size_t count = get<uint16_t>(message, 4);
+	r->errorLine = get<uint16_t>(message, 6);
+	r->id = get<uint32_t>(message, 8);
+	r->values.clear();
+	r->error.clear();
+
+	if (r->status != StatusOk) {
+		r->error.assign(message, responseHeaderSize, std::string::npos);
+		return true;
+	}
+
+	if (message.size() != responseHeaderSize + count)
+		return false;
+	for (size_t i=0; i<count; i++)
+		r->values.push_back(get<uint8_t>(message, responseHeaderSize + i));
+
+	return true;
+}
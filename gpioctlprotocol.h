@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Binary form of gpioctld requests, next to the text one. Both ends are on one
+// host, so fields are in host byte order. A request is
+//
+//   uint8 magic, uint8 version, uint16 count, uint32 id,
+//   count times: uint8 op, uint8 value, uint16 name length, name
+//
+// and is answered by
+//
+//   uint8 magic, uint8 version, uint8 status, uint8 reserved, uint16 count,
+//   uint16 error line, uint32 id, then count values or the error text
+//
+// The id comes back in the response, so clients can keep many requests in
+// flight on one connection. Responses come in the order of the requests.
+class GpioctlProtocol
+{
+public:
+	const static uint8_t s_magic;
+	const static uint8_t s_version;
+
+	enum Op {
+		OpSet = 0,
+		OpGet = 1
+	};
+
+	enum Status {
+		StatusOk = 0,
+		StatusInvalid = 1,
+		StatusFailed = 2	// Valid, but setting or reading the GPIOs failed, some may be set
+	};
+
+	struct Line {
+		Op op;
+		bool value;
+		std::string name;
+	};
+
+	struct Request {
+		uint32_t id;
+		std::vector<Line> lines;
+	};
+
+	struct Response {
+		uint32_t id;
+		Status status;
+		// StatusInvalid: index of the line at fault and why. StatusFailed: why
+		uint16_t errorLine;
+		std::string error;
+		// StatusOk: value of each line, after all were set
+		std::vector<bool> values;
+	};
+
+	// Text requests never start with the magic
+	static bool isBinary(const std::string &message);
+
+	static std::string encode(const Request &r);
+	static std::string encode(const Response &r);
+	// False, if message is not a well formed one
+	static bool decode(const std::string &message, Request *r);
+	static bool decode(const std::string &message, Response *r);
+};
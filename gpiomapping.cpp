@@ -0,0 +1,286 @@
+#include "gpiomapping.h"
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+
+#include "analogdiscovery.h"
+
+const std::string GPIOMapping::s_defaultProfile = "stereo-cubes";
+std::unique_ptr<GPIOMapping> GPIOMapping::s_default;
+
+static const char builtInMapping[] = R"(
+# Mapping as in schematics
+[schematics]
+# Analog Discovery outputs
+Front_LED_1 = ad 0 out 0
+Front_LED_2 = ad 1 out 0
+Front_LED_3 = ad 2 out 0
+Front_LED_4 = ad 3 out 0
+Front_LED_5 = ad 4 out 0
+# This is the main Power for the speaker
+Relais_Power = ad 9 out 1
+# This is to check, if load resistors are damaged
+Relais_K109 = ad 10 out 0
+# 4 or 6 Ohm Load for J103-J105
+Relais_K108 = ad 11 out 0
+# 4 or 6 Ohm Load for J100-J102
+Relais_K104 = ad 12 out 0
+# Load is switched thru a multiplexer. Speaker outputs can not shortcirquid!
+# So we have one nEn and two ADR lines here
+ADR0 = ad 13 out 0
+ADR1 = ad 14 out 0
+Enable = ad 15 out 0
+# MinnowBoard outputs
+Volume Button + = sysfs 477 out 0
+Volume Button - = sysfs 478 out 0
+Enc3 = sysfs 479 out 0
+Station1 Button = sysfs 472 out 0
+Station2 Button = sysfs 473 out 0
+Station3 Button = sysfs 485 out 0
+Station4 Button = sysfs 475 out 0
+Power Button = sysfs 484 out 0
+# Investigate: This must be 1, othewise speaker tries to flash. Inverted?
+Reset Button = sysfs 474 out 1
+Setup Button = sysfs 338 out 0
+# MinnowBoard inputs
+Led 1 = sysfs 509 in
+Led 2 = sysfs 340 in
+Led 3 = sysfs 505 in
+Led 4 = sysfs 339 in
+Led 5 = sysfs 504 in
+
+[stereo-cubes]
+# Analog Discovery outputs
+Front_LED_1 = ad 0 out 0
+Front_LED_2 = ad 1 out 0
+Front_LED_3 = ad 2 out 0
+Front_LED_4 = ad 3 out 0
+Front_LED_5 = ad 4 out 0
+Relais_Power = ad 9 out 0
+Relais_K109 = ad 10 out 0
+Relais_K108 = ad 11 out 0
+Relais_K104 = ad 12 out 0
+ADR0 = ad 13 out 0
+ADR1 = ad 14 out 0
+Enable = ad 15 out 0
+# MinnowBoard outputs
+Enc3 = sysfs 479 out 0
+Volume Button + = sysfs 472 out 0
+Volume Button - = sysfs 485 out 0
+Power Button = sysfs 484 out 0
+Reset Button = sysfs 474 out 1
+Setup Button = sysfs 338 out 0
+# MinnowBoard inputs
+Led 1 = sysfs 509 in
+Led 2 = sysfs 340 in
+Led 3 = sysfs 505 in
+Led 4 = sysfs 339 in
+Led 5 = sysfs 504 in
+)";
+
+static std::string trim(const std::string &s)
+{
+	auto begin = s.find_first_not_of(" \t\r");
+	if (begin == std::string::npos)
+		return "";
+
+	return s.substr(begin, s.find_last_not_of(" \t\r") - begin + 1);
+}
+
+GPIOMapping GPIOMapping::fromFile(const std::string &path, const std::string &profile)
+{
+	std::ifstream file(path);
+	if (!file)
+		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0, ("Can not open GPIO mapping " + path).c_str());
+
+	std::stringstream text;
+	text << file.rdbuf();
+
+	return fromString(text.str(), profile, path);
+}
+
+GPIOMapping GPIOMapping::fromString(const std::string &text, const std::string &profile, const std::string &origin)
+{
+	GPIOMapping ret;
+	ret.m_profile = profile;
+
+	std::vector<std::string> profiles;
+	std::string current;
+	std::istringstream lines(text);
+	std::string line;
+
+	for (int lineNumber=1; std::getline(lines, line); lineNumber++) {
+		auto error = [&](const std::string &what) {
+			return GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
+								 (origin + ":" + std::to_string(lineNumber) + ": " + what).c_str());
+		};
+
+		line = trim(line.substr(0, line.find('#')));
+		if (line.empty())
+			continue;
+
+		if (line.front() == '[') {
+			if (line.back() != ']')
+				throw error("Missing ] after profile name");
+			current = trim(line.substr(1, line.size() - 2));
+			if (std::find(profiles.begin(), profiles.end(), current) != profiles.end())
+				throw error("Profile " + current + " exists already");
+			profiles.push_back(current);
+			continue;
+		}
+
+		if (current.empty())
+			throw error("GPIO outside of a profile");
+		auto separator = line.find('=');
+		if (separator == std::string::npos)
+			throw error("Missing = after GPIO name");
+
+		Entry e;
+		e.name = trim(line.substr(0, separator));
+		if (e.name.empty())
+			throw error("Missing GPIO name");
+
+		std::istringstream fields(line.substr(separator + 1));
+		std::string source, direction, value, extra;
+		long number = -1;
+		fields >> source >> number >> direction >> value >> extra;
+
+		if (source == "ad")
+			e.source = SourceAnalogDiscovery;
+		else if (source == "sysfs")
+			e.source = SourceSysFs;
+		else
+			throw error("Unknown source \"" + source + "\" for " + e.name + ", must be ad or sysfs");
+
+		if (number < 0 || (e.source == SourceAnalogDiscovery && number > 15))
+			throw error("Invalid number for " + e.name);
+		e.number = number;
+
+		if (direction == "out")
+			e.direction = GPIO::DirectionOut;
+		else if (direction == "in")
+			e.direction = GPIO::DirectionIn;
+		else
+			throw error("Invalid direction \"" + direction + "\" for " + e.name + ", must be in or out");
+
+		if (value.empty() || value == "0")
+			e.value = false;
+		else if (value == "1")
+			e.value = true;
+		else
+			throw error("Invalid value \"" + value + "\" for " + e.name + ", must be 0 or 1");
+
+		if (!extra.empty())
+			throw error("Unexpected \"" + extra + "\" after " + e.name);
+
+		// All profiles are checked, only the selected one is kept
+		if (current != profile)
+			continue;
+
+		for (auto &other : ret.m_entries) {
+			if (other.name == e.name)
+				throw error("GPIO " + e.name + " exists already");
+			if (other.source == e.source && other.number == e.number)
+				throw error(e.name + " uses the same pin as " + other.name);
+		}
+
+		ret.m_entries.push_back(e);
+	}
+
+	if (std::find(profiles.begin(), profiles.end(), profile) == profiles.end()) {
+		std::string known;
+		for (auto &p : profiles)
+			known += (known.empty() ? "" : ", ") + p;
+		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
+							(origin + ": No profile " + profile + ", there are: " + known).c_str());
+	}
+
+	return ret;
+}
+
+GPIOMapping GPIOMapping::builtIn(const std::string &profile)
+{
+	return fromString(builtInMapping, profile);
+}
+
+void GPIOMapping::setDefault(const GPIOMapping &m)
+{
+	s_default.reset(new GPIOMapping(m));
+}
+
+const GPIOMapping &GPIOMapping::getDefault()
+{
+	if (!s_default)
+		setDefault(builtIn());
+
+	return *s_default;
+}
+
+const std::string &GPIOMapping::profile() const
+{
+	return m_profile;
+}
+
+const std::vector<GPIOMapping::Entry> &GPIOMapping::entries() const
+{
+	return m_entries;
+}
+
+std::list<SharedGPIOHandle> bindGPIOMapping(const GPIOMapping &mapping, AnalogDiscoveryProvider device, bool lazy)
+{
+	std::list<SharedGPIOHandle> gpios;
+
+	if (lazy) {
+		// Shared by all lazy handles, so device is asked only once
+		struct Device {
+			std::mutex mutex;
+			AnalogDiscoveryProvider provider;
+			std::shared_ptr<AnalogDiscovery> handle;
+		};
+		auto shared = std::make_shared<Device>();
+		shared->provider = device;
+
+		for (auto &e : mapping.entries()) {
+			GPIOLazy::Factory factory;
+			if (e.source == GPIOMapping::SourceAnalogDiscovery) {
+				factory = [shared, e]() {
+					std::shared_ptr<AnalogDiscovery> ad;
+					{
+						std::lock_guard<std::mutex> lock(shared->mutex);
+						if (!shared->handle)
+							shared->handle = shared->provider();
+						ad = shared->handle;
+					}
+					return createGPIO(e.name, ad, e.number, e.direction, e.value);
+				};
+			} else {
+				factory = [e]() { return createGPIO(e.name, e.number, e.direction, e.value); };
+			}
+
+			gpios.push_back(std::make_shared<GPIOLazy>(e.name, factory));
+		}
+
+		return gpios;
+	}
+
+	std::shared_ptr<AnalogDiscovery> ad;
+	std::unique_ptr<DigitalIoTransaction> io;
+
+	for (auto &e : mapping.entries()) {
+		if (e.source == GPIOMapping::SourceSysFs) {
+			gpios.push_back(createGPIO(e.name, e.number, e.direction, e.value));
+			continue;
+		}
+
+		if (!ad) {
+			ad = device();
+			// All Analog Discovery GPIOs are set up in one commit, when this goes
+			io.reset(new DigitalIoTransaction(ad));
+		}
+		gpios.push_back(createGPIO(e.name, ad, e.number, e.direction, e.value));
+	}
+
+	return gpios;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gpio.h"
+
+class AnalogDiscovery;
+
+// Which GPIOs a test setup has, where they are and how they start up. Mapping
+// files hold one or more profiles, one line per GPIO:
+//
+//   # Comment
+//   [stereo-cubes]
+//   Relais_Power = ad 9 out 0
+//   Led 1 = sysfs 509 in
+//
+// A line maps a name to Analog Discovery DIO (ad, 0-15) or host sysfs GPIO
+// (sysfs), sets its direction and, for outputs, the initial value (default 0).
+// Parsing checks everything, but touches no hardware.
+class GPIOMapping
+{
+public:
+	enum Source {
+		SourceAnalogDiscovery,
+		SourceSysFs
+	};
+
+	struct Entry {
+		std::string name;
+		Source source;
+		unsigned int number;
+		GPIO::Direction direction;
+		bool value;
+	};
+
+	// Throw GPIOException naming origin and line on errors
+	static GPIOMapping fromFile(const std::string &path, const std::string &profile = s_defaultProfile);
+	static GPIOMapping fromString(const std::string &text, const std::string &profile = s_defaultProfile,
+								  const std::string &origin = "built-in mapping");
+	// Profiles of this lab, mapping as in schematics and stereo-cubes
+	static GPIOMapping builtIn(const std::string &profile = s_defaultProfile);
+
+	// What loadDefaultGPIOMapping() uses, builtIn() unless set
+	static void setDefault(const GPIOMapping &m);
+	static const GPIOMapping &getDefault();
+
+	const std::string &profile() const;
+	const std::vector<Entry> &entries() const;
+
+	const static std::string s_defaultProfile;
+
+private:
+	std::string m_profile;
+	std::vector<Entry> m_entries;
+
+	static std::unique_ptr<GPIOMapping> s_default;
+};
+
+typedef std::function<std::shared_ptr<AnalogDiscovery>()> AnalogDiscoveryProvider;
+
+// Handles for all GPIOs of mapping, in its order. Lazy ones bind to hardware on
+// first use, device is asked once, when the first Analog Discovery GPIO binds.
+// Otherwise all are set up right away, Analog Discovery ones in one commit.
+std::list<SharedGPIOHandle> bindGPIOMapping(const GPIOMapping &mapping, AnalogDiscoveryProvider device, bool lazy);
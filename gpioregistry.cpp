@@ -0,0 +1,176 @@
+#include "gpioregistry.h"
+
+#include <algorithm>
+
+#include <string.h>
+
+const GPIORegistry::Id GPIORegistry::npos = static_cast<GPIORegistry::Id>(-1);
+
+GPIORegistry::GPIORegistry()
+{}
+
+GPIORegistry::GPIORegistry(const std::list<SharedGPIOHandle> &gpios)
+{
+	for (auto &gpio : gpios)
+		add(gpio);
+}
+
+GPIORegistry::Id GPIORegistry::add(SharedGPIOHandle gpio)
+{
+	auto name = gpio->getName();
+	if (find(name) != npos)
+		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
+							("GPIO with name \"" + name + "\" exists already!").c_str());
+
+	m_gpios.push_back(gpio);
+	m_names.push_back(name);
+
+	// At most half full
+	if (m_slots.size() < 2 * m_gpios.size())
+		rehash(std::max<size_t>(16, 4 * m_gpios.size()));
+	else
+		insert(m_gpios.size() - 1);
+
+	return m_gpios.size() - 1;
+}
+
+GPIORegistry::Id GPIORegistry::find(const char *name, size_t length) const
+{
+	if (m_slots.empty())
+		return npos;
+
+	size_t mask = m_slots.size() - 1;
+	for (size_t s = hash(name, length) & mask; m_slots[s] != npos; s = (s + 1) & mask) {
+		const std::string &candidate = m_names[m_slots[s]];
+		if (candidate.size() == length && memcmp(candidate.data(), name, length) == 0)
+			return m_slots[s];
+	}
+
+	return npos;
+}
+
+GPIORegistry::Id GPIORegistry::find(const std::string &name) const
+{
+	return find(name.data(), name.size());
+}
+
+GPIORegistry::Id GPIORegistry::id(const std::string &name) const
+{
+	Id ret = find(name);
+	if (ret == npos)
+		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
+							("GPIO with name \"" + name +  "\" does not exist!").c_str());
+
+	return ret;
+}
+
+SharedGPIOHandle GPIORegistry::get(const std::string &name) const
+{
+	return m_gpios[id(name)];
+}
+
+const SharedGPIOHandle &GPIORegistry::gpio(Id id) const
+{
+	return m_gpios.at(id);
+}
+
+const std::string &GPIORegistry::name(Id id) const
+{
+	return m_names.at(id);
+}
+
+size_t GPIORegistry::size() const
+{
+	return m_gpios.size();
+}
+
+// FNV-1a
+uint32_t GPIORegistry::hash(const char *name, size_t length)
+{
+	uint32_t h = 2166136261u;
+	for (size_t i=0; i<length; i++) {
+		h ^= static_cast<unsigned char>(name[i]);
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+void GPIORegistry::rehash(size_t slotCount)
+{
+	size_t size = 1;
+	while (size < slotCount)
+		size <<= 1;
+
+	m_slots.assign(size, npos);
+	for (Id id=0; id<m_gpios.size(); id++)
+		insert(id);
+}
+
+void GPIORegistry::insert(Id id)
+{
+	size_t mask = m_slots.size() - 1;
+	size_t s = hash(m_names[id].data(), m_names[id].size()) & mask;
+	while (m_slots[s] != npos)
+		s = (s + 1) & mask;
+
+	m_slots[s] = id;
+}
+
+GPIOSnapshot::GPIOSnapshot(const GPIORegistry &registry) :
+	m_registry(&registry),
+	m_contained((registry.size() + 63) / 64, 0),
+	m_output(m_contained.size(), 0),
+	m_value(m_contained.size(), 0)
+{}
+
+const GPIORegistry &GPIOSnapshot::registry() const
+{
+	return *m_registry;
+}
+
+void GPIOSnapshot::set(GPIORegistry::Id id, GPIOState state)
+{
+	uint64_t bit = uint64_t(1) << (id % 64);
+	size_t w = id / 64;
+
+	m_contained.at(w) |= bit;
+	if (state.direction == GPIO::DirectionOut)
+		m_output[w] |= bit;
+	else
+		m_output[w] &= ~bit;
+	if (state.value)
+		m_value[w] |= bit;
+	else
+		m_value[w] &= ~bit;
+}
+
+void GPIOSnapshot::remove(GPIORegistry::Id id)
+{
+	m_contained.at(id / 64) &= ~(uint64_t(1) << (id % 64));
+}
+
+bool GPIOSnapshot::contains(GPIORegistry::Id id) const
+{
+	return id / 64 < m_contained.size() && (m_contained[id / 64] & (uint64_t(1) << (id % 64)));
+}
+
+GPIOState GPIOSnapshot::state(GPIORegistry::Id id) const
+{
+	uint64_t bit = uint64_t(1) << (id % 64);
+	size_t w = id / 64;
+
+	GPIOState ret;
+	ret.direction = (m_output.at(w) & bit) ? GPIO::DirectionOut : GPIO::DirectionIn;
+	ret.value = m_value[w] & bit;
+	return ret;
+}
+
+size_t GPIOSnapshot::size() const
+{
+	size_t ret = 0;
+	for (auto w : m_contained)
+		ret += __builtin_popcountll(w);
+
+	return ret;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <vector>
+
+#include "gpio.h"
+
+// All GPIOs of a mapping, each with a stable integer id: its position in the
+// order they were added. Names are hashed once when added, so looking one up is
+// a hash and a compare, without copying handles or allocating. find() also takes
+// a pointer and length, so names can be looked up straight out of a request.
+class GPIORegistry
+{
+public:
+	typedef size_t Id;
+	const static Id npos;
+
+	GPIORegistry();
+	GPIORegistry(const std::list<SharedGPIOHandle> &gpios);
+
+	// Throws, if there is a GPIO of that name already
+	Id add(SharedGPIOHandle gpio);
+
+	// npos, if there is none of that name
+	Id find(const char *name, size_t length) const;
+	Id find(const std::string &name) const;
+	// Throws, if there is none of that name
+	Id id(const std::string &name) const;
+	SharedGPIOHandle get(const std::string &name) const;
+
+	const SharedGPIOHandle &gpio(Id id) const;
+	const std::string &name(Id id) const;
+	size_t size() const;
+
+private:
+	std::vector<SharedGPIOHandle> m_gpios;
+	std::vector<std::string> m_names;
+	// Open addressing, linear probing, power of two size, npos marks free slots
+	std::vector<Id> m_slots;
+
+	static uint32_t hash(const char *name, size_t length);
+	void rehash(size_t slotCount);
+	void insert(Id id);
+};
+
+struct GPIOState {
+	GPIO::Direction direction;
+	bool value;
+};
+
+// Wanted direction and value for some GPIOs of a registry. One bit per id for
+// each of contained, output and value, so setting, reading and comparing states
+// never allocates. Only valid as long as its registry.
+class GPIOSnapshot
+{
+public:
+	explicit GPIOSnapshot(const GPIORegistry &registry);
+
+	const GPIORegistry &registry() const;
+
+	void set(GPIORegistry::Id id, GPIOState state);
+	void remove(GPIORegistry::Id id);
+	bool contains(GPIORegistry::Id id) const;
+	GPIOState state(GPIORegistry::Id id) const;
+	// GPIOs contained
+	size_t size() const;
+
+	// Calls f(id) for each GPIO contained, in id order
+	template <class F> void forEach(F f) const;
+	// Calls f(id) for each GPIO contained in this one, which other does not contain
+	// or in another state. So applying those turns other into this. Both have to
+	// belong to the same registry.
+	template <class F> void forEachDifference(const GPIOSnapshot &other, F f) const;
+
+private:
+	const GPIORegistry *m_registry;
+	std::vector<uint64_t> m_contained;
+	std::vector<uint64_t> m_output;
+	std::vector<uint64_t> m_value;
+
+	template <class F> static void forEachBit(uint64_t bits, size_t word, F f);
+};
+
+template <class F>
+void GPIOSnapshot::forEachBit(uint64_t bits, size_t word, F f)
+{
+	while (bits) {
+		f(word * 64 + __builtin_ctzll(bits));
+		bits &= bits - 1;
+	}
+}
+
+template <class F>
+void GPIOSnapshot::forEach(F f) const
+{
+	for (size_t w=0; w<m_contained.size(); w++)
+		forEachBit(m_contained[w], w, f);
+}
+
+template <class F>
+void GPIOSnapshot::forEachDifference(const GPIOSnapshot &other, F f) const
+{
+	for (size_t w=0; w<m_contained.size(); w++) {
+		uint64_t differs = ~other.m_contained[w] | (m_output[w] ^ other.m_output[w]) | (m_value[w] ^ other.m_value[w]);
+		forEachBit(m_contained[w] & differs, w, f);
+	}
+}
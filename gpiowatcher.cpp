@@ -0,0 +1,151 @@
+#include "gpiowatcher.h"
+
+#include <algorithm>
+
+#include <string.h>
+
+extern "C" {
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+}
+
+#include "debug.h"
+
+GPIOWatcher::GPIOWatcher(std::chrono::milliseconds fallbackRate) :
+	m_fallbackRate(fallbackRate),
+	m_epollFd(epoll_create1(EPOLL_CLOEXEC)),
+	m_wakeFd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+	m_running(false),
+	m_dispatched(0)
+{
+	if (m_epollFd < 0 || m_wakeFd < 0)
+		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, errno,
+							(std::string("Can not create GPIO watcher: ") + strerror(errno)).c_str());
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = nullptr;
+	epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeFd, &ev);
+}
+
+GPIOWatcher::~GPIOWatcher()
+{
+	stop();
+	close(m_wakeFd);
+	close(m_epollFd);
+}
+
+void GPIOWatcher::watch(SharedGPIOHandle in, Callback callback)
+{
+	// Edges first, so none gets lost between reading and watching
+	bool priority = false;
+	int fd = in->enableEdgeEvents(&priority);
+
+	Watch w = {in, callback, in->getValue()};
+	callback(w.value);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (fd < 0) {
+		Debug::verbose("GPIOWatcher", in->getName() + " can not signal edges, reading it every " +
+					   std::to_string(m_fallbackRate.count()) + "ms");
+		m_polled.push_back(w);
+	} else {
+		auto source = std::find_if(m_sources.begin(), m_sources.end(), [fd](const Source &s) { return s.fd == fd; });
+		if (source != m_sources.end()) {
+			source->watches.push_back(w);
+		} else {
+			m_sources.push_back({fd, in, {w}});
+
+			struct epoll_event ev;
+			ev.events = priority ? (EPOLLPRI | EPOLLERR) : EPOLLIN;
+			ev.data.ptr = &m_sources.back();
+			if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &ev) < 0)
+				throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, errno,
+									("Can not watch " + in->getName() + ": " + strerror(errno)).c_str());
+		}
+	}
+
+	// The thread may sleep without timeout so far
+	uint64_t one = 1;
+	TEMP_FAILURE_RETRY(write(m_wakeFd, &one, sizeof(one)));
+}
+
+void GPIOWatcher::mirror(SharedGPIOHandle in, SharedGPIOHandle out)
+{
+	watch(in, [out](bool value) { out->setValue(value); });
+}
+
+void GPIOWatcher::start()
+{
+	if (m_running.exchange(true))
+		return;
+
+	m_thread = std::thread(&GPIOWatcher::run, this);
+}
+
+void GPIOWatcher::stop()
+{
+	if (!m_running.exchange(false))
+		return;
+
+	uint64_t one = 1;
+	TEMP_FAILURE_RETRY(write(m_wakeFd, &one, sizeof(one)));
+	m_thread.join();
+}
+
+unsigned long GPIOWatcher::dispatched() const
+{
+	return m_dispatched;
+}
+
+void GPIOWatcher::run()
+{
+	struct epoll_event events[16];
+
+	while (m_running) {
+		int timeout = -1;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!m_polled.empty())
+				timeout = m_fallbackRate.count();
+		}
+
+		int n = epoll_wait(m_epollFd, events, 16, timeout);
+		if (n < 0 && errno != EINTR) {
+			Debug::error("GPIOWatcher", std::string("epoll_wait failed: ") + strerror(errno));
+			break;
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		for (int i=0; i<n; i++) {
+			auto source = static_cast<Source*>(events[i].data.ptr);
+			if (!source) {
+				uint64_t count;
+				TEMP_FAILURE_RETRY(read(m_wakeFd, &count, sizeof(count)));
+				continue;
+			}
+
+			source->gpio->clearEdgeEvents();
+			for (auto &w : source->watches)
+				dispatch(&w);
+		}
+
+		for (auto &w : m_polled)
+			dispatch(&w);
+	}
+}
+
+void GPIOWatcher::dispatch(Watch *w)
+{
+	bool value = w->gpio->getValue();
+	if (value == w->value)
+		return;
+
+	w->value = value;
+	w->callback(value);
+	m_dispatched++;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "gpio.h"
+
+// One thread waiting in epoll for edges of any number of inputs and calling
+// back on each change. Inputs, whose backend can not signal edges (Analog
+// Discovery DIO), are read every fallbackRate instead, only those.
+class GPIOWatcher
+{
+public:
+	typedef std::function<void(bool value)> Callback;
+
+	GPIOWatcher(std::chrono::milliseconds fallbackRate = std::chrono::milliseconds(20));
+	GPIOWatcher(const GPIOWatcher&) = delete;
+	GPIOWatcher& operator=(const GPIOWatcher&) = delete;
+	~GPIOWatcher();
+
+	// Calls callback with the current value right away, then on each change.
+	// Callbacks run on the watcher thread and must not call watch() or mirror().
+	void watch(SharedGPIOHandle in, Callback callback);
+	// out follows in
+	void mirror(SharedGPIOHandle in, SharedGPIOHandle out);
+
+	void start();
+	void stop();
+
+	// Callbacks made because of a change, for benchmarks
+	unsigned long dispatched() const;
+
+private:
+	struct Watch {
+		SharedGPIOHandle gpio;
+		Callback callback;
+		bool value;
+	};
+
+	// All watches on one fd, lines of one gpiochip request share it
+	struct Source {
+		int fd;
+		SharedGPIOHandle gpio;
+		std::vector<Watch> watches;
+	};
+
+	std::chrono::milliseconds m_fallbackRate;
+	int m_epollFd;
+	int m_wakeFd;
+	std::mutex m_mutex;
+	std::list<Source> m_sources;
+	std::vector<Watch> m_polled;
+	std::thread m_thread;
+	std::atomic<bool> m_running;
+	std::atomic<unsigned long> m_dispatched;
+
+	void run();
+	void dispatch(Watch *w);
+};
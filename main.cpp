@@ -3,7 +3,9 @@
 
 #include "measurement.h"
 #include "analogdiscovery.h"
+#include "analogdiscoverysimulated.h"
 #include "gpio.h"
+#include "gpiowatcher.h"
 #include "default.h"
 #include "specialkeyboard.h"
 #include "tests.h"
@@ -35,20 +37,38 @@ int main(int argc, char *argv[])
 				(paramDebugLevel, value<int>(), debugLevelDesc.c_str())
 
 				(paramOutputFile, value<std::string>(), "Save data to file")
+				(paramOutputFormat, value<std::string>(), "arg=(text|binary) Write results as frequency,value lines (default) or as a header and two columns of doubles, see resultwriter.h")
+				(paramArchiveCaptures, "Keep every record of --method sine in <output>.captures, for --reanalyze")
+				(paramSimulate, value<std::string>()->implicit_value(""), "arg=(gain=dB,hp=Hz,lp=Hz,noise=V,hd2=ratio,latency=s) Use a simulated Analog Discovery and host GPIOs instead of hardware. Optional DUT model, missing keys keep their default")
 
 				(paramSelfTest, "Run selftest to verify hw integrity")
 				(paramManualGpio, "Run manual GPIO test application")
 				(paramCalibrate, "Run input level calibration")
+				(paramTestGpioChip, value<std::string>(), "arg=/dev/gpiochipN Switch speaker channels on lines 0-2 of a (gpio-sim) chip in one ioctl and verify them")
+				(paramBenchmarkGpioWatcher, value<int>(), "arg=n Mirror n in-memory inputs to outputs, print how fast edges propagate")
+				(paramTestDspKernels, "Check the vector DSP kernels the CPU supports against their scalar reference")
+				(paramBenchmarkDspKernels, value<int>(), "arg=n Run the DSP kernels over captures of n samples with each supported instruction set, print samples per second")
+				(paramBenchmarkCircularBuffers, value<int>(), "arg=n Stream blocks of n samples between two threads through the locking and the lock-free ring buffer, print samples per second")
+				(paramTestMethodLevels, value<double>()->implicit_value(0.25), "arg=dB Measure with all methods on --simulate \"hp=1,lp=100000,noise=0,hd2=0\", fail if multitone or sweep differ from stepped sine by more than dB (default 0.25). Takes --fmin, --fmax and --points-per-decade")
+				(paramReanalyze, value<std::string>(), "arg=file Run --estimator (default the one measured with) over the records of a capture archive, print level and phase per record")
+				(paramBenchmarkGpio, value<int>(), "arg=n Toggle and read sysfs GPIO n, print how many per second. With --simulate on a scratch directory")
 
 				(paramListGpios, "List available GPIOs")
+				(paramGpioMapping, value<std::string>(), "arg=file Read the GPIO mapping from file instead of the built-in one")
+				(paramGpioProfile, value<std::string>(), "arg=name Use this profile of the GPIO mapping (default stereo-cubes)")
 				(paramSetGpios, boost::program_options::value<std::vector<std::string>>()->multitoken(),  "arg=(name,value name,value ...) Set GPIO(s) to value")
 
 				(paramSpeakerChannel, value<std::string>(), "arg=(lo,mid,hi) Set speaker output channel to measure on")
-				(paramChannel, value<char>(), "arg=(l|r) Set channel you want to measure on")
+				(paramChannel, value<char>(), "arg=(l|r|s) Set channel you want to measure on. s measures left and right in the same sweep and writes <output>.l and <output>.r")
 				(paramfMin, value<double>(), "arg=f [Hz] Set lower frequency to start frequency response measurement with")
 				(paramfMax, value<double>(), "arg=f [Hz] Set upper frequency to stop frequency response measurement with")
 				(paramPointsPerDecade, value<int>(), "arg=p [Points per decade] Set amount of measuring points per decade")
-				(paramOutputCalibration, value<double>(), "arg=v [V] Adjust output value of sine sweep by this value. Use --calibrate to find that value");
+				(paramOutputCalibration, value<double>(), "arg=v [V] Adjust output value of sine sweep by this value. Use --calibrate to find that value")
+				(paramMethod, value<std::string>(), "arg=(sine|multitone|sweep) Measure one sine per point (default), all points at once with a multitone or with an exponential sweep, which writes THD in percent to <output>.thd as well")
+				(paramEstimator, value<std::string>(), "arg=(rms|dft) Level per point for --method sine: broadband rms (default) or a single bin DFT at the stimulus frequency, which writes phase in degrees to <output>.phase as well")
+				(paramTargetSnr, value<double>(), "arg=snr [dB] Signal to noise ratio each point of --method sine is planned for. Higher takes longer")
+				(paramMaxSettle, value<double>(), "arg=time [ms] Upper bound for the DUT to settle after each retune of --method sine (default 50)")
+				(paramSettleTolerance, value<double>(), "arg=level [dB] Level change between two envelope windows, below which the DUT counts as settled (default 0.1)");
 
 		variables_map varMap;
 		store(parse_command_line(argc, argv, desc), varMap);
@@ -61,6 +81,20 @@ int main(int argc, char *argv[])
 			Debug::setDebugLevel(static_cast<Debug::Level>(varMap["debug"].as<int>()));
 		}
 
+		if (varMap.count(paramSimulate)) {
+			AnalogDiscoverySimulated::setDefaultModel(AnalogDiscoverySimulated::Model::fromString(varMap[paramSimulate].as<std::string>()));
+			AnalogDiscovery::setBackend(AnalogDiscovery::BackendSimulated);
+			setHostGPIOSimulated(true);
+		}
+
+		if (varMap.count(paramGpioMapping) || varMap.count(paramGpioProfile)) {
+			auto profile = varMap.count(paramGpioProfile) ? varMap[paramGpioProfile].as<std::string>() : GPIOMapping::s_defaultProfile;
+			if (varMap.count(paramGpioMapping))
+				GPIOMapping::setDefault(GPIOMapping::fromFile(varMap[paramGpioMapping].as<std::string>(), profile));
+			else
+				GPIOMapping::setDefault(GPIOMapping::builtIn(profile));
+		}
+
 		// Testing and single functions
 		if (varMap.count(paramSelfTest)) {
 			std::cout << "Running selftest" << std::endl;
@@ -77,14 +111,40 @@ int main(int argc, char *argv[])
 			exit(EXIT_SUCCESS);
 		}
 
+		if (varMap.count(paramTestGpioChip)) {
+			bool ok = testGPIOCharDev(varMap[paramTestGpioChip].as<std::string>());
+			exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+
+		if (varMap.count(paramBenchmarkGpioWatcher)) {
+			benchmarkGPIOWatcher(varMap[paramBenchmarkGpioWatcher].as<int>(), 10000);
+			exit(EXIT_SUCCESS);
+		}
+
+		if (varMap.count(paramTestDspKernels)) {
+			exit(testDSPKernels() ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+
+		if (varMap.count(paramBenchmarkDspKernels)) {
+			benchmarkDSPKernels(std::max(1, varMap[paramBenchmarkDspKernels].as<int>()));
+			exit(EXIT_SUCCESS);
+		}
+
+		if (varMap.count(paramBenchmarkCircularBuffers)) {
+			benchmarkCircularBuffers(std::max(1, varMap[paramBenchmarkCircularBuffers].as<int>()));
+			exit(EXIT_SUCCESS);
+		}
+
+		if (varMap.count(paramBenchmarkGpio)) {
+			benchmarkGPIOSysFs(varMap[paramBenchmarkGpio].as<int>(), 100000);
+			exit(EXIT_SUCCESS);
+		}
+
 		// GPIO
 		if (varMap.count(paramListGpios)) {
-			{ // exit() kills RAII, so make an extra block here
-				auto sharedDev = AnalogDiscovery::getFirstAvailableDevice();
-				auto gpios = loadDefaultGPIOMapping(sharedDev);
-				for (auto iter = gpios.begin(); iter != gpios.end(); ++iter)
-					std::cout << (*iter)->getName() << std::endl;
-			}
+			// Straight from the mapping, without touching hardware
+			for (auto &e : GPIOMapping::getDefault().entries())
+				std::cout << e.name << std::endl;
 			exit(EXIT_SUCCESS);
 		}
 
@@ -92,6 +152,9 @@ int main(int argc, char *argv[])
 			Debug::warning("set-gpios", "Analog Discovery gpio changes are reset, after the interface is closed for some time. Therefore this tool keeps running, to hold the gpio to what you set it.");
 			auto v = varMap[paramSetGpios].as<vector<std::string>>();
 
+			// Only the GPIOs set are bound, the Analog Discovery is opened only for its own
+			GPIORegistry gpios(bindGPIOMapping(GPIOMapping::getDefault(), AnalogDiscovery::getFirstAvailableDevice, true));
+
 			for (auto iter=v.begin(); iter!=v.end(); ++iter) {
 				std::istringstream ss(*iter);
 				std::string gpioName;
@@ -112,16 +175,15 @@ int main(int argc, char *argv[])
 					exit(EXIT_FAILURE);
 				}
 
-				auto sharedDev = AnalogDiscovery::getFirstAvailableDevice();
-				auto gpios = loadDefaultGPIOMapping(sharedDev);
-				auto gpio = getGPIOForName(gpios, gpioName);
-				if (!gpio) {
+				auto id = gpios.find(gpioName);
+				if (id == GPIORegistry::npos) {
 					Debug::error(paramSetGpios, "GPIO with name " + gpioName + " seems not to exist!");
 					exit(EXIT_FAILURE);
-				} else {
-					Debug::warning(paramSetGpios, "GPIO Ready: " + gpio->getName());
 				}
 
+				auto gpio = gpios.gpio(id);
+				Debug::warning(paramSetGpios, "GPIO Ready: " + gpio->getName());
+
 				//gpio->setDirection(GPIO::DirectionOut);
 				gpio->setValue(gpioValueToSet);
 			}
@@ -132,10 +194,32 @@ int main(int argc, char *argv[])
 		}
 
 
-		// Measuring
+		// Measuring and offline re-analysis
+		if (varMap.count(paramEstimator)) {
+			auto e = varMap[paramEstimator].as<std::string>();
+
+			if (e == "rms") estimator = EstimatorRms;
+			else if (e == "dft") estimator = EstimatorSingleBin;
+			else printUsage(desc, "Invalid value for estimator");
+		}
+
+		if (varMap.count(paramTestMethodLevels)) {
+			if (varMap.count(paramfMin)) fMin = varMap[paramfMin].as<double>();
+			if (varMap.count(paramfMax)) fMax = varMap[paramfMax].as<double>();
+			if (varMap.count(paramPointsPerDecade)) pointsPerDecade = varMap[paramPointsPerDecade].as<int>();
+
+			bool ok = testMethodLevels(fMin, fMax, pointsPerDecade, varMap[paramTestMethodLevels].as<double>());
+			exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+
+		if (varMap.count(paramReanalyze)) {
+			bool ok = reanalyzeCaptures(varMap[paramReanalyze].as<std::string>(), varMap.count(paramEstimator) ? &estimator : nullptr);
+			exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+
 		if (varMap.count(paramChannel)) {
 			channel = varMap[paramChannel].as<char>();
-			if (channel != 'l' && channel != 'r')
+			if (channel != 'l' && channel != 'r' && channel != 's')
 				printUsage(desc, "invalid value for channel");
 		} else {
 			printUsage(desc, "channel must be set!");
@@ -156,6 +240,18 @@ int main(int argc, char *argv[])
 			outputName = varMap[paramOutputFile].as<std::string>();
 		}
 
+		if (varMap.count(paramOutputFormat)) {
+			auto f = varMap[paramOutputFormat].as<std::string>();
+
+			if (f == "text") outputFormat = ResultFormatText;
+			else if (f == "binary") outputFormat = ResultFormatBinary;
+			else printUsage(desc, "Invalid value for output-format");
+		}
+
+		if (varMap.count(paramArchiveCaptures)) {
+			archiveCaptures = true;
+		}
+
 		if (varMap.count(paramfMin)) {
 			fMin = varMap[paramfMin].as<double>();
 		}
@@ -173,6 +269,28 @@ int main(int argc, char *argv[])
 		}
 
 
+		if (varMap.count(paramMethod)) {
+			auto m = varMap[paramMethod].as<std::string>();
+
+			if (m == "sine") method = Measurement::MethodSteppedSine;
+			else if (m == "multitone") method = Measurement::MethodMultitone;
+			else if (m == "sweep") method = Measurement::MethodExponentialSweep;
+			else printUsage(desc, "Invalid value for method");
+		}
+
+		if (varMap.count(paramTargetSnr)) {
+			targetSnr = varMap[paramTargetSnr].as<double>();
+		}
+
+		if (varMap.count(paramMaxSettle)) {
+			maxSettle = varMap[paramMaxSettle].as<double>();
+		}
+
+		if (varMap.count(paramSettleTolerance)) {
+			settleTolerance = varMap[paramSettleTolerance].as<double>();
+		}
+
+
 		auto sharedDev = AnalogDiscovery::getFirstAvailableDevice();
 		auto gpios = loadDefaultGPIOMapping(sharedDev);
 
@@ -185,19 +303,29 @@ int main(int argc, char *argv[])
 		Speaker::setChannel(enable, adr0, adr1, speakerChannel);
 
 		// map Speaker Led {1,2} to front Led {1,2}
-		SharedTerminateFlag tf1 = SharedTerminateFlag(new std::atomic<bool>(false));
-		std::thread t1(mapInToOut, getGPIOForName(gpios, "Led 1"), getGPIOForName(gpios, "Front_LED_1"), 20ms, tf1);
-		SharedTerminateFlag tf2 = SharedTerminateFlag(new std::atomic<bool>(false));
-		std::thread t2(mapInToOut, getGPIOForName(gpios, "Led 2"), getGPIOForName(gpios, "Front_LED_2"), 20ms, tf2);
+		GPIOWatcher ledWatcher;
+		ledWatcher.mirror(getGPIOForName(gpios, "Led 1"), getGPIOForName(gpios, "Front_LED_1"));
+		ledWatcher.mirror(getGPIOForName(gpios, "Led 2"), getGPIOForName(gpios, "Front_LED_2"));
+		ledWatcher.start();
 
 
 		Measurement m(outputName, sharedDev, fMin, fMax, pointsPerDecade);
+		m.setMethod(method);
+		m.setEstimator(estimator);
+		m.setTargetSnr(targetSnr);
+		m.setMaxSettle(maxSettle / 1000.0);
+		m.setSettleTolerance(settleTolerance);
+		m.setResultFormat(outputFormat);
+		m.setArchiveCaptures(archiveCaptures);
 
 		std::cout << "Press enter to start..." << std::endl;
 		getchar();
 
 		// Fix me!
-		m.start((channel == 'r' ? 0 : 1), outputCalibration);
+		if (channel == 's')
+			m.start(std::vector<int>({0, 1}), outputCalibration);
+		else
+			m.start((channel == 'r' ? 0 : 1), outputCalibration);
 
 		{ SpecialKeyboard kb; // nonblocking keyboard input
 			while(kb.kbhit() != 'q' && m.isRunning()) {
@@ -206,11 +334,8 @@ int main(int argc, char *argv[])
 
 		if (m.isRunning()) m.stop();
 
-		// Clean up LED Mapping threads
-		tf1->store(true);
-		tf2->store(true);
-		t1.join();
-		t2.join();
+		// Clean up LED Mapping
+		ledWatcher.stop();
 
 	} catch (const AnalogDiscoveryException &e) {
 		cerr << "AnalogDiscoveryException caught: " << e.what() << std::endl;
@@ -1,99 +1,22 @@
 #include "measurement.h"
 
 #include <algorithm>
-#include <fstream>
-#include <iomanip>
-#include <iterator>
+#include <cstring>
+#include <limits>
 #include <numeric>
 #include <map>
 #include <utility>
 
 #include "debug.h"
+#include "multitone.h"
+#include "sweep.h"
+#include "estimator.h"
+#include "dspkernels.h"
 
 // GPIO foo
 std::list<SharedGPIOHandle> loadDefaultGPIOMapping(SharedAnalogDiscoveryHandle analogDiscovery)
 {
-	std::list<SharedGPIOHandle> gpios;
-
-	// Some Mappings are Speaker dependent :(
-
-#if 0
-	// #### MAPPING AS IN SCHEMATICS (DEFAULT) ####
-	// Analog Discovery GPIOs
-	// Outputs
-	gpios.push_back(createGPIO("Front_LED_1", analogDiscovery, 0, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("Front_LED_2", analogDiscovery, 1, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("Front_LED_3", analogDiscovery, 2, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("Front_LED_4", analogDiscovery, 3, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("Front_LED_5", analogDiscovery, 4, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("Relais_Power", analogDiscovery, 9, GPIO::DirectionOut, true)); // This is the main Power for the speaker
-	gpios.push_back(createGPIO("Relais_K109", analogDiscovery, 10, GPIO::DirectionOut, false)); // This is to check, if load resistors are damaged
-	gpios.push_back(createGPIO("Relais_K108", analogDiscovery, 11, GPIO::DirectionOut, false)); // 4 or 6 Ohm Load for J103-J105
-	gpios.push_back(createGPIO("Relais_K104", analogDiscovery, 12, GPIO::DirectionOut, false));	// 4 or 6 Ohm Load for J100-J102
-
-	// Load is switched thru a multiplexer. Speaker outputs can not shortcirquid!
-	// So we have one nEn and two ADR lines here
-	gpios.push_back(createGPIO("ADR0", analogDiscovery, 13, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("ADR1", analogDiscovery, 14, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("Enable", analogDiscovery, 15, GPIO::DirectionOut, false));
-
-	// MinnowBoard GPIOs
-	// Outputs
-	gpios.push_back(createGPIO("Volume Button +", 477, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("Volume Button -", 478, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("Enc3", 479, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("Station1 Button", 472, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("Station2 Button", 473, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("Station3 Button", 485, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("Station4 Button", 475, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("Power Button", 484, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("Reset Button", 474, GPIO::DirectionOut, true)); //Investigate: This must be true, othewise speaker tries to flash. Inverted?
-	gpios.push_back(createGPIO("Setup Button", 338, GPIO::DirectionOut, false));
-	// Inputs
-	gpios.push_back(createGPIO("Led 1", 509, GPIO::DirectionIn, false));
-	gpios.push_back(createGPIO("Led 2", 340, GPIO::DirectionIn, false));
-	gpios.push_back(createGPIO("Led 3", 505, GPIO::DirectionIn, false));
-	gpios.push_back(createGPIO("Led 4", 339, GPIO::DirectionIn, false));
-	gpios.push_back(createGPIO("Led 5", 504, GPIO::DirectionIn, false));
-#endif
-#if 1
-	// #### Stereo Cubes Mapping ####
-	// Analog Discovery GPIOs
-	// Outputs
-	gpios.push_back(createGPIO("Front_LED_1", analogDiscovery, 0, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("Front_LED_2", analogDiscovery, 1, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("Front_LED_3", analogDiscovery, 2, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("Front_LED_4", analogDiscovery, 3, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("Front_LED_5", analogDiscovery, 4, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("Relais_Power", analogDiscovery, 9, GPIO::DirectionOut, false)); // This is the main Power for the speaker
-	gpios.push_back(createGPIO("Relais_K109", analogDiscovery, 10, GPIO::DirectionOut, false)); // This is to check, if load resistors are damaged
-	gpios.push_back(createGPIO("Relais_K108", analogDiscovery, 11, GPIO::DirectionOut, false)); // 4 or 6 Ohm Load for J103-J105
-	gpios.push_back(createGPIO("Relais_K104", analogDiscovery, 12, GPIO::DirectionOut, false));	// 4 or 6 Ohm Load for J100-J102
-
-	// Load is switched thru a multiplexer. Speaker outputs can not shortcirquid!
-	// So we have one nEn and two ADR lines here
-	gpios.push_back(createGPIO("ADR0", analogDiscovery, 13, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("ADR1", analogDiscovery, 14, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("Enable", analogDiscovery, 15, GPIO::DirectionOut, false));
-
-
-	// MinnowBoard GPIOs
-	// Outputs
-	gpios.push_back(createGPIO("Enc3", 479, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("Volume Button +", 472, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("Volume Button -", 485, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("Power Button", 484, GPIO::DirectionOut, false));
-	gpios.push_back(createGPIO("Reset Button", 474, GPIO::DirectionOut, true)); //Investigate: This must be true, othewise speaker tries to flash. Inverted?
-	gpios.push_back(createGPIO("Setup Button", 338, GPIO::DirectionOut, false));
-	// Inputs
-	gpios.push_back(createGPIO("Led 1", 509, GPIO::DirectionIn, false));
-	gpios.push_back(createGPIO("Led 2", 340, GPIO::DirectionIn, false));
-	gpios.push_back(createGPIO("Led 3", 505, GPIO::DirectionIn, false));
-	gpios.push_back(createGPIO("Led 4", 339, GPIO::DirectionIn, false));
-	gpios.push_back(createGPIO("Led 5", 504, GPIO::DirectionIn, false));
-#endif
-
-	return gpios;
+	return bindGPIOMapping(GPIOMapping::getDefault(), [analogDiscovery]() { return analogDiscovery; }, false);
 }
 
 // This is usefull on PC, where we dont have those GPIOs available
@@ -103,14 +26,14 @@ std::list<SharedGPIOHandle> loadDummyGPIOMapping(SharedAnalogDiscoveryHandle ana
 	return ret;
 }
 
-GPIOSnapshot createGPIOSnapshot(std::list<SharedGPIOHandle> gpios)
+GPIOSnapshot createGPIOSnapshot(const GPIORegistry &registry)
 {
-	GPIOSnapshot ret;
-	for (auto it = gpios.begin(); it != gpios.end(); ++it) {
+	GPIOSnapshot ret(registry);
+	for (GPIORegistry::Id id=0; id<registry.size(); id++) {
 		GPIOState state;
-		state.direction = (*it)->getDirection();
-		state.value = (*it)->getValue();
-		ret.insert(std::make_pair(*it, state));
+		state.direction = registry.gpio(id)->getDirection();
+		state.value = registry.gpio(id)->getValue();
+		ret.set(id, state);
 	}
 
 	return ret;
@@ -119,48 +42,63 @@ GPIOSnapshot createGPIOSnapshot(std::list<SharedGPIOHandle> gpios)
 void updateGPIOSnapshot(GPIOSnapshot *snapshot, SharedGPIOHandle gpio, GPIOState state)
 {
 	if (!gpio) {
-		Debug::warning("updateGPIOSnapshot", "Ignoring snapshot update. GPIO(" + gpio->getName() + ") is nullptr");
+		Debug::warning("updateGPIOSnapshot", "Ignoring snapshot update. GPIO is nullptr");
 		return;
 	}
 
-	auto it = snapshot->find(gpio);
-	if (it == snapshot->end()) {
-		if (snapshot->insert(std::make_pair(gpio, state)).second == false)
-			Debug::warning("updateGPIOSnapshot", "Can not insert: " + gpio->getName());
-	} else {
-		Debug::verbose("updateGPIOSnapshot", "Updating " + gpio->getName() + " to " + std::to_string(state.value));
-		it->second = state;
+	auto id = snapshot->registry().find(gpio->getName());
+	if (id == GPIORegistry::npos || snapshot->registry().gpio(id) != gpio) {
+		Debug::warning("updateGPIOSnapshot", "Can not insert: " + gpio->getName());
+		return;
 	}
+
+	Debug::verbose("updateGPIOSnapshot", "Updating " + gpio->getName() + " to " + std::to_string(state.value));
+	snapshot->set(id, state);
 }
 
-void setGPIOSnapshot(GPIOSnapshot snapshot)
+void setGPIOSnapshot(const GPIOSnapshot &snapshot, GPIOBatch *batch, GPIOSnapshot *current)
 {
-	Debug::verbose("Measurement", "setGPIOSnapshot: Setting " + std::to_string(snapshot.size()) + " values!");
-	for (auto it=snapshot.begin(); it!=snapshot.end(); it++) {
-		Debug::verbose("setGPIOSnapshot", "Setting: " + it->first->getName() + " to: " + std::to_string(it->second.value));
-		it->first->setDirection(it->second.direction);
-		it->first->setValue(it->second.value);
-	}
+	auto &registry = snapshot.registry();
+	const bool verbose = Debug::getDebugLevel() >= Debug::LevelVerbose;
+
+	batch->clear();
+	auto add = [&](GPIORegistry::Id id) {
+		auto state = snapshot.state(id);
+		if (verbose)
+			Debug::verbose("setGPIOSnapshot", "Setting: " + registry.name(id) + " to: " + std::to_string(state.value));
+		batch->add(registry.gpio(id), state.direction, state.value);
+		if (current)
+			current->set(id, state);
+	};
+
+	// Straight from the bits, that differ
+	if (current)
+		snapshot.forEachDifference(*current, add);
+	else
+		snapshot.forEach(add);
+
+	if (verbose)
+		Debug::verbose("Measurement", "setGPIOSnapshot: Setting " + std::to_string(batch->values().size()) + " of "
+					   + std::to_string(snapshot.size()) + " values!");
+
+	// Directions and values of one device or request change together
+	batch->apply();
 }
 
-double dBuForVolts(double v) {
-	static const double Uref = 0.7746;
-	return 20 * log(v / Uref);
+void setGPIOSnapshot(const GPIOSnapshot &snapshot)
+{
+	GPIOBatch batch;
+	setGPIOSnapshot(snapshot, &batch, nullptr);
 }
 
-double dBvForVolts(double v) {
-	static const double Uref = 1.0;
-	return 20 * log (v / Uref);
+double rms(const std::vector<double>& samples)
+{
+	return rms(samples.data(), samples.size());
 }
 
-double rms(const std::vector<double>& samples)
+double rms(const double *samples, size_t size)
 {
-	double rms = 0.0;
-	for (auto sample : samples) {
-		rms += sample * sample;
-	}
-	rms = sqrt(rms / samples.size());
-	return rms;
+	return DSPKernels::rms(SampleView(samples, size));
 }
 
 double rms(double vsine)
@@ -168,46 +106,83 @@ double rms(double vsine)
 	return vsine / sqrt(2);
 }
 
-void saveBuffer(const std::vector<double>& s, const std::string& fileName)
+void saveBuffer(const std::vector<double>& s, const std::string& fileName, ResultFormat format)
 {
-	std::ofstream outfile(fileName, std::ofstream::out);
-
-	if (!outfile.is_open()) {
-		Debug::error("saveBuffer", "Can not save buffer! File not opened: " + fileName);
-		return;
+	try {
+		writeSamples(format, fileName, s.data(), s.size());
+	} catch (const ResultException &e) {
+		Debug::error("saveBuffer", std::string("Can not save buffer! ") + e.what());
 	}
-
-	IntIndexer<double>::setStartIndex(0);
-	std::ostream_iterator<IntIndexer<double>> iter(outfile, "\n");
-	std::copy(s.begin(), s.end(), iter);
-	outfile.flush();
-	outfile.close();
 }
 
-void saveMeasurement(const std::vector<double>& frequencies, const std::vector<double>& responses, const std::string& fileName)
+void playAndRecord(AcquisitionSession *session, const std::vector<double>& stimulus,
+				   double samplingFrequency, double amplitude, double tail, CaptureBuffer *target)
 {
-	Debug::debug("saveMeasurement",  "Saving measurement to file: " + fileName);
+	auto handle = session->handle();
+	auto &channels = session->channels();
+
+	samplingFrequency = session->setSamplingFrequency(samplingFrequency);
+	double duration = stimulus.size() / samplingFrequency;
+	double recordDuration = session->setRecordLength(duration + tail);
+	session->setTrigger(AnalogDiscovery::TriggerSourceNone);
+
+	target->clear();
+	target->reserve(static_cast<size_t>(std::ceil(recordDuration * samplingFrequency)) + session->bufferSize());
+
+	// Generator plays every sample once, at the rate we record with
+	std::vector<size_t> played(channels.size());
+	for (size_t c=0; c<channels.size(); c++) {
+		int channel = channels[c];
+		handle->setAnalogOutputWaveform(channel, AnalogDiscovery::WaveformPlay);
+		handle->setAnalogOutputFrequency(channel, samplingFrequency);
+		handle->setAnalogOutputAmplitude(channel, amplitude);
+		handle->setAnalogOutputRepeat(channel, 1);
+		handle->setAnalogOutputRunDuration(channel, duration);
+
+		played[c] = std::min(stimulus.size(), static_cast<size_t>(handle->analogOutputCustomDataMaxSize(channel)));
+		handle->setAnalogOutputCustomData(channel, std::vector<double>(stimulus.begin(), stimulus.begin() + played[c]));
+	}
 
-	std::ofstream outfile(fileName, std::ofstream::out);
+	// Start recording first, so the beginning of the response is not missed
+	session->start();
+	session->startOutputs();
 
-	if (!outfile.is_open()) {
-		Debug::error("saveBuffer", "Can not save buffer! File not opened: " + fileName);
-		return;
-	}
+	auto deviceState = AnalogDiscovery::DeviceStateUnknown;
 
-	auto currentResponse = responses.begin();
-	auto currentFrequency = frequencies.begin();
+	do {
+		for (size_t c=0; c<channels.size(); c++) {
+			if (played[c] >= stimulus.size())
+				continue;
 
-	while (currentResponse != responses.end() && currentFrequency != frequencies.end()) {
-		outfile << std::setprecision(6) << *currentFrequency << "," << std::setprecision(6) << *currentResponse << std::endl;
-		currentResponse++;
-		currentFrequency++;
-	}
+			auto playState = handle->analogOutputPlayState(channels[c]);
+			if (playState.corrupted != 0 || playState.lost != 0) {
+				std::stringstream ss;
+				ss << playState;
+				Debug::warning("playAndRecord", "Generator underrun: " + ss.str());
+			}
 
-	outfile.flush();
-	outfile.close();
-}
+			size_t count = std::min(stimulus.size() - played[c], static_cast<size_t>(std::max(playState.available, 0)));
+			if (count) {
+				handle->writeAnalogOutputPlayData(channels[c], &stimulus[played[c]], count);
+				played[c] += count;
+			}
+		}
 
+		auto sampleState = handle->analogInSampleState();
+		if (sampleState.corrupted != 0 || sampleState.lost != 0) {
+			std::stringstream ss;
+			ss << sampleState;
+			Debug::verbose("playAndRecord", ss.str());
+		}
+
+		if (!sampleState.available)
+			deviceState = handle->analogInputStatus(channels.front());
+
+		if (sampleState.available)
+			AnalogDiscovery::readSamples(handle, channels, target, sampleState.available);
+
+	} while (deviceState != AnalogDiscovery::DeviceStateDone);
+}
 
 // Class
 Measurement::Measurement(const std::string &name, SharedAnalogDiscoveryHandle dev, double fMin, double fMax, int pointsPerDecade) :
@@ -218,16 +193,32 @@ Measurement::Measurement(const std::string &name, SharedAnalogDiscoveryHandle de
 	m_thread(nullptr),
 	m_fMin(fMin),
 	m_fMax(fMax),
-	m_pointsPerDecade(pointsPerDecade)
+	m_pointsPerDecade(pointsPerDecade),
+	m_method(MethodSteppedSine),
+	m_estimator(EstimatorRms),
+	m_targetSnr(40.0),
+	m_settleTolerance(0.1),
+	m_maxSettle(0.05),
+	m_resultFormat(ResultFormatText),
+	m_archiveCaptures(false),
+	m_timings({0.0, 0.0, 0.0, 0.0, 0.0, 0}),
+	m_pointsDone(0),
+	m_pointsTotal(0)
 {
 }
 
 Measurement::~Measurement()
 {
-	stop();
+	if (m_isRunning)
+		stop();
 }
 
 void Measurement::start(int channel, double outputCalibration)
+{
+	start(std::vector<int>({channel}), outputCalibration);
+}
+
+void Measurement::start(const std::vector<int>& channels, double outputCalibration)
 {
 	Debug::verbose("Measurement::start", "Starting measurement");
 
@@ -236,8 +227,20 @@ void Measurement::start(int channel, double outputCalibration)
 		return;
 	}
 
+	if (channels.empty()) {
+		Debug::warning("Measurement", "No channel to measure on. Ignoring start command!");
+		return;
+	}
+
 	m_terminateRequest->store(false);
-	m_thread = new std::thread(Measurement::run, m_terminateRequest, m_dev, channel, outputCalibration, this);
+	m_pointsDone = 0;
+	m_pointsTotal = createMeasuringPoints(m_pointsPerDecade, m_fMin, m_fMax).size();
+	if (m_method == MethodMultitone)
+		m_thread = new std::thread(Measurement::runMultitone, m_terminateRequest, m_dev, channels, outputCalibration, this);
+	else if (m_method == MethodExponentialSweep)
+		m_thread = new std::thread(Measurement::runSweep, m_terminateRequest, m_dev, channels, outputCalibration, this);
+	else
+		m_thread = new std::thread(Measurement::run, m_terminateRequest, m_dev, channels, outputCalibration, this);
 	m_isRunning = true;
 }
 
@@ -259,7 +262,7 @@ void Measurement::stop()
 
 bool Measurement::isRunning()
 {
-	if (m_terminateRequest->load())
+	if (m_isRunning && m_terminateRequest->load())
 		stop();
 
 	return m_isRunning;
@@ -270,6 +273,159 @@ std::string Measurement::name() const
     return m_name;
 }
 
+// Static
+std::string Measurement::channelName(int channel)
+{
+	return channel == 0 ? "r" : "l";
+}
+
+std::string Measurement::fileName(const std::vector<int>& channels, size_t index) const
+{
+	// Single channel measurements keep the plain name
+	if (channels.size() < 2)
+		return m_name;
+
+	return m_name + "." + channelName(channels[index]);
+}
+
+std::unique_ptr<ResultWriter> Measurement::createWriter(const std::string &fileName, ResultQuantity quantity,
+														const std::vector<double>& points, int channel) const
+{
+	auto header = ResultWriter::header(m_fMin, m_fMax, m_pointsPerDecade);
+	header.targetSnr = m_targetSnr;
+	header.maxSettle = m_maxSettle;
+	header.settleTolerance = m_settleTolerance;
+	header.method = m_method;
+	header.estimator = m_estimator;
+	header.channel = channel;
+
+	Debug::debug("Measurement", "Saving measurement to file: " + fileName);
+	return ResultWriter::create(m_resultFormat, fileName, header, quantity, points);
+}
+
+void Measurement::save(const std::vector<double>& points, const std::vector<double>& values,
+					   const std::string &fileName, ResultQuantity quantity, int channel) const
+{
+	try {
+		auto writer = createWriter(fileName, quantity, points, channel);
+		for (size_t i=0; i<values.size(); i++)
+			writer->write(i, values[i]);
+		writer->flush();
+	} catch (const ResultException &e) {
+		Debug::error("Measurement", std::string("Can not save measurement! ") + e.what());
+	}
+}
+
+void Measurement::setMethod(Method m)
+{
+	if (m_isRunning) {
+		Debug::warning("Measurement", "Can not change method while running. Ignoring!");
+		return;
+	}
+
+	m_method = m;
+}
+
+Measurement::Method Measurement::method() const
+{
+	return m_method;
+}
+
+void Measurement::setEstimator(Estimator e)
+{
+	if (m_isRunning) {
+		Debug::warning("Measurement", "Can not change estimator while running. Ignoring!");
+		return;
+	}
+
+	m_estimator = e;
+}
+
+Estimator Measurement::estimator() const
+{
+	return m_estimator;
+}
+
+void Measurement::setTargetSnr(double snr)
+{
+	m_targetSnr = snr;
+}
+
+double Measurement::targetSnr() const
+{
+	return m_targetSnr;
+}
+
+void Measurement::setSettleTolerance(double toleranceDb)
+{
+	m_settleTolerance = toleranceDb;
+}
+
+double Measurement::settleTolerance() const
+{
+	return m_settleTolerance;
+}
+
+void Measurement::setMaxSettle(double maxSettle)
+{
+	m_maxSettle = maxSettle;
+}
+
+double Measurement::maxSettle() const
+{
+	return m_maxSettle;
+}
+
+void Measurement::setResultFormat(ResultFormat f)
+{
+	if (m_isRunning) {
+		Debug::warning("Measurement", "Can not change result format while running. Ignoring!");
+		return;
+	}
+
+	m_resultFormat = f;
+}
+
+ResultFormat Measurement::resultFormat() const
+{
+	return m_resultFormat;
+}
+
+void Measurement::setArchiveCaptures(bool archive)
+{
+	if (m_isRunning) {
+		Debug::warning("Measurement", "Can not change capture archiving while running. Ignoring!");
+		return;
+	}
+
+	m_archiveCaptures = archive;
+}
+
+bool Measurement::archiveCaptures() const
+{
+	return m_archiveCaptures;
+}
+
+SweepTimings Measurement::timings() const
+{
+	return m_timings;
+}
+
+std::vector<double> Measurement::settleTimes() const
+{
+	return m_settleTimes;
+}
+
+size_t Measurement::pointsDone() const
+{
+	return m_pointsDone;
+}
+
+size_t Measurement::pointsTotal() const
+{
+	return m_pointsTotal;
+}
+
 // create logarithmically well distributed measuring points,
 // so we have the same amount of measuring points in each decade.
 std::vector<double> Measurement::createMeasuringPoints(int pointsPerDecade, double minHz, double maxHz)
@@ -307,52 +463,252 @@ std::vector<double> Measurement::createMeasuringPoints(int pointsPerDecade, doub
 	return points;
 }
 
+// One record, handed from the device thread to the analysis thread
+struct PointCapture {
+	AcquisitionPlan plan;
+	RecordTiming actual;
+	int buffer;					// Index of the capture buffer holding the record
+	std::vector<size_t> skip;	// Samples of settle time in front of the record, per channel
+	size_t count;				// Samples to analyze after skip
+	AnalogDiscovery::SampleState losses;	// Samples lost and corrupted during the record
+};
+
 // Static
-void Measurement::run(SharedTerminateFlag terminateRequest, SharedAnalogDiscoveryHandle dev, int channel, double outputCalibration, Measurement *ptr)
+void Measurement::run(SharedTerminateFlag terminateRequest, SharedAnalogDiscoveryHandle dev, std::vector<int> channels, double outputCalibration, Measurement *ptr)
 {
 	// Create frequency vector containing measuring frequencies
 	auto points = ptr->createMeasuringPoints(ptr->m_pointsPerDecade, ptr->m_fMin, ptr->m_fMax);
 
 	//saveBuffer(points, "fMeasuringPoints.txt");
 
-	std::vector<double>freqResp(points.size());
+	std::vector<std::vector<double>>freqResp(channels.size(), std::vector<double>(points.size()));
+	std::vector<std::vector<double>>phaseResp(channels.size(), std::vector<double>(points.size()));
+	std::vector<double>settleTimes(points.size());
+
+	SweepTimings timings = {0.0, 0.0, 0.0, 0.0, 0.0, 0};
+	typedef std::chrono::duration<double> Seconds;
+
+	// The device thread (this one) only ever retunes and records. Each capture is
+	// handed over by index, analysis and writing the results happen on a second
+	// thread while the device is already busy with the next point. Only this
+	// thread sets and only that one gets, so the queue does without a lock.
+	std::vector<PointCapture> captures(points.size());
+	SPSCCircularBuffer<int> analysisQueue("AnalysisQueue", points.size() + 2);
+
+	// Records go straight into a few preallocated buffers, that travel between the
+	// threads. The analysis thread hands each one back, once it is done with it.
+	const int bufferCount = 3;
+	std::vector<CaptureBuffer> buffers(bufferCount, CaptureBuffer(channels.size()));
+	BlockingCircularBuffer<int> freeBuffers("FreeCaptureBuffers", bufferCount + 2);
+	for (int b=0; b<bufferCount; b++)
+		freeBuffers.set(&b, 1, std::chrono::seconds(1));
+
+	for (auto &capture : captures)
+		capture.skip.resize(channels.size());
+
+	const Estimator estimator = ptr->m_estimator;
+	const double settleTolerance = SettleDetector::toleranceForDb(ptr->m_settleTolerance);
+	const double maxSettle = ptr->m_maxSettle;
+
+	// Every point goes to disk as soon as it is analyzed, so an aborted sweep
+	// keeps what it has measured so far
+	std::vector<std::unique_ptr<ResultWriter>> levelWriters, phaseWriters;
+	std::unique_ptr<ResultWriter> settleWriter;
+	std::unique_ptr<CaptureArchiveWriter> archive;
+	try {
+		for (size_t c=0; c<channels.size(); c++) {
+			levelWriters.push_back(ptr->createWriter(ptr->fileName(channels, c), ResultQuantityLevel, points, channels[c]));
+			if (estimator == EstimatorSingleBin)
+				phaseWriters.push_back(ptr->createWriter(ptr->fileName(channels, c) + ".phase", ResultQuantityPhase, points, channels[c]));
+		}
+		settleWriter = ptr->createWriter(ptr->name() + ".settle", ResultQuantitySettleTime, points, -1);
+
+		if (ptr->m_archiveCaptures) {
+			auto header = CaptureArchiveWriter::header(ptr->m_fMin, ptr->m_fMax, ptr->m_pointsPerDecade, channels.size());
+			header.estimator = estimator;
+			header.targetSnr = ptr->m_targetSnr;
+			header.maxSettle = maxSettle;
+			header.settleTolerance = ptr->m_settleTolerance;
+			archive.reset(new CaptureArchiveWriter(ptr->name() + ".captures", header));
+		}
+	} catch (const ResultException &e) {
+		std::cerr << e.what() << std::endl;
+		terminateRequest->store(true);
+		return;
+	}
+
+	std::thread analysisThread([&]() {
+		int index;
+		while (true) {
+			if (!analysisQueue.get(&index, 1, std::chrono::seconds(1)))
+				continue;
+
+			// Sentinel, device thread is done
+			if (index < 0)
+				break;
+
+			auto start = std::chrono::steady_clock::now();
+			auto &capture = captures[index];
+			const double frequency = capture.plan.frequency;
+			const double samplingFrequency = capture.actual.samplingFrequency;
+
+			const auto &buffer = buffers[capture.buffer];
+
+			for (size_t c=0; c<channels.size(); c++) {
+				auto estimate = estimatePoint(estimator, buffer.view(c), capture.skip[c], capture.count, frequency, samplingFrequency);
+
+				freqResp[c][index] = dBuForVolts(estimate.rms);
+				phaseResp[c][index] = estimate.phase;
+
+				Debug::debug("Measurement::run", std::to_string(index)
+							 + " ch=" + std::to_string(channels[c]) + "  "
+							 + std::to_string(frequency) + "Hz: " + std::to_string(freqResp[c][index]));
+			}
+
+			if (archive) {
+				try {
+					for (size_t c=0; c<channels.size(); c++) {
+						CaptureChunkHeader chunk;
+						memset(&chunk, 0, sizeof(chunk));
+						chunk.point = index;
+						chunk.channel = channels[c];
+						chunk.lost = capture.losses.lost;
+						chunk.corrupted = capture.losses.corrupted;
+						chunk.frequency = frequency;
+						chunk.samplingFrequency = samplingFrequency;
+						chunk.skip = capture.skip[c];
+						chunk.count = capture.count;
+						archive->append(chunk, buffer.view(c));
+					}
+				} catch (const ResultException &e) {
+					Debug::error("Measurement::run", std::string("Can not archive record! ") + e.what());
+				}
+			}
+
+			// Done with the record, the device thread may fill the buffer again
+			freeBuffers.set(&capture.buffer, 1, std::chrono::seconds(1));
+
+			try {
+				for (size_t c=0; c<channels.size(); c++) {
+					levelWriters[c]->write(index, freqResp[c][index]);
+					levelWriters[c]->flush();
+					if (estimator == EstimatorSingleBin) {
+						phaseWriters[c]->write(index, phaseResp[c][index]);
+						phaseWriters[c]->flush();
+					}
+				}
+				settleWriter->write(index, settleTimes[index]);
+				settleWriter->flush();
+			} catch (const ResultException &e) {
+				Debug::error("Measurement::run", std::string("Can not save point! ") + e.what());
+			}
+
+			ptr->m_pointsDone++;
+
+			timings.analysis += Seconds(std::chrono::steady_clock::now() - start).count();
+		}
+	});
 
 	try {
 
-		dev->setAnalogOutputAmplitude(channel, 1.08 + outputCalibration); // 1.08Vpp -> 0.77 Vrms -> 0dBu input signal + calibration
-		dev->setAnalogOutputWaveform(channel, AnalogDiscovery::WaveformSine);
+		AcquisitionSession session(dev, channels);
+
+		for (auto channel : channels) {
+			dev->setAnalogOutputAmplitude(channel, 1.08 + outputCalibration); // 1.08Vpp -> 0.77 Vrms -> 0dBu input signal + calibration
+			dev->setAnalogOutputWaveform(channel, AnalogDiscovery::WaveformSine);
+		}
 
-		auto currentFrequency = points.begin();
-		auto currentFreqResp = freqResp.begin();
+		AcquisitionPlanner planner(estimator, ptr->m_targetSnr, dev->analogInputMaxSamplingFreq(), session.bufferSize());
+		auto plans = planner.plan(points);
 
-		while (!terminateRequest->load() && currentFrequency != points.end()) {
+		Debug::debug("Measurement::run", "Planned " + std::to_string(AcquisitionPlanner::totalDuration(plans)) +
+					 "s of settling and recording for " + std::to_string(points.size()) + " points");
 
-			dev->setAnalogOutputFrequency(channel, *currentFrequency);
-			dev->setAnalogOutputEnabled(channel, true);
+		// Longest record of the sweep, plus one device buffer the last read may overshoot
+		size_t capacity = 0;
+		double recordLength = 0.0;
+		for (auto &plan : plans) {
+			capacity = std::max(capacity, static_cast<size_t>(std::ceil((maxSettle + plan.duration) * plan.samplingFrequency)));
+			recordLength = std::max(recordLength, maxSettle + plan.duration);
+		}
+		capacity += session.bufferSize();
+		for (auto &buffer : buffers)
+			buffer.reserve(capacity);
 
-			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		std::vector<SettleDetector> detectors(channels.size(), SettleDetector(1.0, 1.0, settleTolerance, maxSettle));
 
-			auto samples = readOneBuffer(dev, channel, *currentFrequency);
+		auto sweepStart = std::chrono::steady_clock::now();
 
-			// Remove upper and lower 10% leads to better results
-			int removeCount = samples.size() * 0.1;
-			samples.erase(samples.begin(), samples.begin()+removeCount);
-			samples.erase(samples.end()-removeCount, samples.end());
+		for (size_t i=0; i<plans.size() && !terminateRequest->load(); i++) {
 
-			std::vector<double> keys(samples.size());
-			std::iota(std::begin(keys), std::end(keys), 0);
+			auto &capture = captures[i];
+			capture.plan = plans[i];
+			const double frequency = capture.plan.frequency;
 
-			*currentFreqResp = dBuForVolts(rms(samples));
+			// Blocks, while the analysis thread still works on all buffers
+			while (!freeBuffers.get(&capture.buffer, 1, std::chrono::seconds(1)) && !terminateRequest->load());
+			if (terminateRequest->load())
+				break;
 
-			Debug::debug("Measurement::run", std::to_string(std::distance(points.begin(), currentFrequency))
-						 + " ch=" + std::to_string(channel) + "  "
-						 + std::to_string(double(*currentFrequency)) + "Hz: " + std::to_string(*currentFreqResp));
+			auto pointStart = std::chrono::steady_clock::now();
+			unsigned long callsBefore = dev->callCount();
 
-			currentFrequency++;
-			currentFreqResp++;
+			session.setOutputFrequency(frequency);
+
+			// The record is triggered by restarting the generator, so sample 0 is the
+			// stimulus at phase 0. It runs, until the envelope is stable plus the
+			// planned duration. The record length is just an upper bound for that,
+			// the same for all points, so it is only sent once.
+			auto trigger = static_cast<AnalogDiscovery::TriggerSource>(AnalogDiscovery::TriggerSourceAnalogOut1 + channels.front());
+
+			capture.actual = session.arm(capture.plan.samplingFrequency, recordLength, trigger);
+			session.startOutputs();
+			auto recordStart = std::chrono::steady_clock::now();
+			unsigned long retuneCalls = dev->callCount() - callsBefore;
+			timings.retune += Seconds(recordStart - pointStart).count();
+			timings.retuneCalls += retuneCalls;
+
+			for (auto &detector : detectors)
+				detector = SettleDetector(frequency, capture.actual.samplingFrequency, settleTolerance, maxSettle);
+			capture.count = static_cast<size_t>(capture.plan.duration * capture.actual.samplingFrequency);
+			capture.losses = collectSettledRecord(&session, &detectors, capture.count, &buffers[capture.buffer]);
+
+			settleTimes[i] = 0.0;
+			for (size_t c=0; c<channels.size(); c++) {
+				capture.skip[c] = detectors[c].settleIndex();
+				settleTimes[i] = std::max(settleTimes[i], detectors[c].settleTime());
+
+				if (detectors[c].timedOut())
+					Debug::verbose("Measurement::run", std::to_string(frequency) + "Hz on ch=" + std::to_string(channels[c])
+								   + " did not settle within " + std::to_string(maxSettle) + "s");
+			}
+
+			// Settling happens inside the record
+			double record = Seconds(std::chrono::steady_clock::now() - recordStart).count();
+			double settle = std::min(record, settleTimes[i]);
+			timings.settle += settle;
+			timings.record += record - settle;
+
+			int index = static_cast<int>(i);
+			if (!analysisQueue.set(&index, 1, std::chrono::seconds(1))) {
+				Debug::error("Measurement::run", "Analysis queue full, dropping point " + std::to_string(i));
+				freeBuffers.set(&capture.buffer, 1, std::chrono::seconds(1));
+			}
+
+			Debug::verbose("AcquisitionPlanner", std::to_string(frequency) + "Hz:"
+						   + " fs planned=" + std::to_string(capture.plan.samplingFrequency)
+						   + " actual=" + std::to_string(capture.actual.samplingFrequency)
+						   + " record planned=" + std::to_string(capture.plan.duration)
+						   + "s actual=" + std::to_string(capture.count / capture.actual.samplingFrequency)
+						   + "s settle planned=" + std::to_string(capture.plan.settle)
+						   + "s actual=" + std::to_string(settleTimes[i])
+						   + "s point took " + std::to_string(Seconds(std::chrono::steady_clock::now() - pointStart).count()) + "s"
+						   + " and " + std::to_string(retuneCalls) + " DWF calls to retune");
 		}
 
-        saveMeasurement(points, freqResp, ptr->name());
+		session.setTrigger(AnalogDiscovery::TriggerSourceNone);
+
+		timings.total = Seconds(std::chrono::steady_clock::now() - sweepStart).count();
 
 	} catch(AnalogDiscoveryException e) {
 		std::cerr << e.what() << std::endl;
@@ -360,9 +716,176 @@ void Measurement::run(SharedTerminateFlag terminateRequest, SharedAnalogDiscover
 		std::cerr << e.what() << std::endl;
 	}
 
+	// Let the analysis thread drain the queue and write the results
+	int sentinel = -1;
+	while (!analysisQueue.set(&sentinel, 1, std::chrono::seconds(1)));
+	analysisThread.join();
+
+	Debug::debug("Measurement::run", "Sweep took " + std::to_string(timings.total) + "s:"
+				 + " retune=" + std::to_string(timings.retune)
+				 + "s settle=" + std::to_string(timings.settle)
+				 + "s record=" + std::to_string(timings.record)
+				 + "s analysis=" + std::to_string(timings.analysis) + "s (overlapped), "
+				 + std::to_string(timings.retuneCalls) + " DWF calls to retune");
+
+	ptr->m_timings = timings;
+	ptr->m_settleTimes = settleTimes;
+
+	terminateRequest->store(true);
+
+	saveBuffer(freqResp.front(), "measurement.txt", ptr->m_resultFormat);
+}
+
+// Static
+void Measurement::runMultitone(SharedTerminateFlag terminateRequest, SharedAnalogDiscoveryHandle dev, std::vector<int> channels, double outputCalibration, Measurement *ptr)
+{
+	const double captureSeconds = 1.0;
+	const double leadSeconds = 0.25;	// Room for the DUT to settle and for its latency
+	const double tailSeconds = 0.05;
+	const size_t minPeriodSamples = 4096;
+	const size_t maxPeriodSamples = 1 << 18;
+
+	auto points = ptr->createMeasuringPoints(ptr->m_pointsPerDecade, ptr->m_fMin, ptr->m_fMax);
+
+	std::vector<std::vector<double>> freqResp(channels.size());
+
+	try {
+		const double amplitude = 1.08 + outputCalibration; // Peak of the whole multitone, see run()
+
+		AcquisitionSession session(dev, channels);
+		// A period of one sample: the rate, that keeps the highest tone at its place
+		double samplingFrequency = session.setSamplingFrequency(Multitone::fundamentalFor(points.back(), 1));
+
+		// The period is streamed, so it may be as long as the lowest points need
+		// to get an odd harmonic of their own each
+		size_t periodSamples = Multitone::periodSamplesFor(points, samplingFrequency, minPeriodSamples, maxPeriodSamples);
+		Multitone stimulus(points, periodSamples, samplingFrequency / periodSamples);
+		size_t periods = FFT::nextPowerOfTwo(std::ceil(captureSeconds * stimulus.fundamental()));
+		size_t sampleCount = periods * periodSamples;
+
+		// What is analyzed is preceded by the end of a period, so the stimulus runs
+		// on continuously into it, while the DUT settles
+		size_t lead = static_cast<size_t>(std::max(leadSeconds, ptr->m_maxSettle) * samplingFrequency);
+		std::vector<double> signal(lead + sampleCount);
+		for (size_t i=0; i<signal.size(); i++)
+			signal[i] = stimulus.period()[(i + periodSamples - lead % periodSamples) % periodSamples];
+
+		if (terminateRequest->load())
+			throw DSPException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0, "Terminated before capture");
+
+		CaptureBuffer buffer(channels.size());
+		playAndRecord(&session, signal, samplingFrequency, amplitude, tailSeconds, &buffer);
+
+		// Points without a harmonic of their own stay NaN
+		for (auto &r : freqResp)
+			r.assign(points.size(), std::numeric_limits<double>::quiet_NaN());
+		auto indexOf = [&points](double f) {
+			return std::lower_bound(points.begin(), points.end(), f) - points.begin();
+		};
+
+		for (size_t c=0; c<channels.size(); c++) {
+			auto samples = buffer.view(c);
+
+			if (samples.size() < lead + sampleCount)
+				throw DSPException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
+								   ("Capture too short: " + std::to_string(samples.size()) + " of " +
+									std::to_string(lead + sampleCount) + " samples").c_str());
+
+			samples = samples.trimmed(lead, samples.size() - lead - sampleCount);
+
+			auto levels = stimulus.analyze(samples.data(), samples.size(), periods);
+
+			// Report what a full level sine would give, like run() does
+			for (size_t i=0; i<levels.size(); i++) {
+				auto index = indexOf(stimulus.placed()[i]);
+				freqResp[c][index] = dBuForVolts(rms(levels[i] / stimulus.toneAmplitude()));
+
+				Debug::debug("Measurement::runMultitone", std::to_string(index)
+							 + " ch=" + std::to_string(channels[c]) + "  "
+							 + std::to_string(points[index]) + "Hz (tone at "
+							 + std::to_string(stimulus.harmonics()[i] * stimulus.fundamental()) + "Hz): "
+							 + std::to_string(freqResp[c][index]));
+			}
+		}
+
+		ptr->m_pointsDone = stimulus.placed().size();
+
+		// At the requested points, like the other methods
+		for (size_t c=0; c<channels.size(); c++)
+			ptr->save(points, freqResp[c], ptr->fileName(channels, c), ResultQuantityLevel, channels[c]);
+
+	} catch(const AnalogDiscoveryException &e) {
+		std::cerr << e.what() << std::endl;
+	} catch(const DSPException &e) {
+		std::cerr << e.what() << std::endl;
+	} catch (const std::exception &e) {
+		std::cerr << e.what() << std::endl;
+	}
+
+	terminateRequest->store(true);
+
+	saveBuffer(freqResp.front(), "measurement.txt", ptr->m_resultFormat);
+}
+
+// Static
+void Measurement::runSweep(SharedTerminateFlag terminateRequest, SharedAnalogDiscoveryHandle dev, std::vector<int> channels, double outputCalibration, Measurement *ptr)
+{
+	const double sweepSeconds = 1.0;
+	const double tailSeconds = 0.25;	// Room for the DUTs latency and decay
+	const int harmonicCount = 5;
+
+	auto points = ptr->createMeasuringPoints(ptr->m_pointsPerDecade, ptr->m_fMin, ptr->m_fMax);
+
+	std::vector<std::vector<double>> freqResp(channels.size());
+
+	try {
+		const double amplitude = 1.08 + outputCalibration; // See run()
+
+		// Sweep starts an octave below and ends above the measuring points,
+		// so the fades of the inverse filter stay out of the way.
+		AcquisitionSession session(dev, channels);
+		double samplingFrequency = session.setSamplingFrequency(4.0 * points.back());
+		ExponentialSweep sweep(points.front() / 2.0, points.back() * 1.5, sweepSeconds, samplingFrequency);
+
+		if (terminateRequest->load())
+			throw DSPException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0, "Terminated before capture");
+
+		CaptureBuffer buffer(channels.size());
+		playAndRecord(&session, sweep.signal(), samplingFrequency, amplitude, tailSeconds, &buffer);
+
+		for (size_t c=0; c<channels.size(); c++) {
+			auto result = sweep.analyze(buffer.view(c).toVector(), points, harmonicCount);
+			std::vector<double> thd;
+
+			for (size_t i=0; i<points.size(); i++) {
+				// The recording is deconvolved with the unit sweep, so magnitude already
+				// is the amplitude a sine played at amplitude comes back with
+				freqResp[c].push_back(dBuForVolts(rms(result.magnitude[i])));
+				thd.push_back(result.thd[i] * 100.0);
+
+				Debug::debug("Measurement::runSweep", std::to_string(i)
+							 + " ch=" + std::to_string(channels[c]) + "  "
+							 + std::to_string(points[i]) + "Hz: " + std::to_string(freqResp[c].back())
+							 + " THD: " + std::to_string(thd.back()) + "%");
+			}
+
+			ptr->save(points, freqResp[c], ptr->fileName(channels, c), ResultQuantityLevel, channels[c]);
+			ptr->save(points, thd, ptr->fileName(channels, c) + ".thd", ResultQuantityThd, channels[c]);
+		}
+
+		ptr->m_pointsDone = points.size();
+
+	} catch(const AnalogDiscoveryException &e) {
+		std::cerr << e.what() << std::endl;
+	} catch(const DSPException &e) {
+		std::cerr << e.what() << std::endl;
+	} catch (const std::exception &e) {
+		std::cerr << e.what() << std::endl;
+	}
+
 	terminateRequest->store(true);
 
-	saveBuffer(freqResp, "measurement.txt");
+	saveBuffer(freqResp.front(), "measurement.txt", ptr->m_resultFormat);
 }
 
 // Static
@@ -385,23 +908,23 @@ void Measurement::calibrate(SharedTerminateFlag terminateRequest, SharedCalibrat
 
 		while (!terminateRequest->load()) {
 
-			auto samples = readOneBuffer(dev, channel, refFrequency);
+			auto buffer = readOneBuffer(dev, channel, refFrequency);
 
 			// Remove upper and lower 10% leads to better results
-			int removeCount = samples.size() * 0.1;
-			samples.erase(samples.begin(), samples.begin()+removeCount);
-			samples.erase(samples.end()-removeCount, samples.end());
+			size_t removeCount = buffer.size() * 0.1;
+			auto samples = SampleView(buffer.data(), buffer.size()).trimmed(removeCount, removeCount);
+			double inputRms = DSPKernels::rms(samples);
 
 			std::cout << "output: " << std::to_string(rms(refOutput)) << "Vrms(" << std::to_string(dBuForVolts(rms(refOutput))) << "dBu) --- input: "
-					  << std::to_string(rms(samples)) << "Vrms(" <<  std::to_string(dBuForVolts(rms(samples))) << "dBu) ---"
-					  << std::to_string(*std::max_element(samples.begin(), samples.end())) << "Vmax" << std::endl;
+					  << std::to_string(inputRms) << "Vrms(" <<  std::to_string(dBuForVolts(inputRms)) << "dBu) ---"
+					  << std::to_string(samples.empty() ? 0.0 : *std::max_element(samples.begin(), samples.end())) << "Vmax" << std::endl;
 
 			// Commands
 			char ncmd = cmd->load();
 			if (ncmd == 'b') {
 				cmd->store(0);
 				std::cout << "saving buffer..." << std::endl;
-				saveBuffer(samples, "samples.txt");
+				saveBuffer(samples.toVector(), "samples.txt");
 			}
 
 			// Calibration Amount
@@ -1,40 +1,68 @@
 #pragma once
 
+#include <atomic>
 #include <vector>
 #include <map>
 #include <sstream>
 
 #include "analogdiscovery.h"
 #include "gpio.h"
+#include "gpioregistry.h"
+#include "gpiomapping.h"
 #include "types.h"
+#include "estimator.h"
+#include "dsp.h"
+#include "acquisitionplanner.h"
+#include "blockingcircularbuffer.h"
+#include "spsccircularbuffer.h"
+#include "settledetector.h"
+#include "capturebuffer.h"
+#include "acquisitionsession.h"
+#include "resultwriter.h"
+#include "capturearchive.h"
+
+
+
+// Thread function, that polls and reads the inputbuffer of an armed record
+// straight into target, one target channel per channel of the session
+static auto collectRecord = [](AcquisitionSession *session, CaptureBuffer *target)
+{
+	auto handle = session->handle();
+	auto &channels = session->channels();
 
+	target->clear();
 
+	auto deviceState = AnalogDiscovery::DeviceStateUnknown;
 
-// Thread function, that polls and reads the inputbuffer
-auto readOneBuffer = [](SharedAnalogDiscoveryHandle handle, int channel, double currentFrequency)
-{
-	const double oversampling = 100.0;
-	const int desiredSampleCount = 8192;
-	const int periodes = 20;
-
-	double *buffer;
+	do {
+		auto sampleState = handle->analogInSampleState();
+		if (sampleState.corrupted != 0 || sampleState.lost != 0) {
+			std::stringstream ss;
+			ss << sampleState;
+			Debug::verbose("Measurement", ss.str());
+		}
 
-	std::vector<double> samples;
+		if (!sampleState.available)
+			deviceState = handle->analogInputStatus(channels.front());
 
-	handle->setAnalogInputEnabled(channel, true);
-	handle->setAnalogInputRange(channel, 5);
+		// One status covers all channels, each is read on its own
+		if (sampleState.available)
+			AnalogDiscovery::readSamples(handle, channels, target, sampleState.available);
 
-	handle->setAnalogInputBufferSize(desiredSampleCount);
-	int bufferSize = handle->analogInputBufferSize();
-	buffer = new double[bufferSize];
+	} while (deviceState != AnalogDiscovery::DeviceStateDone);
+};
 
-	handle->setAnalogInputAcquisitionMode(AnalogDiscovery::AcquisitionModeRecord);
+// Like collectRecord, but feeds the samples to one detector per channel while they come in and
+// stops the record, as soon as recordSamples samples past the latest settle point are in.
+// Returns the samples lost and corrupted during the record.
+static auto collectSettledRecord = [](AcquisitionSession *session, std::vector<SettleDetector> *detectors, size_t recordSamples, CaptureBuffer *target)
+{
+	auto handle = session->handle();
+	auto &channels = session->channels();
 
-	double desiredSamplingFrequency = oversampling * currentFrequency;
-	handle->setAnalogInputSamplingFreq(desiredSamplingFrequency);
-	handle->setAnalogInputAcquisitionDuration(1.0 / currentFrequency * periodes);
-	handle->setAnalogInputStart(true);
+	target->clear();
 
+	AnalogDiscovery::SampleState losses = {0, 0, 0};
 	auto deviceState = AnalogDiscovery::DeviceStateUnknown;
 
 	do {
@@ -43,87 +71,93 @@ auto readOneBuffer = [](SharedAnalogDiscoveryHandle handle, int channel, double
 			std::stringstream ss;
 			ss << sampleState;
 			Debug::verbose("Measurement", ss.str());
+			losses.lost += sampleState.lost;
+			losses.corrupted += sampleState.corrupted;
 		}
 
 		if (!sampleState.available)
-			deviceState = handle->analogInputStatus(channel);
+			deviceState = handle->analogInputStatus(channels.front());
 
+		size_t fed = target->size();
 		if (sampleState.available)
-			AnalogDiscovery::readSamples(handle, channel, buffer, bufferSize, &samples, sampleState.available);
+			AnalogDiscovery::readSamples(handle, channels, target, sampleState.available);
 
-	} while (deviceState != AnalogDiscovery::DeviceStateDone);
+		bool done = true;
+		for (size_t c=0; c<channels.size(); c++) {
+			auto &detector = (*detectors)[c];
 
-	delete[] buffer;
+			if (!detector.settled() && target->size() > fed)
+				detector.feed(target->view(c).data() + fed, target->size() - fed);
 
-	return samples;
-};
+			done = done && detector.settled() && target->size() >= detector.settleIndex() + recordSamples;
+		}
 
-// Helpers, so I can use copy(), to write data with indexed values into a csv file;
-template <class T>
-class IntIndexer
-{
-public:
-	IntIndexer(T val) : value(val) {}
-	static void setStartIndex(int i) { IntIndexer<T>::index = i; }
-	void Print(std::ostream& os) const
-	{
-		os << (IntIndexer::index++) << "," << value;
-	}
-private:
-	T value;
-	std::string delim;
-	static int index;
-};
+		if (done) {
+			handle->setAnalogInputStart(false);
+			break;
+		}
 
-template <class T>
-int IntIndexer<T>::index = 0;
+	} while (deviceState != AnalogDiscovery::DeviceStateDone);
 
-template <class T>
-std::ostream& operator<<(std::ostream& lhs, IntIndexer<T> const& rhs)
-{
-	rhs.Print(lhs);
-	return lhs;
-}
+	return losses;
+};
 
-template <typename A, typename B>
-class PrintablePair
+// Reads duration seconds at samplingFrequency in record mode, untriggered
+static auto readRecord = [](SharedAnalogDiscoveryHandle handle, int channel, double samplingFrequency, double duration)
 {
-public:
-	PrintablePair(A val1, B val2) : first(val1), second(val2) {}
-	void Print(std::ostream& os) const
-	{
-		os << first << "," << second;
-	}
-	A first;
-	B second;
+	AcquisitionSession session(handle, {channel});
+	auto actual = session.arm(samplingFrequency, duration, AnalogDiscovery::TriggerSourceNone);
+
+	CaptureBuffer buffer(1, static_cast<size_t>(std::ceil(actual.samplingFrequency * actual.duration)) + session.bufferSize());
+	collectRecord(&session, &buffer);
+	return buffer.view(0).toVector();
 };
 
-template <class T>
-std::ostream& operator<<(std::ostream& lhs, PrintablePair<T,T> const& rhs)
+// Reads 20 periodes of currentFrequency at 100x oversampling
+static auto readOneBuffer = [](SharedAnalogDiscoveryHandle handle, int channel, double currentFrequency)
 {
-	rhs.Print(lhs);
-	return lhs;
-}
+	const double oversampling = 100.0;
+	const int periodes = 20;
+
+	return readRecord(handle, channel, oversampling * currentFrequency, 1.0 / currentFrequency * periodes);
+};
 
 // GPIO foo
+// All GPIOs of GPIOMapping::getDefault(), set up right away
 std::list<SharedGPIOHandle> loadDefaultGPIOMapping(SharedAnalogDiscoveryHandle analogDiscovery);
 std::list<SharedGPIOHandle> loadDummyGPIOMapping(SharedAnalogDiscoveryHandle analogDiscovery);
 
-struct GPIOState {
-	GPIO::Direction direction;
-	bool value;
-};
-typedef std::map<SharedGPIOHandle, GPIOState> GPIOSnapshot;
-GPIOSnapshot createGPIOSnapshot(std::list<SharedGPIOHandle> gpios);
+// Current state of all GPIOs of registry
+GPIOSnapshot createGPIOSnapshot(const GPIORegistry &registry);
 
 void updateGPIOSnapshot(GPIOSnapshot *snapshot, SharedGPIOHandle gpio, GPIOState state);
-void setGPIOSnapshot(GPIOSnapshot snapshot);
+// Sets the GPIOs of snapshot through batch, which is cleared first. With current,
+// only those differing from it, current is updated to match. Reusing batch and
+// current, applying snapshots does not allocate.
+void setGPIOSnapshot(const GPIOSnapshot &snapshot, GPIOBatch *batch, GPIOSnapshot *current);
+void setGPIOSnapshot(const GPIOSnapshot &snapshot);
 
-double dBuForVolts(double v);
-double dBvForVolts(double v);
 double rms(const std::vector<double>& samples);
+double rms(const double *samples, size_t size);
 double rms(double vsine);
-void saveBuffer(const std::vector<double>& s, const std::string& fileName);
+// Raw dump, index and value per line, or a ResultQuantitySamples file for binary
+void saveBuffer(const std::vector<double>& s, const std::string& fileName, ResultFormat format = ResultFormatText);
+
+// Streams stimulus out of all channels in WaveformPlay mode at samplingFrequency,
+// while recording the same channels into target from before the start until tail seconds after the end
+void playAndRecord(AcquisitionSession *session, const std::vector<double>& stimulus,
+				   double samplingFrequency, double amplitude, double tail, CaptureBuffer *target);
+
+// Wall time per stage of a stepped sine sweep. Analysis runs on its own thread,
+// so it only costs time, if it is more than settle and record together.
+struct SweepTimings {
+	double retune;		// Seconds setting up generator and record
+	double settle;		// Seconds waiting for the DUT
+	double record;		// Seconds reading records
+	double analysis;	// Seconds in estimators, on the analysis thread
+	double total;		// Wall time of the whole sweep
+	unsigned long retuneCalls;	// DWF calls setting up generator and record, all points
+};
 
 // Class
 
@@ -133,11 +167,56 @@ public:
 	Measurement(const std::string &name, SharedAnalogDiscoveryHandle dev, double fMin, double fMax, int pointsPerDecade);
 	~Measurement();
 
+	enum Method {
+		MethodSteppedSine,		// One sine per measuring point
+		MethodMultitone,		// All measuring points at once, one streamed stimulus and capture
+		MethodExponentialSweep	// One logarithmic chirp, deconvolved. Gives THD as well
+	};
+	void setMethod(Method m);
+	Method method() const;
+
+	// How MethodSteppedSine gets the level of each point
+	void setEstimator(Estimator e);
+	Estimator estimator() const;
+
+	// dB the acquisition planner aims for on each point
+	void setTargetSnr(double snr);
+	double targetSnr() const;
+
+	// Stepped sine waits for the level to change less than toleranceDb between
+	// two envelope windows after each retune, but never longer than maxSettle seconds
+	void setSettleTolerance(double toleranceDb);
+	double settleTolerance() const;
+	void setMaxSettle(double maxSettle);
+	double maxSettle() const;
+
+	// Of all result files. Stepped sine writes each point as soon as it is analyzed.
+	void setResultFormat(ResultFormat f);
+	ResultFormat resultFormat() const;
+
+	// Stepped sine keeps every record in <name>.captures, see CaptureArchive
+	void setArchiveCaptures(bool archive);
+	bool archiveCaptures() const;
+
+	// Of the last stepped sine sweep, valid once isRunning() is false
+	SweepTimings timings() const;
+	// Seconds each measuring point took to settle
+	std::vector<double> settleTimes() const;
+
+	// Measuring points analyzed so far of all of the running or last measurement.
+	// Safe to poll from any thread. Multitone and sweep finish all at once.
+	size_t pointsDone() const;
+	size_t pointsTotal() const;
+
 	void start(int channel, double outputCalibration);
+	// Measures all channels in the same records. With more than one channel,
+	// results go to <name>.<channelName()> each.
+	void start(const std::vector<int>& channels, double outputCalibration);
 	void stop();
 	bool isRunning();
 
     std::string name() const;
+	static std::string channelName(int channel);
 
 	//Hmm... rethink
 	static void calibrate(SharedTerminateFlag terminateRequest, SharedCalibrateAmout amount, SharedCommandFlag cmd, SharedAnalogDiscoveryHandle dev);
@@ -150,8 +229,28 @@ private:
 	double m_fMin;
 	double m_fMax;
 	int m_pointsPerDecade;
+	Method m_method;
+	Estimator m_estimator;
+	double m_targetSnr;
+	double m_settleTolerance;
+	double m_maxSettle;
+	ResultFormat m_resultFormat;
+	bool m_archiveCaptures;
+	SweepTimings m_timings;
+	std::vector<double> m_settleTimes;
+	std::atomic<size_t> m_pointsDone;
+	std::atomic<size_t> m_pointsTotal;
 
 	std::vector<double> createMeasuringPoints(int pointsPerDecade, double minHz, double maxHz);
-	static void run(SharedTerminateFlag terminateRequest, SharedAnalogDiscoveryHandle dev, int channel, double outputCalibration, Measurement *ptr);
+	std::string fileName(const std::vector<int>& channels, size_t index) const;
+	// Channel -1 for results of several
+	std::unique_ptr<ResultWriter> createWriter(const std::string &fileName, ResultQuantity quantity,
+											   const std::vector<double>& points, int channel) const;
+	// All points at once, logs if that fails
+	void save(const std::vector<double>& points, const std::vector<double>& values,
+			  const std::string &fileName, ResultQuantity quantity, int channel) const;
+	static void run(SharedTerminateFlag terminateRequest, SharedAnalogDiscoveryHandle dev, std::vector<int> channels, double outputCalibration, Measurement *ptr);
+	static void runMultitone(SharedTerminateFlag terminateRequest, SharedAnalogDiscoveryHandle dev, std::vector<int> channels, double outputCalibration, Measurement *ptr);
+	static void runSweep(SharedTerminateFlag terminateRequest, SharedAnalogDiscoveryHandle dev, std::vector<int> channels, double outputCalibration, Measurement *ptr);
 
 };
@@ -0,0 +1,273 @@
+#include "measurementservice.h"
+
+#include <fstream>
+#include <sstream>
+
+#include <string.h>
+
+extern "C" {
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+}
+
+#include "debug.h"
+
+MeasurementService::MeasurementService(SharedAnalogDiscoveryHandle dev, const GPIORegistry &gpios, const std::string &directory) :
+	m_dev(dev),
+	m_gpios(gpios),
+	m_directory(directory),
+	m_eventFd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+	m_nextId(1),
+	m_quit(false)
+{
+	if (m_eventFd < 0)
+		throw DescriptiveException(__PRETTY_FUNCTION__, __FILE__, __LINE__, errno,
+								   (std::string("Can not create measurement service: ") + strerror(errno)).c_str());
+
+	m_thread = std::thread(&MeasurementService::run, this);
+}
+
+MeasurementService::~MeasurementService()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+		for (auto &e : m_entries)
+			e.second.cancelRequested = true;
+	}
+	m_condition.notify_all();
+	m_thread.join();
+
+	close(m_eventFd);
+}
+
+unsigned int MeasurementService::submit(const Job &job)
+{
+	unsigned int id;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		id = m_nextId++;
+		m_entries[id] = Entry{job, Status{id, StateQueued, 0, 0}, false};
+		m_queue.push_back(id);
+	}
+	m_condition.notify_all();
+
+	Debug::verbose("MeasurementService", "Queued job " + std::to_string(id));
+	return id;
+}
+
+bool MeasurementService::cancel(unsigned int id)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_entries.find(id);
+		if (it == m_entries.end() || hasEnded(it->second.status.state))
+			return false;
+
+		// Queued ones never start, the running one stops within a poll
+		it->second.cancelRequested = true;
+		if (it->second.status.state == StateQueued) {
+			it->second.status.state = StateCancelled;
+			for (auto q = m_queue.begin(); q != m_queue.end(); q++) {
+				if (*q == id) {
+					m_queue.erase(q);
+					break;
+				}
+			}
+		}
+	}
+
+	notify();
+	return true;
+}
+
+bool MeasurementService::status(unsigned int id, Status *status) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto it = m_entries.find(id);
+	if (it == m_entries.end())
+		return false;
+
+	*status = it->second.status;
+	return true;
+}
+
+std::vector<MeasurementService::Status> MeasurementService::statuses() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::vector<Status> ret;
+	for (auto &e : m_entries)
+		ret.push_back(e.second.status);
+	return ret;
+}
+
+std::vector<std::pair<std::string, std::string>> MeasurementService::results(unsigned int id) const
+{
+	std::vector<std::pair<std::string, std::string>> ret;
+
+	std::vector<std::string> names;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_entries.find(id);
+		if (it == m_entries.end() || it->second.status.state != StateDone)
+			return ret;
+
+		std::string name = "job-" + std::to_string(id);
+		if (it->second.job.channel == 's') {
+			names.push_back(name + "." + Measurement::channelName(1));
+			names.push_back(name + "." + Measurement::channelName(0));
+		} else {
+			names.push_back(name);
+		}
+	}
+
+	// Whatever the method wrote besides the response
+	std::vector<std::string> files;
+	for (auto &name : names) {
+		for (auto suffix : {"", ".phase", ".thd"})
+			files.push_back(name + suffix);
+	}
+	files.push_back("job-" + std::to_string(id) + ".settle");
+
+	for (auto &file : files) {
+		std::ifstream in(m_directory + "/" + file);
+		if (!in.is_open())
+			continue;
+
+		std::stringstream ss;
+		ss << in.rdbuf();
+		ret.push_back(std::make_pair(file, ss.str()));
+	}
+
+	return ret;
+}
+
+int MeasurementService::eventFd() const
+{
+	return m_eventFd;
+}
+
+void MeasurementService::clearEvent()
+{
+	uint64_t count;
+	TEMP_FAILURE_RETRY(read(m_eventFd, &count, sizeof(count)));
+}
+
+// Static
+bool MeasurementService::hasEnded(State s)
+{
+	return s == StateDone || s == StateFailed || s == StateCancelled;
+}
+
+// Static
+std::string MeasurementService::stateName(State s)
+{
+	switch (s) {
+	case StateQueued: return "queued";
+	case StateRunning: return "running";
+	case StateDone: return "done";
+	case StateFailed: return "failed";
+	case StateCancelled: return "cancelled";
+	}
+	return "unknown";
+}
+
+void MeasurementService::run()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	for (;;) {
+		m_condition.wait(lock, [this]() { return m_quit || !m_queue.empty(); });
+		if (m_quit)
+			return;
+
+		unsigned int id = m_queue.front();
+		m_queue.pop_front();
+
+		// Entries are never removed, the reference stays valid while unlocked
+		auto &entry = m_entries[id];
+		entry.status.state = StateRunning;
+		Job job = entry.job;
+
+		lock.unlock();
+		notify();
+		State end = measure(id, job);
+		lock.lock();
+
+		entry.status.state = end;
+		notify();
+
+		Debug::verbose("MeasurementService", "Job " + std::to_string(id) + " " + stateName(end));
+	}
+}
+
+MeasurementService::State MeasurementService::measure(unsigned int id, const Job &job)
+{
+	if (job.selectSpeaker) {
+		try {
+			Speaker::setChannel(m_gpios.get("Enable"), m_gpios.get("ADR0"), m_gpios.get("ADR1"), job.speaker);
+		} catch (const GPIOException &e) {
+			Debug::error("MeasurementService", std::string("Can not select speaker: ") + e.what());
+			return StateFailed;
+		}
+	}
+
+	Measurement m(resultName(id), m_dev, job.fMin, job.fMax, job.pointsPerDecade);
+	m.setMethod(job.method);
+	m.setEstimator(job.estimator);
+	m.setTargetSnr(job.targetSnr);
+	m.setMaxSettle(job.maxSettle);
+	m.setSettleTolerance(job.settleTolerance);
+
+	if (job.channel == 's')
+		m.start(std::vector<int>({0, 1}), job.outputCalibration);
+	else
+		m.start((job.channel == 'r' ? 0 : 1), job.outputCalibration);
+
+	bool cancelled = false;
+	size_t done = 0;
+	size_t total = 0;
+
+	for (;;) {
+		// isRunning() first, so the points read after it are final, once it is false
+		bool running = m.isRunning();
+		bool changed = m.pointsDone() != done || m.pointsTotal() != total;
+		done = m.pointsDone();
+		total = m.pointsTotal();
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto &entry = m_entries[id];
+			entry.status.pointsDone = done;
+			entry.status.pointsTotal = total;
+			cancelled = entry.cancelRequested;
+		}
+
+		if (!running)
+			break;
+		if (changed)
+			notify();
+
+		if (cancelled)
+			m.stop();
+		else
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+
+	// Measurements report errors only by not getting through all points
+	if (cancelled)
+		return StateCancelled;
+	return total > 0 && done == total ? StateDone : StateFailed;
+}
+
+
+std::string MeasurementService::resultName(unsigned int id) const
+{
+	return m_directory + "/job-" + std::to_string(id);
+}
+
+void MeasurementService::notify()
+{
+	uint64_t one = 1;
+	TEMP_FAILURE_RETRY(write(m_eventFd, &one, sizeof(one)));
+}
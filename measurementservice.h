@@ -0,0 +1,102 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "measurement.h"
+#include "gpioregistry.h"
+#include "speaker.h"
+
+// Measurements for gpioctld clients, on the device gpioctld keeps open. Jobs
+// are queued and measured one after the other on a thread of their own, each
+// writes its results to <directory>/job-<id>[.<channel>][.phase|.thd|.settle].
+// Whenever a job starts, progresses or ends, eventFd() becomes readable, so the
+// server loop can tell watching clients without polling.
+class MeasurementService
+{
+public:
+	// What to measure, like the options of FreqResp
+	struct Job {
+		double fMin;
+		double fMax;
+		int pointsPerDecade;
+		char channel;			// 'l', 'r' or 's' for both at once
+		Measurement::Method method;
+		Estimator estimator;
+		double targetSnr;
+		double maxSettle;		// Seconds
+		double settleTolerance;
+		double outputCalibration;
+		bool selectSpeaker;		// Leave the speaker GPIOs alone otherwise
+		Speaker::Channel speaker;
+	};
+
+	enum State {
+		StateQueued,
+		StateRunning,
+		StateDone,
+		StateFailed,
+		StateCancelled
+	};
+
+	struct Status {
+		unsigned int id;
+		State state;
+		size_t pointsDone;
+		size_t pointsTotal;
+	};
+
+	MeasurementService(SharedAnalogDiscoveryHandle dev, const GPIORegistry &gpios, const std::string &directory);
+	MeasurementService(const MeasurementService&) = delete;
+	MeasurementService& operator=(const MeasurementService&) = delete;
+	// Stops the running job, drops queued ones
+	~MeasurementService();
+
+	// Returns the id of the job, ids start at 1
+	unsigned int submit(const Job &job);
+	// False, if there is no such job or it has ended already
+	bool cancel(unsigned int id);
+
+	// False, if there is no such job
+	bool status(unsigned int id, Status *status) const;
+	std::vector<Status> statuses() const;
+	// Name and content of each result file of a job, that is done
+	std::vector<std::pair<std::string, std::string>> results(unsigned int id) const;
+
+	// Readable after any job changed, clearEvent() once handled
+	int eventFd() const;
+	void clearEvent();
+
+	static bool hasEnded(State s);
+	static std::string stateName(State s);
+
+private:
+	struct Entry {
+		Job job;
+		Status status;
+		bool cancelRequested;
+	};
+
+	SharedAnalogDiscoveryHandle m_dev;
+	const GPIORegistry &m_gpios;
+	std::string m_directory;
+	int m_eventFd;
+	mutable std::mutex m_mutex;
+	std::condition_variable m_condition;
+	std::map<unsigned int, Entry> m_entries;
+	std::deque<unsigned int> m_queue;
+	unsigned int m_nextId;
+	bool m_quit;
+	std::thread m_thread;
+
+	void run();
+	State measure(unsigned int id, const Job &job);
+	std::string resultName(unsigned int id) const;
+	void notify();
+};
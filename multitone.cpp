@@ -0,0 +1,266 @@
+#include "multitone.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#include "debug.h"
+
+Multitone::Multitone(const std::vector<double>& requestedFrequencies, size_t periodSamples, double fundamental,
+					 double maxDeviation) :
+	m_periodSamples(periodSamples),
+	m_fundamental(fundamental),
+	m_toneAmplitude(0.0),
+	m_crestFactor(0.0)
+{
+	if (!FFT::isPowerOfTwo(m_periodSamples))
+		throw DSPException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
+						   ("Multitone period must be a power of two: " + std::to_string(m_periodSamples)).c_str());
+
+	if (m_fundamental <= 0.0)
+		throw DSPException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0, "Multitone fundamental must be positive");
+
+	place(requestedFrequencies, m_periodSamples, m_fundamental, maxDeviation, &m_harmonics, &m_placed, &m_unplaced);
+
+	if (!m_unplaced.empty())
+		Debug::warning("Multitone", std::to_string(m_unplaced.size()) + " measuring points without a harmonic of their own, "
+					   "resolution is " + std::to_string(m_fundamental) + "Hz");
+
+	if (m_harmonics.empty())
+		throw DSPException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0, "Multitone without any tones");
+
+	synthesize();
+}
+
+// Static
+void Multitone::place(const std::vector<double>& requestedFrequencies, size_t periodSamples, double fundamental,
+					  double maxDeviation, std::vector<size_t> *harmonics, std::vector<double> *placed,
+					  std::vector<double> *unplaced)
+{
+	std::vector<double> requested = requestedFrequencies;
+	std::sort(requested.begin(), requested.end());
+
+	harmonics->clear();
+	placed->clear();
+	unplaced->clear();
+
+	// Only odd harmonics: sums and differences of two of them, so all second order
+	// distortion, land on even ones. Lowest first, so a tone only has to stay off
+	// the third harmonics of those already placed.
+	const long nyquist = periodSamples / 2;
+	std::vector<bool> taken(nyquist, false);
+
+	for (auto f : requested) {
+		long nearest = 2 * std::lround((f / fundamental - 1.0) / 2.0) + 1;
+		long h = 0;
+
+		// Nearest free harmonic first, then alternating below and above
+		for (long d=0; !h; d+=2) {
+			bool inRange = false;
+			for (long candidate : {nearest - d, nearest + d}) {
+				if (candidate < 1 || std::fabs(candidate * fundamental - f) > maxDeviation * f)
+					continue;
+				inRange = true;
+				if (candidate < nyquist && !taken[candidate]) {
+					h = candidate;
+					break;
+				}
+			}
+			if (!inRange)
+				break;
+		}
+
+		if (!h) {
+			unplaced->push_back(f);
+			continue;
+		}
+
+		for (long k : {1, 3}) {
+			if (k * h < nyquist)
+				taken[k * h] = true;
+		}
+		harmonics->push_back(h);
+		placed->push_back(f);
+	}
+}
+
+// Static
+size_t Multitone::periodSamplesFor(const std::vector<double>& requestedFrequencies, double samplingFrequency,
+								   size_t minimum, size_t maximum, double maxDeviation)
+{
+	std::vector<size_t> harmonics;
+	std::vector<double> placed, unplaced;
+
+	size_t ret = FFT::nextPowerOfTwo(minimum);
+	for (; ret < maximum; ret *= 2) {
+		place(requestedFrequencies, ret, samplingFrequency / ret, maxDeviation, &harmonics, &placed, &unplaced);
+		if (unplaced.empty())
+			break;
+	}
+
+	return std::min(ret, maximum);
+}
+
+// Static
+double Multitone::fundamentalFor(double fMax, size_t periodSamples)
+{
+	// Keep the highest tone at 40% of the sampling rate, so the generators
+	// reconstruction filter does not bend the top end.
+	return fMax / (0.4 * periodSamples);
+}
+
+double Multitone::fundamental() const
+{
+	return m_fundamental;
+}
+
+size_t Multitone::periodSamples() const
+{
+	return m_periodSamples;
+}
+
+const std::vector<size_t>& Multitone::harmonics() const
+{
+	return m_harmonics;
+}
+
+std::vector<double> Multitone::frequencies() const
+{
+	std::vector<double> ret;
+	ret.reserve(m_harmonics.size());
+	for (auto h : m_harmonics)
+		ret.push_back(h * m_fundamental);
+	return ret;
+}
+
+const std::vector<double>& Multitone::placed() const
+{
+	return m_placed;
+}
+
+const std::vector<double>& Multitone::unplaced() const
+{
+	return m_unplaced;
+}
+
+const std::vector<double>& Multitone::period() const
+{
+	return m_period;
+}
+
+double Multitone::toneAmplitude() const
+{
+	return m_toneAmplitude;
+}
+
+double Multitone::crestFactor() const
+{
+	return m_crestFactor;
+}
+
+void Multitone::synthesize()
+{
+	const int iterations = 100;
+	const size_t n = m_periodSamples;
+	const size_t k = m_harmonics.size();
+
+	FFT fft(n);
+
+	// Schroeder phases for equal amplitude tones
+	ComplexVector spectrum(n);
+	for (size_t i=0; i<k; i++) {
+		double phi = -M_PI * i * (i + 1) / k;
+		spectrum[m_harmonics[i]] = std::polar(n / 2.0, phi);
+		spectrum[n - m_harmonics[i]] = std::conj(spectrum[m_harmonics[i]]);
+	}
+
+	auto peakAndRms = [](const ComplexVector& s, double *peak, double *rms) {
+		*peak = 0.0;
+		*rms = 0.0;
+		for (auto &v : s) {
+			*peak = std::max(*peak, std::fabs(v.real()));
+			*rms += v.real() * v.real();
+		}
+		*rms = std::sqrt(*rms / s.size());
+	};
+
+	std::vector<double> best;
+	double bestCrest = 0.0;
+	double bestPeak = 0.0;
+
+	for (int it=0; it<=iterations; it++) {
+		ComplexVector signal = spectrum;
+		fft.inverse(&signal);
+
+		double peak, rms;
+		peakAndRms(signal, &peak, &rms);
+		double crest = peak / rms;
+
+		if (best.empty() || crest < bestCrest) {
+			best.resize(n);
+			for (size_t i=0; i<n; i++)
+				best[i] = signal[i].real();
+			bestCrest = crest;
+			bestPeak = peak;
+		}
+
+		if (it == iterations)
+			break;
+
+		// Clip, then project back onto the allowed tones with their amplitudes
+		// restored and the new phases kept. Relative to rms, not to the peak, so
+		// a long period has more than its few highest samples clipped each time.
+		double clip = 1.2 * rms;
+		for (auto &v : signal)
+			v = Complex(std::max(-clip, std::min(clip, v.real())), 0.0);
+
+		fft.forward(&signal);
+
+		std::fill(spectrum.begin(), spectrum.end(), Complex(0.0, 0.0));
+		for (auto h : m_harmonics) {
+			double phi = std::arg(signal[h]);
+			spectrum[h] = std::polar(n / 2.0, phi);
+			spectrum[n - h] = std::conj(spectrum[h]);
+		}
+	}
+
+	m_period.resize(n);
+	for (size_t i=0; i<n; i++)
+		m_period[i] = best[i] / bestPeak;
+
+	m_toneAmplitude = 1.0 / bestPeak;
+	m_crestFactor = bestCrest;
+
+	Debug::debug("Multitone", std::to_string(k) + " tones, crest factor " + std::to_string(m_crestFactor) +
+				 " (" + std::to_string(20.0 * std::log10(m_crestFactor)) + "dB)");
+}
+
+std::vector<double> Multitone::analyze(const std::vector<double>& samples, size_t periods) const
+{
+	return analyze(samples.data(), samples.size(), periods);
+}
+
+std::vector<double> Multitone::analyze(const double *samples, size_t size, size_t periods) const
+{
+	if (periods == 0 || size % periods != 0)
+		throw DSPException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
+						   ("Capture of " + std::to_string(size) + " samples does not hold " +
+							std::to_string(periods) + " whole periods").c_str());
+
+	FFT fft(size);
+
+	// Coherent, so without a window: tone h and every distortion product land
+	// exactly on their bins, h * periods for the tone. A window would smear the
+	// even products next to each tone into it.
+	ComplexVector spectrum(size);
+	for (size_t i=0; i<size; i++)
+		spectrum[i] = Complex(samples[i], 0.0);
+	fft.forward(&spectrum);
+
+	std::vector<double> ret;
+	ret.reserve(m_harmonics.size());
+	for (auto h : m_harmonics)
+		ret.push_back(binAmplitude(spectrum, h * periods, 1.0));
+
+	return ret;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vector>
+
+#include "dsp.h"
+
+// Periodic multitone stimulus: all measuring points are played at once as harmonics
+// of one fundamental, so one record captures the whole frequency response.
+// Tone phases start as Schroeder phases and are refined by iterative clipping,
+// which keeps the crest factor low and therefore the per tone level high.
+class Multitone
+{
+public:
+	// periodSamples must be a power of two. Each requested frequency gets an odd
+	// harmonic of fundamental of its own, within maxDeviation (relative) of it.
+	// Second order distortion of the DUT then only lands on even harmonics, and no
+	// tone sits on the third harmonic of a lower one, so neither adds to a measured
+	// tone. Frequencies without such a harmonic are left out, see unplaced().
+	Multitone(const std::vector<double>& requestedFrequencies, size_t periodSamples, double fundamental,
+			  double maxDeviation = 0.02);
+
+	// Shortest power of two period from minimum on, in which every requested
+	// frequency gets a harmonic of its own at samplingFrequency. maximum, if none.
+	static size_t periodSamplesFor(const std::vector<double>& requestedFrequencies, double samplingFrequency,
+								   size_t minimum, size_t maximum, double maxDeviation = 0.02);
+	// Lowest fundamental that still keeps fMax well below nyquist of periodSamples
+	static double fundamentalFor(double fMax, size_t periodSamples);
+
+	double fundamental() const;
+	size_t periodSamples() const;
+	const std::vector<size_t>& harmonics() const;
+	std::vector<double> frequencies() const;
+	// Requested frequency of each harmonic
+	const std::vector<double>& placed() const;
+	// Requested frequencies, that are not part of the multitone
+	const std::vector<double>& unplaced() const;
+
+	// One period, normalized to +-1. Played over and over, see Measurement::runMultitone().
+	const std::vector<double>& period() const;
+	// Peak amplitude of each single tone relative to the peak of period()
+	double toneAmplitude() const;
+	double crestFactor() const;
+
+	// Peak amplitude of each tone, samples must hold exactly 'periods' periods
+	// and its size must be a power of two.
+	std::vector<double> analyze(const double *samples, size_t size, size_t periods) const;
+	std::vector<double> analyze(const std::vector<double>& samples, size_t periods) const;
+
+private:
+	size_t m_periodSamples;
+	double m_fundamental;
+	std::vector<size_t> m_harmonics;
+	std::vector<double> m_placed;
+	std::vector<double> m_unplaced;
+	std::vector<double> m_period;
+	double m_toneAmplitude;
+	double m_crestFactor;
+
+	static void place(const std::vector<double>& requestedFrequencies, size_t periodSamples, double fundamental,
+					  double maxDeviation, std::vector<size_t> *harmonics, std::vector<double> *placed,
+					  std::vector<double> *unplaced);
+	void synthesize();
+};
@@ -0,0 +1,344 @@
+#include "resultwriter.h"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+
+#include <string.h>
+
+extern "C" {
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+static_assert(sizeof(ResultHeader) == 80, "ResultHeader is laid out without padding");
+
+const size_t TextWriter::s_bufferSize = 64 * 1024;
+const char ResultHeader::s_magic[8] = {'F', 'R', 'E', 'Q', 'R', 'E', 'S', 'P'};
+const uint32_t ResultHeader::s_version = 1;
+
+ResultException::ResultException(const char* func, const char* file, int line, int errorNumber, const char *what) :
+	basetype(func, file, line, errorNumber, what)
+{}
+
+const char* ResultException::what() const noexcept
+{
+	return basetype::what();
+}
+
+TextWriter::TextWriter(const std::string &fileName) :
+	m_fd(open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)),
+	m_fileName(fileName),
+	m_buffer(s_bufferSize),
+	m_used(0)
+{
+	if (m_fd < 0)
+		throw ResultException(__PRETTY_FUNCTION__, __FILE__, __LINE__, errno,
+							  ("Can not create " + fileName + ": " + strerror(errno)).c_str());
+}
+
+TextWriter::~TextWriter()
+{
+	try {
+		flush();
+	} catch (const ResultException &e) {
+		fprintf(stderr, "%s\n", e.what());
+	}
+	close(m_fd);
+}
+
+void TextWriter::writeLine(double a, double b)
+{
+	reserve(64);
+	m_used += snprintf(&m_buffer[m_used], m_buffer.size() - m_used, "%g,%g\n", a, b);
+}
+
+void TextWriter::writeLine(size_t index, double value)
+{
+	reserve(64);
+	m_used += snprintf(&m_buffer[m_used], m_buffer.size() - m_used, "%zu,%g\n", index, value);
+}
+
+void TextWriter::flush()
+{
+	size_t done = 0;
+	while (done < m_used) {
+		ssize_t ret = TEMP_FAILURE_RETRY(write(m_fd, &m_buffer[done], m_used - done));
+		if (ret < 0) {
+			m_used = 0;
+			throw ResultException(__PRETTY_FUNCTION__, __FILE__, __LINE__, errno,
+								  ("Can not write " + m_fileName + ": " + strerror(errno)).c_str());
+		}
+		done += ret;
+	}
+	m_used = 0;
+}
+
+void TextWriter::reserve(size_t size)
+{
+	if (m_buffer.size() - m_used < size)
+		flush();
+}
+
+MappedFile::MappedFile(const std::string &fileName, size_t size) :
+	m_fd(open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)),
+	m_data(nullptr),
+	m_size(size)
+{
+	if (m_fd < 0)
+		throw ResultException(__PRETTY_FUNCTION__, __FILE__, __LINE__, errno,
+							  ("Can not create " + fileName + ": " + strerror(errno)).c_str());
+
+	// Blocks are allocated up front, a full disk fails here and not with SIGBUS later
+	int ret = size ? posix_fallocate(m_fd, 0, size) : 0;
+	if (ret == EOPNOTSUPP || ret == EINVAL)
+		ret = ftruncate(m_fd, size) < 0 ? errno : 0;
+	if (ret != 0) {
+		close(m_fd);
+		throw ResultException(__PRETTY_FUNCTION__, __FILE__, __LINE__, ret,
+							  ("Can not size " + fileName + ": " + strerror(ret)).c_str());
+	}
+
+	if (size) {
+		void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+		if (data == MAP_FAILED) {
+			int e = errno;
+			close(m_fd);
+			throw ResultException(__PRETTY_FUNCTION__, __FILE__, __LINE__, e,
+								  ("Can not map " + fileName + ": " + strerror(e)).c_str());
+		}
+		m_data = static_cast<char*>(data);
+	}
+}
+
+MappedFile::MappedFile(const std::string &fileName) :
+	m_fd(open(fileName.c_str(), O_RDONLY | O_CLOEXEC)),
+	m_data(nullptr),
+	m_size(0)
+{
+	if (m_fd < 0)
+		throw ResultException(__PRETTY_FUNCTION__, __FILE__, __LINE__, errno,
+							  ("Can not open " + fileName + ": " + strerror(errno)).c_str());
+
+	struct stat st;
+	if (fstat(m_fd, &st) < 0) {
+		int e = errno;
+		close(m_fd);
+		throw ResultException(__PRETTY_FUNCTION__, __FILE__, __LINE__, e,
+							  ("Can not stat " + fileName + ": " + strerror(e)).c_str());
+	}
+	m_size = st.st_size;
+
+	if (m_size) {
+		void *data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+		if (data == MAP_FAILED) {
+			int e = errno;
+			close(m_fd);
+			throw ResultException(__PRETTY_FUNCTION__, __FILE__, __LINE__, e,
+								  ("Can not map " + fileName + ": " + strerror(e)).c_str());
+		}
+		m_data = static_cast<char*>(data);
+		// Readers go through it front to back
+		madvise(m_data, m_size, MADV_SEQUENTIAL);
+	}
+}
+
+MappedFile::~MappedFile()
+{
+	if (m_data)
+		munmap(m_data, m_size);
+	close(m_fd);
+}
+
+char *MappedFile::data()
+{
+	return m_data;
+}
+
+const char *MappedFile::data() const
+{
+	return m_data;
+}
+
+size_t MappedFile::size() const
+{
+	return m_size;
+}
+
+void MappedFile::sync()
+{
+	if (m_data)
+		msync(m_data, m_size, MS_ASYNC);
+}
+
+ResultWriter::~ResultWriter()
+{}
+
+// Lines in the order of the calls, the index is not needed for that
+class TextResultWriter : public ResultWriter
+{
+public:
+	TextResultWriter(const std::string &fileName, const std::vector<double> &frequencies) :
+		m_writer(fileName),
+		m_frequencies(frequencies)
+	{}
+
+	void write(size_t index, double value) override
+	{
+		if (index < m_frequencies.size())
+			m_writer.writeLine(m_frequencies[index], value);
+	}
+
+	void flush() override
+	{
+		m_writer.flush();
+	}
+
+private:
+	TextWriter m_writer;
+	std::vector<double> m_frequencies;
+};
+
+// Header and both columns mapped, values go straight to their place
+class BinaryResultWriter : public ResultWriter
+{
+public:
+	BinaryResultWriter(const std::string &fileName, const ResultHeader &header, const std::vector<double> &frequencies) :
+		m_file(fileName, sizeof(ResultHeader) + 2 * header.points * sizeof(double)),
+		m_points(header.points)
+	{
+		memcpy(m_file.data(), &header, sizeof(header));
+
+		double *columns = reinterpret_cast<double*>(m_file.data() + sizeof(ResultHeader));
+		for (size_t i=0; i<m_points; i++) {
+			columns[i] = i < frequencies.size() ? frequencies[i] : std::numeric_limits<double>::quiet_NaN();
+			columns[m_points + i] = std::numeric_limits<double>::quiet_NaN();
+		}
+	}
+
+	void write(size_t index, double value) override
+	{
+		if (index < m_points)
+			reinterpret_cast<double*>(m_file.data() + sizeof(ResultHeader))[m_points + index] = value;
+	}
+
+	void flush() override
+	{
+		m_file.sync();
+	}
+
+private:
+	MappedFile m_file;
+	size_t m_points;
+};
+
+// Static
+std::unique_ptr<ResultWriter> ResultWriter::create(ResultFormat format, const std::string &fileName,
+												   const ResultHeader &header, ResultQuantity quantity,
+												   const std::vector<double> &frequencies)
+{
+	if (format == ResultFormatBinary) {
+		ResultHeader h = header;
+		h.quantity = quantity;
+		h.points = frequencies.size();
+		return std::unique_ptr<ResultWriter>(new BinaryResultWriter(fileName, h, frequencies));
+	}
+
+	return std::unique_ptr<ResultWriter>(new TextResultWriter(fileName, frequencies));
+}
+
+// Static
+ResultHeader ResultWriter::header(double fMin, double fMax, int pointsPerDecade)
+{
+	ResultHeader ret;
+	memset(&ret, 0, sizeof(ret));
+	memcpy(ret.magic, ResultHeader::s_magic, sizeof(ret.magic));
+	ret.version = ResultHeader::s_version;
+	ret.fMin = fMin;
+	ret.fMax = fMax;
+	ret.pointsPerDecade = pointsPerDecade;
+	ret.channel = -1;
+	return ret;
+}
+
+void writeSamples(ResultFormat format, const std::string &fileName, const double *samples, size_t count)
+{
+	if (format == ResultFormatText) {
+		TextWriter writer(fileName);
+		for (size_t i=0; i<count; i++)
+			writer.writeLine(i, samples[i]);
+		writer.flush();
+		return;
+	}
+
+	auto header = ResultWriter::header(0.0, 0.0, 0);
+	header.quantity = ResultQuantitySamples;
+	header.points = count;
+
+	MappedFile file(fileName, sizeof(header) + count * sizeof(double));
+	memcpy(file.data(), &header, sizeof(header));
+	memcpy(file.data() + sizeof(header), samples, count * sizeof(double));
+	file.sync();
+}
+
+bool readResult(const std::string &fileName, ResultHeader *header, std::vector<double> *frequencies, std::vector<double> *values)
+{
+	std::ifstream in(fileName, std::ifstream::binary);
+	if (!in.is_open())
+		return false;
+
+	frequencies->clear();
+	values->clear();
+
+	char magic[sizeof(ResultHeader::s_magic)] = {};
+	in.read(magic, sizeof(magic));
+
+	if (in.gcount() == sizeof(magic) && memcmp(magic, ResultHeader::s_magic, sizeof(magic)) == 0) {
+		in.seekg(0);
+		in.read(reinterpret_cast<char*>(header), sizeof(*header));
+		if (in.gcount() != sizeof(*header) || header->version != ResultHeader::s_version)
+			return false;
+
+		// Before trusting points with an allocation
+		const size_t columns = header->quantity == ResultQuantitySamples ? 1 : 2;
+		in.seekg(0, std::ifstream::end);
+		const uint64_t payload = static_cast<uint64_t>(in.tellg()) - sizeof(*header);
+		if (payload % (columns * sizeof(double)) != 0 || payload / (columns * sizeof(double)) != header->points)
+			return false;
+		in.seekg(sizeof(*header));
+
+		frequencies->resize(header->points);
+		values->resize(header->points);
+		if (columns == 1) {
+			for (size_t i=0; i<frequencies->size(); i++)
+				(*frequencies)[i] = i;
+		} else {
+			in.read(reinterpret_cast<char*>(frequencies->data()), header->points * sizeof(double));
+		}
+		in.read(reinterpret_cast<char*>(values->data()), header->points * sizeof(double));
+		return in.gcount() == static_cast<std::streamsize>(header->points * sizeof(double));
+	}
+
+	// Text, "<frequency>,<value>" per line
+	in.clear();
+	in.seekg(0);
+	*header = ResultWriter::header(0.0, 0.0, 0);
+
+	for (std::string line; std::getline(in, line);) {
+		if (line.empty())
+			continue;
+
+		double f, v;
+		if (sscanf(line.c_str(), "%lf,%lf", &f, &v) != 2)
+			return false;
+		frequencies->push_back(f);
+		values->push_back(v);
+	}
+
+	header->points = frequencies->size();
+	return true;
+}
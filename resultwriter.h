@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "descriptiveexception.h"
+
+class ResultException : public DescriptiveException {
+public:
+	typedef DescriptiveException basetype;
+
+	ResultException(const char* func, const char* file, int line, int errorNumber, const char* what);
+	virtual const char* what() const noexcept;
+};
+
+// Appends text to a file through a buffer of its own, written out with one
+// write() when full or on flush(). Numbers are formatted with snprintf, without
+// the locale and state of a stream.
+class TextWriter
+{
+public:
+	// Truncates fileName. Throws, if it can not be created.
+	TextWriter(const std::string &fileName);
+	TextWriter(const TextWriter&) = delete;
+	TextWriter& operator=(const TextWriter&) = delete;
+	// Flushes
+	~TextWriter();
+
+	// "<a>,<b>\n", like a stream with precision 6 prints them
+	void writeLine(double a, double b);
+	void writeLine(size_t index, double value);
+	void flush();
+
+private:
+	int m_fd;
+	std::string m_fileName;
+	std::vector<char> m_buffer;
+	size_t m_used;
+
+	void reserve(size_t size);
+	const static size_t s_bufferSize;
+};
+
+// A file of fixed size, mapped shared. What is written to data() is in the page
+// cache right away, so it is kept, even if the process dies before it is done.
+class MappedFile
+{
+public:
+	// Creates or truncates fileName to size bytes. Throws, if that fails.
+	MappedFile(const std::string &fileName, size_t size);
+	// Maps all of an existing fileName read only, data() must not be written to.
+	// Throws, if that fails.
+	explicit MappedFile(const std::string &fileName);
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	char *data();
+	const char *data() const;
+	size_t size() const;
+	// Starts writing back to disk, without waiting for it
+	void sync();
+
+private:
+	int m_fd;
+	char *m_data;
+	size_t m_size;
+};
+
+// Binary results start with this header, in host byte order, followed by two
+// columns of points doubles: all frequencies, then all values. Values not
+// measured (yet) are NaN. Raw samples have the values column only.
+struct ResultHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t quantity;
+	uint64_t points;
+	double fMin;
+	double fMax;
+	double targetSnr;
+	double maxSettle;			// Seconds
+	double settleTolerance;		// dB
+	uint32_t pointsPerDecade;
+	uint32_t method;			// Measurement::Method
+	uint32_t estimator;			// Estimator
+	int32_t channel;			// 0 or 1, -1 for a result of several
+
+	const static char s_magic[8];
+	const static uint32_t s_version;
+};
+
+enum ResultFormat {
+	ResultFormatText,		// "<frequency>,<value>" lines, in the order points come in
+	ResultFormatBinary		// ResultHeader and columns, see there
+};
+
+enum ResultQuantity {
+	ResultQuantityLevel,		// dBu
+	ResultQuantityPhase,		// Degrees
+	ResultQuantityThd,			// Percent
+	ResultQuantitySettleTime,	// Seconds
+	ResultQuantitySamples		// Volts, one column without frequencies, see writeSamples()
+};
+
+// Takes the points of one result file as they are measured. Whatever was
+// written is on disk after flush(), so an aborted sweep keeps its points.
+class ResultWriter
+{
+public:
+	virtual ~ResultWriter();
+
+	// Value of point index of header.points
+	virtual void write(size_t index, double value) = 0;
+	virtual void flush() = 0;
+
+	// One point per frequency, header.points and quantity are set from them
+	static std::unique_ptr<ResultWriter> create(ResultFormat format, const std::string &fileName,
+												 const ResultHeader &header, ResultQuantity quantity,
+												 const std::vector<double> &frequencies);
+	// The header for sweep parameters, everything else zero
+	static ResultHeader header(double fMin, double fMax, int pointsPerDecade);
+};
+
+// Raw samples, as "<index>,<value>" lines or as a ResultHeader and the samples,
+// mapped and copied in one go. Throws, if the file can not be written.
+void writeSamples(ResultFormat format, const std::string &fileName, const double *samples, size_t count);
+
+// Result file of either format, false if it is neither or cut short. Text has no
+// header, it is returned zeroed, except for points. Of raw samples, frequencies
+// are their indices.
+bool readResult(const std::string &fileName, ResultHeader *header, std::vector<double> *frequencies, std::vector<double> *values);
@@ -0,0 +1,89 @@
+#include "settledetector.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "dspkernels.h"
+
+const double SettleDetector::s_minWindow = 0.002;
+
+SettleDetector::SettleDetector(double frequency, double samplingFrequency, double tolerance, double maxSettle) :
+	m_samplingFrequency(samplingFrequency),
+	m_tolerance(tolerance),
+	m_windowSamples(1),
+	m_maxSettleSamples(static_cast<size_t>(maxSettle * samplingFrequency)),
+	m_seen(0),
+	m_inWindow(0),
+	m_windowSum(0.0),
+	m_lastRms(0.0),
+	m_hasLast(false),
+	m_settled(false),
+	m_timedOut(false),
+	m_settleIndex(0)
+{
+	// rms of a sine over whole half periods does not ripple
+	double halfPeriods = std::ceil(std::max(1.0, s_minWindow * 2.0 * frequency));
+	m_windowSamples = std::max<size_t>(1, static_cast<size_t>(std::round(halfPeriods * samplingFrequency / (2.0 * frequency))));
+}
+
+bool SettleDetector::feed(const double *samples, size_t count)
+{
+	size_t i = 0;
+	while (i < count && !m_settled) {
+		if (m_seen >= m_maxSettleSamples) {
+			m_settled = true;
+			m_timedOut = true;
+			m_settleIndex = m_seen;
+			break;
+		}
+
+		// Up to the end of the window or the time out, whatever comes first
+		size_t n = std::min(std::min(count - i, m_windowSamples - m_inWindow), m_maxSettleSamples - m_seen);
+		m_windowSum += DSPKernels::sumOfSquares(SampleView(samples + i, n));
+		m_inWindow += n;
+		m_seen += n;
+		i += n;
+
+		if (m_inWindow < m_windowSamples)
+			continue;
+
+		double rms = std::sqrt(m_windowSum / m_inWindow);
+		if (m_hasLast && std::fabs(rms - m_lastRms) <= m_tolerance * std::max(rms, m_lastRms)) {
+			m_settled = true;
+			m_settleIndex = m_seen;
+		}
+
+		m_lastRms = rms;
+		m_hasLast = true;
+		m_windowSum = 0.0;
+		m_inWindow = 0;
+	}
+
+	return m_settled;
+}
+
+bool SettleDetector::settled() const
+{
+	return m_settled;
+}
+
+bool SettleDetector::timedOut() const
+{
+	return m_timedOut;
+}
+
+size_t SettleDetector::settleIndex() const
+{
+	return m_settleIndex;
+}
+
+double SettleDetector::settleTime() const
+{
+	return m_settleIndex / m_samplingFrequency;
+}
+
+// Static
+double SettleDetector::toleranceForDb(double db)
+{
+	return std::pow(10.0, std::fabs(db) / 20.0) - 1.0;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+
+// Watches the amplitude envelope of a capture that starts with a retune of the
+// generator. The envelope is the rms over windows of whole half periods (at least
+// s_minWindow seconds), the DUT counts as settled once two windows in a row agree
+// within tolerance. Feed samples as they come in from the device.
+class SettleDetector
+{
+public:
+	// tolerance is relative, e.g. 0.01 for 1%. maxSettle is the upper bound in seconds,
+	// after that the capture counts as settled, whatever the envelope does.
+	SettleDetector(double frequency, double samplingFrequency, double tolerance, double maxSettle);
+
+	// Returns true once settled
+	bool feed(const double *samples, size_t count);
+
+	bool settled() const;
+	bool timedOut() const;
+
+	// First sample after settling, valid once settled
+	size_t settleIndex() const;
+	double settleTime() const;
+
+	// Relative tolerance for a level change in dB
+	static double toleranceForDb(double db);
+
+private:
+	double m_samplingFrequency;
+	double m_tolerance;
+	size_t m_windowSamples;
+	size_t m_maxSettleSamples;
+
+	size_t m_seen;
+	size_t m_inWindow;
+	double m_windowSum;
+	double m_lastRms;
+	bool m_hasLast;
+	bool m_settled;
+	bool m_timedOut;
+	size_t m_settleIndex;
+
+	const static double s_minWindow;
+};
@@ -7,6 +7,14 @@ Speaker::Speaker()
 
 // Static
 void Speaker::setChannel(SharedGPIOHandle enable, SharedGPIOHandle adr0, SharedGPIOHandle adr1, Channel sp) {
+	// Lines switching together go straight from the old channel to the new one
+	GPIOValues lines = {{enable, true}, {adr0, sp != Speaker::Mid}, {adr1, sp != Speaker::Hi}};
+	if (setAtomically(lines)) {
+		setGPIOValues(lines);
+		return;
+	}
+
+	// Otherwise disable the mux, while the address is in between
 	enable->setValue(false);
 	if (sp == Speaker::Hi) {
 		adr0->setValue(true);
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <type_traits>
+
+extern "C" {
+#include <errno.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+}
+
+// Like BlockingCircularBuffer, but for exactly one thread calling set() and one
+// calling get(), without a lock. The capacity is rounded up to a power of two,
+// indices run freely and are masked, blocks are copied with at most two memcpy
+// around the wrap. Each side keeps what it writes on a cache line of its own,
+// along with a copy of the other sides index, so it only reads that line when
+// the copy says it is full or empty.
+//
+// trySet() and tryGet() never block. set() and get() sleep on the other sides
+// index through a futex, but only ever make a syscall while one side waits.
+template <typename T>
+class SPSCCircularBuffer
+{
+	static_assert(std::is_trivially_copyable<T>::value, "Elements are copied with memcpy");
+
+public:
+	SPSCCircularBuffer(const std::string& name, unsigned int size) :
+		m_buffer(nullptr),
+		m_size(1),
+		m_name(name),
+		m_consumer(),
+		m_producer()
+	{
+		static_assert(offsetof(SPSCCircularBuffer, m_consumer) % s_cacheLine == 0 &&
+					  offsetof(SPSCCircularBuffer, m_producer) - offsetof(SPSCCircularBuffer, m_consumer) >= s_cacheLine &&
+					  sizeof(SPSCCircularBuffer) - offsetof(SPSCCircularBuffer, m_producer) >= s_cacheLine,
+					  "Each side needs a cache line of its own");
+
+		while (m_size < size && m_size < (1u << 31))
+			m_size <<= 1;
+
+		m_mask = m_size - 1;
+		m_buffer = new T[m_size];
+		memset(m_buffer, 0, m_size * sizeof(T));
+	}
+
+	SPSCCircularBuffer(const SPSCCircularBuffer&) = delete;
+	SPSCCircularBuffer& operator=(const SPSCCircularBuffer&) = delete;
+
+	~SPSCCircularBuffer()
+	{
+		delete [] m_buffer;
+	}
+
+	// Plain new only aligns to 16 bytes before C++17
+	static void *operator new(size_t size)
+	{
+		void *ret;
+		if (posix_memalign(&ret, s_cacheLine, size))
+			throw std::bad_alloc();
+		return ret;
+	}
+
+	static void operator delete(void *p)
+	{
+		free(p);
+	}
+
+	// Consumer. All of size or nothing.
+	bool tryGet(T *buffer, unsigned int size)
+	{
+		const uint32_t read = m_consumer.readIndex.load(std::memory_order_relaxed);
+
+		if (m_consumer.cachedWriteIndex - read < size) {
+			m_consumer.cachedWriteIndex = m_producer.writeIndex.load(std::memory_order_acquire);
+			if (m_consumer.cachedWriteIndex - read < size)
+				return false;
+		}
+
+		copyOut(read, buffer, size);
+		m_consumer.readIndex.store(read + size, std::memory_order_release);
+		wake(&m_consumer.readIndex, &m_consumer.producerWaiting);
+
+		return true;
+	}
+
+	// Producer. All of size or nothing.
+	bool trySet(const T *buffer, unsigned int size)
+	{
+		const uint32_t write = m_producer.writeIndex.load(std::memory_order_relaxed);
+
+		if (m_size - (write - m_producer.cachedReadIndex) < size) {
+			m_producer.cachedReadIndex = m_consumer.readIndex.load(std::memory_order_acquire);
+			if (m_size - (write - m_producer.cachedReadIndex) < size)
+				return false;
+		}
+
+		copyIn(write, buffer, size);
+		m_producer.writeIndex.store(write + size, std::memory_order_release);
+		wake(&m_producer.writeIndex, &m_producer.consumerWaiting);
+
+		return true;
+	}
+
+	// Consumer. Sleeps until size elements are there, false after timeout.
+	bool get(T *buffer, unsigned int size, std::chrono::milliseconds timeout)
+	{
+		if (size > m_size)
+			return false;
+
+		auto deadline = std::chrono::steady_clock::now() + timeout;
+		while (!tryGet(buffer, size)) {
+			const uint32_t read = m_consumer.readIndex.load(std::memory_order_relaxed);
+			if (!wait(&m_producer.writeIndex, &m_producer.consumerWaiting, deadline, [=](uint32_t write) { return write - read >= size; }))
+				return false;
+		}
+
+		return true;
+	}
+
+	// Producer. Sleeps until there is room for size elements, false after timeout.
+	bool set(const T *buffer, unsigned int size, std::chrono::milliseconds timeout)
+	{
+		if (size > m_size)
+			return false;
+
+		auto deadline = std::chrono::steady_clock::now() + timeout;
+		while (!trySet(buffer, size)) {
+			const uint32_t write = m_producer.writeIndex.load(std::memory_order_relaxed);
+			if (!wait(&m_consumer.readIndex, &m_consumer.producerWaiting, deadline, [=](uint32_t read) { return m_size - (write - read) >= size; }))
+				return false;
+		}
+
+		return true;
+	}
+
+	// Exact only on the side, that would wait for it
+	inline unsigned int availableToRead() const
+	{
+		return m_producer.writeIndex.load(std::memory_order_acquire) - m_consumer.readIndex.load(std::memory_order_acquire);
+	}
+
+	inline unsigned int availableToWrite() const
+	{
+		return m_size - availableToRead();
+	}
+
+	inline int size() const
+	{
+		return m_size;
+	}
+
+	inline std::string name() const
+	{
+		return m_name;
+	}
+
+private:
+	const static size_t s_cacheLine = 64;
+
+	// Written by the consumer
+	struct alignas(s_cacheLine) ConsumerSide {
+		std::atomic<uint32_t> readIndex;
+		uint32_t cachedWriteIndex;
+		std::atomic<uint32_t> producerWaiting;	// Rarely, read along with readIndex
+	};
+
+	// Written by the producer
+	struct alignas(s_cacheLine) ProducerSide {
+		std::atomic<uint32_t> writeIndex;
+		uint32_t cachedReadIndex;
+		std::atomic<uint32_t> consumerWaiting;	// Rarely, read along with writeIndex
+	};
+
+	// Set once, only read afterwards, so both sides may share it
+	T *m_buffer;
+	uint32_t m_size;
+	uint32_t m_mask;
+	std::string m_name;
+
+	ConsumerSide m_consumer;
+	ProducerSide m_producer;
+
+	void copyIn(uint32_t index, const T *from, unsigned int size)
+	{
+		const uint32_t offset = index & m_mask;
+		const uint32_t first = std::min(size, m_size - offset);
+
+		memcpy(m_buffer + offset, from, first * sizeof(T));
+		memcpy(m_buffer, from + first, (size - first) * sizeof(T));
+	}
+
+	void copyOut(uint32_t index, T *to, unsigned int size) const
+	{
+		const uint32_t offset = index & m_mask;
+		const uint32_t first = std::min(size, m_size - offset);
+
+		memcpy(to, m_buffer + offset, first * sizeof(T));
+		memcpy(to + first, m_buffer, (size - first) * sizeof(T));
+	}
+
+	// After moving index. The fence orders that store before reading the flag,
+	// wait() does the opposite, so one of both always sees the other.
+	static void wake(std::atomic<uint32_t> *index, std::atomic<uint32_t> *waiting)
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiting->load(std::memory_order_relaxed))
+			futex(index, FUTEX_WAKE_PRIVATE, 1, nullptr);
+	}
+
+	// Sleeps on the other sides index, until ready(index) or deadline
+	template <typename F>
+	static bool wait(std::atomic<uint32_t> *index, std::atomic<uint32_t> *waiting,
+					 std::chrono::steady_clock::time_point deadline, F ready)
+	{
+		waiting->store(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		bool ret = true;
+		uint32_t current;
+		while (!ready(current = index->load(std::memory_order_acquire))) {
+			auto left = deadline - std::chrono::steady_clock::now();
+			if (left <= std::chrono::steady_clock::duration::zero()) {
+				ret = false;
+				break;
+			}
+
+			auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+			struct timespec ts = {static_cast<time_t>(ns / 1000000000), static_cast<long>(ns % 1000000000)};
+			// Returns right away, if index moved on since it was read
+			futex(index, FUTEX_WAIT_PRIVATE, current, &ts);
+		}
+
+		waiting->store(0, std::memory_order_relaxed);
+		return ret;
+	}
+
+	static long futex(std::atomic<uint32_t> *address, int op, uint32_t value, const struct timespec *timeout)
+	{
+		static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex needs a plain 32 bit word");
+		return syscall(SYS_futex, reinterpret_cast<uint32_t*>(address), op, value, timeout, nullptr, 0);
+	}
+};
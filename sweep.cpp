@@ -0,0 +1,201 @@
+#include "sweep.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#include "debug.h"
+
+const double ExponentialSweep::s_topFade = 1.5;
+
+ExponentialSweep::ExponentialSweep(double f1, double f2, double duration, double samplingFrequency) :
+	m_f1(f1),
+	m_f2(f2),
+	m_samplingFrequency(samplingFrequency),
+	m_rate(0.0)
+{
+	if (f1 <= 0.0 || f2 <= f1 || duration <= 0.0)
+		throw DSPException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
+						   ("Invalid sweep: " + std::to_string(f1) + "Hz to " + std::to_string(f2) +
+							"Hz in " + std::to_string(duration) + "s").c_str());
+
+	if (f2 >= samplingFrequency / 2.0)
+		throw DSPException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0,
+						   ("Sweep end " + std::to_string(f2) + "Hz is above nyquist").c_str());
+
+	const double fade = 0.005;
+
+	m_rate = duration / std::log(f2 / f1);
+
+	size_t n = static_cast<size_t>(std::round(duration * samplingFrequency));
+	size_t fadeSamples = std::min(n / 4, static_cast<size_t>(fade * samplingFrequency));
+
+	m_signal.resize(n);
+	for (size_t i=0; i<n; i++) {
+		double t = i / samplingFrequency;
+		m_signal[i] = std::sin(2.0 * M_PI * f1 * m_rate * (std::exp(t / m_rate) - 1.0));
+	}
+
+	for (size_t i=0; i<fadeSamples; i++) {
+		double w = 0.5 - 0.5 * std::cos(M_PI * i / fadeSamples);
+		m_signal[i] *= w;
+		m_signal[n - 1 - i] *= w;
+	}
+}
+
+const std::vector<double>& ExponentialSweep::signal() const
+{
+	return m_signal;
+}
+
+double ExponentialSweep::samplingFrequency() const
+{
+	return m_samplingFrequency;
+}
+
+double ExponentialSweep::f1() const
+{
+	return m_f1;
+}
+
+double ExponentialSweep::f2() const
+{
+	return m_f2;
+}
+
+ComplexVector ExponentialSweep::inverseFilter(size_t fftSize) const
+{
+	const double regularization = 1e-3;
+
+	FFT fft(fftSize);
+	auto x = fft.forward(m_signal);
+
+	double maxPower = 0.0;
+	for (auto &v : x)
+		maxPower = std::max(maxPower, std::norm(v));
+
+	// Band weight: one octave raised cosine fade in above f1, fade out below f2
+	auto band = [this](double f) {
+		if (f <= m_f1 || f >= m_f2)
+			return 0.0;
+		if (f < 2.0 * m_f1)
+			return 0.5 - 0.5 * std::cos(M_PI * std::log2(f / m_f1));
+		double fadeStart = m_f2 / s_topFade;
+		if (f > fadeStart)
+			return 0.5 + 0.5 * std::cos(M_PI * std::log(f / fadeStart) / std::log(s_topFade));
+		return 1.0;
+	};
+
+	ComplexVector ret(fftSize);
+	for (size_t i=0; i<=fftSize / 2; i++) {
+		double f = i * m_samplingFrequency / fftSize;
+		ret[i] = std::conj(x[i]) / (std::norm(x[i]) + regularization * maxPower) * band(f);
+		if (i != 0 && i != fftSize / 2)
+			ret[fftSize - i] = std::conj(ret[i]);
+	}
+
+	return ret;
+}
+
+std::vector<double> ExponentialSweep::impulseResponse(const std::vector<double>& capture, size_t fftSize) const
+{
+	FFT fft(fftSize);
+
+	auto y = fft.forward(capture);
+	auto inv = inverseFilter(fftSize);
+
+	for (size_t i=0; i<y.size(); i++)
+		y[i] *= inv[i];
+
+	fft.inverse(&y);
+
+	std::vector<double> ret(fftSize);
+	for (size_t i=0; i<fftSize; i++)
+		ret[i] = y[i].real();
+
+	return ret;
+}
+
+ExponentialSweep::Result ExponentialSweep::analyze(const std::vector<double>& capture, const std::vector<double>& frequencies, int harmonicCount) const
+{
+	const double preWindow = 0.002;		// Seconds in front of each impulse response
+	const double linearWindow = 0.25;	// Seconds of linear impulse response to evaluate
+
+	Result ret;
+
+	const size_t fftSize = FFT::nextPowerOfTwo(capture.size() + m_signal.size());
+	const long n = static_cast<long>(fftSize);
+	auto ir = impulseResponse(capture, fftSize);
+
+	// What a perfect wire deconvolves to. Evaluating it with the same windows
+	// takes out the gain and the band weighting of the inverse filter, so results
+	// end up as a plain V/V transfer function.
+	auto reference = impulseResponse(m_signal, fftSize);
+
+	// The linear response is the strongest, harmonics only come before it
+	auto peak = std::max_element(ir.begin(), ir.end(), [](double a, double b){
+		return std::fabs(a) < std::fabs(b);
+	});
+	long peakIndex = std::distance(ir.begin(), peak);
+	ret.latency = peakIndex < n / 2 ? peakIndex : peakIndex - n;
+
+	const long pre = static_cast<long>(preWindow * m_samplingFrequency);
+
+	// Cut length samples out of the circular response starting at start,
+	// fading in over pre and out over the second half
+	auto evaluate = [pre, n](const std::vector<double>& response, long start, long length, double frequency, double samplingFrequency) {
+		if (length <= 2 * pre)
+			return Complex(0.0, 0.0);
+
+		std::vector<double> windowed(length);
+		long fadeOut = length / 2;
+		for (long i=0; i<length; i++) {
+			double w = 1.0;
+			if (i < pre)
+				w = 0.5 - 0.5 * std::cos(M_PI * i / pre);
+			else if (i >= length - fadeOut)
+				w = 0.5 + 0.5 * std::cos(M_PI * (i - (length - fadeOut)) / fadeOut);
+			windowed[i] = response[((start + i) % n + n) % n] * w;
+		}
+
+		return dftAt(windowed.data(), windowed.size(), frequency, samplingFrequency);
+	};
+
+	auto transfer = [&](long start, long length, double frequency) {
+		double gain = std::abs(evaluate(reference, -pre, length, frequency, m_samplingFrequency));
+		if (gain <= 0.0)
+			return 0.0;
+		return std::abs(evaluate(ir, start, length, frequency, m_samplingFrequency)) / gain;
+	};
+
+	long linearLength = std::min(static_cast<long>(linearWindow * m_samplingFrequency), n / 2);
+	for (auto f : frequencies)
+		ret.magnitude.push_back(transfer(peakIndex - pre, linearLength, f));
+
+	// Harmonic k sits L*ln(k) in front of the linear response and
+	// ends where the window of harmonic k-1 starts.
+	ret.thd.assign(frequencies.size(), 0.0);
+	for (int k=2; k<=harmonicCount; k++) {
+		long advance = std::lround(m_rate * std::log(static_cast<double>(k)) * m_samplingFrequency);
+		long gap = std::lround(m_rate * std::log(static_cast<double>(k) / (k - 1)) * m_samplingFrequency);
+
+		std::vector<double> relative;
+		for (size_t i=0; i<frequencies.size(); i++) {
+			double fk = k * frequencies[i];
+			double hk = 0.0;
+			// Harmonics are only trustworthy where the inverse filter is flat
+			if (fk < m_f2 / s_topFade && ret.magnitude[i] > 0.0)
+				hk = transfer(peakIndex - advance - pre, gap, fk) / ret.magnitude[i];
+			relative.push_back(hk);
+			ret.thd[i] += hk * hk;
+		}
+		ret.harmonics.push_back(relative);
+	}
+
+	for (auto &thd : ret.thd)
+		thd = std::sqrt(thd);
+
+	Debug::verbose("ExponentialSweep", "Latency " + std::to_string(ret.latency) + " samples");
+
+	return ret;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+
+#include "dsp.h"
+
+// Exponential sine sweep after Farina.
+// The capture is deconvolved by multiplying its spectrum with the inverse filter.
+// This turns the capture into the linear impulse response, with the impulse
+// responses of the harmonic distortion products in front of it, each L*ln(k) earlier.
+// The inverse filter is built in the frequency domain (regularized 1/X, faded out
+// below f1 and above f2), a time reversed sweep leaves too much pre ringing
+// in front of the linear response to separate the harmonics cleanly.
+class ExponentialSweep
+{
+public:
+	ExponentialSweep(double f1, double f2, double duration, double samplingFrequency);
+
+	struct Result {
+		std::vector<double> magnitude;					// |H1| at the requested frequencies, times the amplitude the sweep was played at
+		std::vector<double> thd;						// sqrt(sum |Hk|^2) / |H1|, 0 where no harmonic is below f2 / 1.5
+		std::vector<std::vector<double>> harmonics;		// |Hk| / |H1| for k = 2..harmonicCount
+		int latency;									// Samples between stimulus and response
+	};
+
+	// Normalized to +-1, with short fades at both ends
+	const std::vector<double>& signal() const;
+	ComplexVector inverseFilter(size_t fftSize) const;
+	double samplingFrequency() const;
+	double f1() const;
+	double f2() const;
+
+	// Circular impulse response of fftSize samples, the linear response starts at
+	// latency, the harmonics wrap around to the end. fftSize must be a power of two
+	// and should be at least capture.size() + signal().size() to avoid aliasing.
+	std::vector<double> impulseResponse(const std::vector<double>& capture, size_t fftSize) const;
+
+	Result analyze(const std::vector<double>& capture, const std::vector<double>& frequencies, int harmonicCount) const;
+
+private:
+	double m_f1;
+	double m_f2;
+	double m_samplingFrequency;
+	double m_rate;	// Farinas L: sweep takes L seconds per factor e in frequency
+	std::vector<double> m_signal;
+
+	// Ratio between f2 and the point where the inverse filter starts to fade out
+	const static double s_topFade;
+};
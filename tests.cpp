@@ -4,10 +4,27 @@
 #include "measurement.h"
 #include "volume.h"
 #include "speaker.h"
+#include "gpiowatcher.h"
+#include "dsp.h"
+#include "dspkernels.h"
+#include "capturearchive.h"
+#include "blockingcircularbuffer.h"
+#include "spsccircularbuffer.h"
 
 #include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <cstring>
 #include <thread>
 
+extern "C" {
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
 using namespace std::chrono_literals;
 
 // This is a bit hackish, but works good to test-toggle GPIOs by hand.
@@ -22,9 +39,10 @@ void manualGPIOTest()
 	auto gpios = loadDefaultGPIOMapping(sharedDev);
 
 	// map Speaker Led {1,2} to front Led {1,2}
-	SharedTerminateFlag tf = createSharedTerminateFlag();
-	std::thread t1(mapInToOut, getGPIOForName(gpios, "Led 1"), getGPIOForName(gpios, "Front_LED_1"), 10ms, tf);
-	std::thread t2(mapInToOut, getGPIOForName(gpios, "Led 2"), getGPIOForName(gpios, "Front_LED_2"), 10ms, tf);
+	GPIOWatcher watcher;
+	watcher.mirror(getGPIOForName(gpios, "Led 1"), getGPIOForName(gpios, "Front_LED_1"));
+	watcher.mirror(getGPIOForName(gpios, "Led 2"), getGPIOForName(gpios, "Front_LED_2"));
+	watcher.start();
 
 	do {
 
@@ -47,9 +65,7 @@ void manualGPIOTest()
 		while ((g = kb.kbhit()) == 0);
 	} while (g != 'q');
 
-	tf->store(true);
-	t1.join();
-	t2.join();
+	watcher.stop();
 }
 
 void manualInputLevelCalibration()
@@ -103,10 +119,468 @@ void manualInputLevelCalibration()
 	t1.join();
 }
 
-void mapInToOut(SharedGPIOHandle in, SharedGPIOHandle out, std::chrono::milliseconds refreshRate, SharedTerminateFlag terminateRequest)
+// GPIOSysFs access as it was before it kept its fds, for comparison
+static void reopeningSetValue(const std::string &path, bool v)
+{
+	std::ofstream fileValue;
+	fileValue.open(path);
+	if (!fileValue.is_open())
+		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0, ("Can not open file: " + path).c_str());
+
+	fileValue << (v ? "1" : "0") << std::endl;
+	fileValue.flush();
+}
+
+static bool reopeningGetValue(const std::string &path)
+{
+	std::ifstream fileValue;
+	fileValue.open(path);
+	if (!fileValue.is_open())
+		throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, 0, ("Can not open file: " + path).c_str());
+
+	std::string line;
+	std::getline(fileValue, line);
+	return line == "1";
+}
+
+template <typename F>
+static double perSecond(int iterations, F f)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (int i=0; i<iterations; i++)
+		f(i);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return iterations / elapsed.count();
+}
+
+void benchmarkGPIOSysFs(int gpioNumber, int iterations)
+{
+	std::string basePath = GPIOSysFs::s_defaultBasePath;
+
+	if (hostGPIOSimulated()) {
+		char scratch[] = "/tmp/gpiobenchXXXXXX";
+		if (!mkdtemp(scratch))
+			throw GPIOException(__PRETTY_FUNCTION__, __FILE__, __LINE__, errno, "Can not create scratch directory");
+
+		basePath = scratch;
+		std::string gpioPath = basePath + "/gpio" + std::to_string(gpioNumber);
+		mkdir(gpioPath.c_str(), 0755);
+		for (auto f : {"/export", "/unexport"})
+			std::ofstream(basePath + f);
+		std::ofstream(gpioPath + "/value") << "0" << std::endl;
+		std::ofstream(gpioPath + "/direction") << "in" << std::endl;
+	}
+
+	double toggles, reads, reopeningToggles, reopeningReads;
+	{
+		GPIOSysFs gpio("benchmark", gpioNumber, GPIO::DirectionOut, false, basePath);
+		std::string valuePath = basePath + "/gpio" + std::to_string(gpioNumber) + "/value";
+
+		reopeningToggles = perSecond(iterations, [&](int i) { reopeningSetValue(valuePath, i & 1); });
+		reopeningReads = perSecond(iterations, [&](int) { reopeningGetValue(valuePath); });
+		toggles = perSecond(iterations, [&](int i) { gpio.setValue(i & 1); });
+		reads = perSecond(iterations, [&](int) { gpio.getValue(); });
+	}
+
+	std::cout << std::fixed << std::setprecision(0)
+			  << "GPIO" << gpioNumber << " at " << basePath << ", " << iterations << " iterations" << std::endl
+			  << "                 toggles/s     reads/s" << std::endl
+			  << "reopen per call  " << std::setw(9) << reopeningToggles << "   " << std::setw(9) << reopeningReads << std::endl
+			  << "persistent fd    " << std::setw(9) << toggles << "   " << std::setw(9) << reads << std::endl;
+
+	if (hostGPIOSimulated()) {
+		std::string gpioPath = basePath + "/gpio" + std::to_string(gpioNumber);
+		for (auto f : {"/value", "/direction"})
+			unlink((gpioPath + f).c_str());
+		rmdir(gpioPath.c_str());
+		for (auto f : {"/export", "/unexport"})
+			unlink((basePath + f).c_str());
+		rmdir(basePath.c_str());
+	}
+}
+
+bool testGPIOCharDev(const std::string &chipPath)
+{
+	auto gpios = createGPIOs({"Enable", "ADR0", "ADR1"}, chipPath, {0, 1, 2}, GPIO::DirectionOut, false);
+	auto enable = getGPIOForName(gpios, "Enable");
+	auto adr0 = getGPIOForName(gpios, "ADR0");
+	auto adr1 = getGPIOForName(gpios, "ADR1");
+
+	bool ok = setAtomically({{enable, true}, {adr0, true}, {adr1, true}});
+	if (hostGPIOSimulated())
+		std::cout << "Enable, ADR0 and ADR1 are simulated, set one by one" << std::endl;
+	else
+		std::cout << "Enable, ADR0 and ADR1 " << (ok ? "switch in one ioctl" : "can not be switched at once") << std::endl;
+	// Simulated lines live in memory, nothing to switch at once
+	ok = ok || hostGPIOSimulated();
+
+	const Speaker::Channel channels[] = {Speaker::Hi, Speaker::Mid, Speaker::Lo};
+	const int iterations = 10000;
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i=0; i<iterations; i++) {
+		auto sp = channels[i % 3];
+		Speaker::setChannel(enable, adr0, adr1, sp);
+
+		if (i < 3) {
+			bool match = enable->getValue() && adr0->getValue() == (sp != Speaker::Mid) && adr1->getValue() == (sp != Speaker::Hi);
+			std::cout << "Channel " << i << ": " << (match ? "OK" : "FAIL") << std::endl;
+			ok = ok && match;
+		}
+	}
+	std::chrono::duration<double> atomic = std::chrono::steady_clock::now() - start;
+
+	start = std::chrono::steady_clock::now();
+	for (int i=0; i<iterations; i++) {
+		auto sp = channels[i % 3];
+		enable->setValue(false);
+		adr0->setValue(sp != Speaker::Mid);
+		adr1->setValue(sp != Speaker::Hi);
+		enable->setValue(true);
+	}
+	std::chrono::duration<double> sequential = std::chrono::steady_clock::now() - start;
+
+	std::cout << std::fixed << std::setprecision(0)
+			  << "Channel switches/s, Speaker::setChannel: " << iterations / atomic.count()
+			  << ", line by line: " << iterations / sequential.count() << std::endl;
+
+	return ok;
+}
+
+void benchmarkGPIOWatcher(int mappings, int edges)
+{
+	std::vector<std::shared_ptr<GPIOMemory>> inputs;
+	std::vector<SharedGPIOHandle> outputs;
+	for (int i=0; i<mappings; i++) {
+		inputs.push_back(std::make_shared<GPIOMemory>("in" + std::to_string(i), GPIO::DirectionIn, false));
+		outputs.push_back(std::make_shared<GPIOMemory>("out" + std::to_string(i), GPIO::DirectionOut, false));
+	}
+
+	GPIOWatcher watcher;
+	for (int i=0; i<mappings; i++)
+		watcher.mirror(inputs[i], outputs[i]);
+	watcher.start();
+
+	// Edges on one input after the other, each waits for its output to follow
+	double worst = 0.0;
+	double sum = 0.0;
+	for (int e=0; e<edges; e++) {
+		auto &in = inputs[e % mappings];
+		auto &out = outputs[e % mappings];
+		bool value = !in->getValue();
+
+		auto start = std::chrono::steady_clock::now();
+		in->setValue(value);
+		while (out->getValue() != value)
+			std::this_thread::yield();
+		std::chrono::duration<double, std::micro> latency = std::chrono::steady_clock::now() - start;
+
+		sum += latency.count();
+		worst = std::max(worst, latency.count());
+	}
+
+	watcher.stop();
+
+	std::cout << std::fixed << std::setprecision(1)
+			  << mappings << " mappings, " << edges << " edges, " << watcher.dispatched() << " dispatched" << std::endl
+			  << "Propagation mean " << sum / edges << "us, worst " << worst << "us" << std::endl;
+}
+
+// Bitwise, so -0.0 and 0.0 or two NaNs are told apart as well
+static bool identical(double a, double b)
+{
+	return std::memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+bool testDSPKernels()
+{
+	const DSPKernels::Isa isas[] = {DSPKernels::IsaSse2, DSPKernels::IsaAvx2, DSPKernels::IsaNeon};
+	const size_t sizes[] = {0, 1, 3, 4, 5, 7, 8, 17, 1000, 4097, 100003};
+	auto selected = DSPKernels::isa();
+
+	std::mt19937_64 random(1);
+	// DC, a large and a tiny sine and noise, so compensation has something to do
+	std::vector<std::vector<double>> captures;
+	std::vector<std::vector<double>> windows;
+	for (auto size : sizes) {
+		std::normal_distribution<double> noise(0.0, 1e-6);
+		std::vector<double> capture(size);
+		for (size_t i=0; i<size; i++)
+			capture[i] = 0.3 + 1e3 * std::sin(0.01 * i) + 1e-9 * std::sin(0.7 * i) + noise(random);
+		captures.push_back(capture);
+		windows.push_back(hannWindow(size));
+	}
+
+	struct Result {
+		std::vector<double> values;
+		std::vector<std::vector<double>> buffers;
+	};
+
+	auto run = [&]() {
+		Result r;
+		for (size_t c=0; c<captures.size(); c++) {
+			SampleView x(captures[c].data(), captures[c].size());
+			r.values.push_back(DSPKernels::sum(x));
+			r.values.push_back(DSPKernels::sumOfSquares(x));
+			r.values.push_back(DSPKernels::sumOfSquaredDeviations(x, 0.3));
+			r.values.push_back(DSPKernels::rms(x));
+			r.values.push_back(DSPKernels::acRms(x));
+
+			std::vector<double> out(x.size());
+			DSPKernels::subtract(x.data(), 0.3, out.data(), out.size());
+			r.buffers.push_back(out);
+			DSPKernels::multiply(x.data(), windows[c].data(), out.data(), out.size());
+			r.buffers.push_back(out);
+			out = captures[c];
+			DSPKernels::removeMean(out.data(), out.size());
+			r.buffers.push_back(out);
+		}
+		return r;
+	};
+
+	DSPKernels::setIsa(DSPKernels::IsaScalar);
+	Result reference = run();
+
+	bool ok = true;
+	for (auto isa : isas) {
+		if (!DSPKernels::setIsa(isa)) {
+			std::cout << DSPKernels::isaName(isa) << ": not supported" << std::endl;
+			continue;
+		}
+
+		Result r = run();
+		size_t mismatches = 0;
+		for (size_t i=0; i<r.values.size(); i++)
+			mismatches += !identical(r.values[i], reference.values[i]);
+		for (size_t b=0; b<r.buffers.size(); b++) {
+			for (size_t i=0; i<r.buffers[b].size(); i++)
+				mismatches += !identical(r.buffers[b][i], reference.buffers[b][i]);
+		}
+
+		std::cout << DSPKernels::isaName(isa) << ": " << (mismatches ? "FAIL, " + std::to_string(mismatches) + " differ" : std::string("OK")) << std::endl;
+		ok = ok && mismatches == 0;
+	}
+
+	DSPKernels::setIsa(selected);
+	return ok;
+}
+
+void benchmarkDSPKernels(size_t samples)
+{
+	const int channels = 2;
+	const int iterations = std::max<size_t>(1, 200000000 / std::max<size_t>(samples, 1) / channels);
+
+	std::vector<std::vector<double>> captures(channels, std::vector<double>(samples));
+	for (int c=0; c<channels; c++) {
+		for (size_t i=0; i<samples; i++)
+			captures[c][i] = std::sin(0.01 * i + c);
+	}
+	auto window = hannWindow(samples);
+	std::vector<double> out(samples);
+	auto selected = DSPKernels::isa();
+
+	// The optimizer must not drop what is not used
+	volatile double sink = 0.0;
+
+	auto samplesPerSecond = [&](std::function<void()> f) {
+		double calls = perSecond(iterations, [&](int) { f(); });
+		return calls * channels * samples;
+	};
+
+	double plain = samplesPerSecond([&]() {
+		for (auto &capture : captures) {
+			double sum = 0.0;
+			for (auto x : capture)
+				sum += x * x;
+			sink = std::sqrt(sum / capture.size());
+		}
+	});
+
+	std::cout << samples << " samples, " << channels << " channels, " << iterations << " iterations" << std::endl
+			  << "            rms/s     acRms/s  multiply/s" << std::endl
+			  << std::scientific << std::setprecision(2)
+			  << "plain loop  " << plain << std::endl;
+
+	for (auto isa : {DSPKernels::IsaScalar, DSPKernels::IsaSse2, DSPKernels::IsaAvx2, DSPKernels::IsaNeon}) {
+		if (!DSPKernels::setIsa(isa))
+			continue;
+
+		double rmsRate = samplesPerSecond([&]() {
+			for (auto &capture : captures)
+				sink = DSPKernels::rms(SampleView(capture.data(), capture.size()));
+		});
+		double acRmsRate = samplesPerSecond([&]() {
+			for (auto &capture : captures)
+				sink = DSPKernels::acRms(SampleView(capture.data(), capture.size()));
+		});
+		double multiplyRate = samplesPerSecond([&]() {
+			for (auto &capture : captures)
+				DSPKernels::multiply(capture.data(), window.data(), out.data(), samples);
+			sink = out[samples / 2];
+		});
+
+		std::cout << std::left << std::setw(12) << DSPKernels::isaName(isa) << std::right
+				  << rmsRate << "    " << acRmsRate << "    " << multiplyRate << std::endl;
+	}
+
+	DSPKernels::setIsa(selected);
+}
+
+bool reanalyzeCaptures(const std::string &fileName, const Estimator *estimator)
+{
+	try {
+		auto start = std::chrono::steady_clock::now();
+
+		CaptureArchive archive(fileName);
+		Estimator e = estimator ? *estimator : static_cast<Estimator>(archive.header().estimator);
+
+		std::cout << "point,channel,frequency,level,phase,lost,corrupted" << std::endl;
+
+		size_t samples = 0;
+		for (auto &capture : archive.captures()) {
+			auto estimate = CaptureArchive::estimate(capture, e);
+			samples += capture.samples.size();
+
+			std::cout << capture.header->point << "," << capture.header->channel << ","
+					  << capture.header->frequency << "," << dBuForVolts(estimate.rms) << ","
+					  << estimate.phase << "," << capture.header->lost << ","
+					  << capture.header->corrupted << std::endl;
+		}
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cerr << archive.captures().size() << " records, " << samples << " samples in " << seconds << "s, "
+				  << samples * sizeof(double) / seconds / 1e6 << " MB/s" << std::endl;
+
+		return !archive.truncated();
+
+	} catch (const ResultException &e) {
+		std::cerr << e.what() << std::endl;
+		return false;
+	}
+}
+
+// Pushes blocks of increasing numbers from a second thread through ring and
+// checks them on this one. Seconds it took, negative if anything came out wrong.
+template <typename Ring>
+static double streamThrough(Ring *ring, size_t blockSize, size_t blocks)
 {
-	while (!terminateRequest->load()) {
-		out->setValue(in->getValue());
-		std::this_thread::sleep_for(refreshRate);
+	auto start = std::chrono::steady_clock::now();
+
+	std::thread producer([=]() {
+		std::vector<double> block(blockSize);
+		double next = 0.0;
+		for (size_t b=0; b<blocks; b++) {
+			for (auto &x : block)
+				x = next++;
+			while (!ring->set(block.data(), blockSize, std::chrono::seconds(1)));
+		}
+	});
+
+	std::vector<double> block(blockSize);
+	double expected = 0.0;
+	bool ok = true;
+	for (size_t b=0; b<blocks; b++) {
+		while (!ring->get(block.data(), blockSize, std::chrono::seconds(1)));
+		for (auto x : block)
+			ok = ok && x == expected++;
 	}
+
+	producer.join();
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return ok ? seconds : -seconds;
+}
+
+void benchmarkCircularBuffers(size_t blockSize)
+{
+	const size_t capacity = FFT::nextPowerOfTwo(8 * blockSize);
+	const size_t blocks = std::max<size_t>(1, 50000000 / blockSize);
+
+	std::cout << blocks << " blocks of " << blockSize << " samples through " << capacity << " samples" << std::endl
+			  << std::scientific << std::setprecision(2);
+
+	auto print = [&](const std::string &name, double seconds) {
+		std::cout << std::left << std::setw(24) << name << std::right
+				  << blocks * blockSize / std::abs(seconds) << " samples/s  "
+				  << blocks / std::abs(seconds) << " blocks/s"
+				  << (seconds < 0.0 ? "  MISMATCH" : "") << std::endl;
+	};
+
+	{
+		BlockingCircularBuffer<double> ring("Benchmark", capacity);
+		print("BlockingCircularBuffer", streamThrough(&ring, blockSize, blocks));
+	}
+	{
+		SPSCCircularBuffer<double> ring("Benchmark", capacity);
+		print("SPSCCircularBuffer", streamThrough(&ring, blockSize, blocks));
+	}
+}
+
+bool testMethodLevels(double fMin, double fMax, int pointsPerDecade, double toleranceDb)
+{
+	char scratch[] = "/tmp/methodlevelsXXXXXX";
+	if (!mkdtemp(scratch)) {
+		std::cerr << "Can not create scratch directory: " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	const std::vector<std::pair<Measurement::Method, std::string>> methods = {
+		{Measurement::MethodSteppedSine, "sine"},
+		{Measurement::MethodMultitone, "multitone"},
+		{Measurement::MethodExponentialSweep, "sweep"}
+	};
+
+	auto dev = AnalogDiscovery::getFirstAvailableDevice();
+	std::vector<std::vector<double>> frequencies(methods.size());
+	std::vector<std::vector<double>> levels(methods.size());
+	std::vector<std::string> files;
+
+	for (size_t m=0; m<methods.size(); m++) {
+		std::string name = std::string(scratch) + "/" + methods[m].second;
+		Measurement measurement(name, dev, fMin, fMax, pointsPerDecade);
+		measurement.setMethod(methods[m].first);
+		measurement.start(1, 0.0);
+		while (measurement.isRunning())
+			std::this_thread::sleep_for(50ms);
+
+		ResultHeader header;
+		if (!readResult(name, &header, &frequencies[m], &levels[m])) {
+			std::cerr << methods[m].second << ": no result" << std::endl;
+			levels[m].clear();
+		}
+
+		for (auto suffix : {"", ".thd", ".settle"})
+			files.push_back(name + suffix);
+	}
+
+	// Stepped sine is the reference, the others measure the same points
+	bool ok = !levels[0].empty();
+	std::cout << std::fixed << std::setprecision(3) << "frequency";
+	for (size_t m=0; m<methods.size(); m++)
+		std::cout << std::setw(12) << methods[m].second;
+	std::cout << std::endl;
+
+	for (size_t i=0; i<levels[0].size(); i++) {
+		std::cout << std::setw(9) << std::setprecision(1) << frequencies[0][i] << std::setprecision(3);
+		for (size_t m=0; m<methods.size(); m++) {
+			if (i >= levels[m].size()) {
+				std::cout << std::setw(12) << "-";
+				ok = false;
+				continue;
+			}
+
+			bool within = std::fabs(levels[m][i] - levels[0][i]) <= toleranceDb;
+			std::cout << std::setw(11) << levels[m][i] << (within ? " " : "*");
+			ok = ok && within;
+		}
+		std::cout << std::endl;
+	}
+
+	std::cout << (ok ? "All methods within " : "Methods differ by more than ") << toleranceDb << "dB" << std::endl;
+
+	for (auto &f : files)
+		unlink(f.c_str());
+	rmdir(scratch);
+
+	return ok;
 }
@@ -6,4 +6,34 @@
 
 void manualGPIOTest();
 void manualInputLevelCalibration();
-void mapInToOut(SharedGPIOHandle in, SharedGPIOHandle out, std::chrono::milliseconds refreshRate, SharedTerminateFlag terminateRequest);
+// Toggles and reads one sysfs GPIO, opening the files per call as GPIOSysFs used to
+// and through GPIOSysFs with its persistent fds. Prints the rate of both.
+// With simulated host GPIOs it runs on a scratch copy of the sysfs layout.
+void benchmarkGPIOSysFs(int gpioNumber, int iterations);
+// Requests lines 0, 1 and 2 of chipPath as Enable, ADR0 and ADR1 and switches
+// through all speaker channels, reading every line back. Meant for a gpio-sim chip:
+//   mkdir /sys/kernel/config/gpio-sim/test/gpio-bank0 -p
+//   echo 8 > /sys/kernel/config/gpio-sim/test/gpio-bank0/num_lines
+//   echo 1 > /sys/kernel/config/gpio-sim/test/live
+// Returns false on mismatch.
+bool testGPIOCharDev(const std::string &chipPath);
+// Mirrors in-memory inputs to outputs through a GPIOWatcher, prints how long edges take
+void benchmarkGPIOWatcher(int mappings, int edges);
+// Runs every DSP kernel the CPU supports against the scalar reference on random
+// captures of odd sizes, prints the result per instruction set. False on any bit difference.
+bool testDSPKernels();
+// rms, rms without DC and window multiply over samples per channel, with each
+// supported instruction set and the plain loop rms() used to be. Prints samples/s.
+void benchmarkDSPKernels(size_t samples);
+// Runs estimator, or the one of the sweep for nullptr, over every record of a
+// capture archive. Prints a line per record and the throughput. False, if the
+// archive can not be read or is cut short.
+bool reanalyzeCaptures(const std::string &fileName, const Estimator *estimator);
+// Streams blocks of blockSize samples from one thread to another through a
+// BlockingCircularBuffer and an SPSCCircularBuffer, checks them and prints the rate of both.
+void benchmarkCircularBuffers(size_t blockSize);
+// Measures the same points with stepped sine, multitone and sweep into a scratch
+// directory and prints them side by side. False, if multitone or sweep differ from
+// stepped sine by more than toleranceDb anywhere. Meant for a flat simulated DUT:
+//   --simulate "hp=1,lp=100000,noise=0,hd2=0"
+bool testMethodLevels(double fMin, double fMax, int pointsPerDecade, double toleranceDb);
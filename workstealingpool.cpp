@@ -0,0 +1,133 @@
+#include "workstealingpool.h"
+
+#include <algorithm>
+#include <exception>
+#include <string>
+
+#include "debug.h"
+
+// Pool and queue of the thread running, for submit() from within a task
+static thread_local const WorkStealingPool *t_pool = nullptr;
+static thread_local unsigned t_index = 0;
+
+WorkStealingPool::WorkStealingPool(unsigned threads) :
+	m_queued(0),
+	m_pending(0),
+	m_steals(0),
+	m_next(0),
+	m_stop(false)
+{
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	for (unsigned i=0; i<threads; i++)
+		m_queues.emplace_back(new Queue);
+
+	for (unsigned i=0; i<threads; i++)
+		m_threads.emplace_back(&WorkStealingPool::work, this, i);
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+	wait();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wakeup.notify_all();
+
+	for (auto &t : m_threads)
+		t.join();
+}
+
+unsigned WorkStealingPool::threadCount() const
+{
+	return m_threads.size();
+}
+
+void WorkStealingPool::submit(Task task)
+{
+	unsigned index = t_pool == this ? t_index : m_next++ % m_queues.size();
+
+	m_pending++;
+	{
+		// Counted before anyone can take it, so m_queued never runs below zero
+		std::lock_guard<std::mutex> lock(m_queues[index]->mutex);
+		m_queues[index]->tasks.push_back(std::move(task));
+
+		std::lock_guard<std::mutex> countLock(m_mutex);
+		m_queued++;
+	}
+	m_wakeup.notify_one();
+}
+
+void WorkStealingPool::wait()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done.wait(lock, [this]() { return m_pending == 0; });
+}
+
+size_t WorkStealingPool::steals() const
+{
+	return m_steals;
+}
+
+void WorkStealingPool::work(unsigned index)
+{
+	t_pool = this;
+	t_index = index;
+
+	Task task;
+	while (true) {
+		if (!take(index, &task)) {
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wakeup.wait(lock, [this]() { return m_queued != 0 || m_stop; });
+			if (m_stop && m_queued == 0)
+				return;
+			continue;
+		}
+
+		try {
+			task();
+		} catch (const std::exception &e) {
+			Debug::error("WorkStealingPool", std::string("Task failed: ") + e.what());
+		}
+		task = nullptr;
+
+		if (--m_pending == 0) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_done.notify_all();
+		}
+	}
+}
+
+bool WorkStealingPool::take(unsigned index, Task *task)
+{
+	// Own queue from the back, where the newest task is still warm in the cache
+	{
+		auto &own = *m_queues[index];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.tasks.empty()) {
+			*task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			m_queued--;
+			return true;
+		}
+	}
+
+	// Others from the front, oldest first, starting with the next one
+	for (size_t i=1; i<m_queues.size(); i++) {
+		auto &other = *m_queues[(index + i) % m_queues.size()];
+		std::lock_guard<std::mutex> lock(other.mutex);
+		if (!other.tasks.empty()) {
+			*task = std::move(other.tasks.front());
+			other.tasks.pop_front();
+			m_queued--;
+			m_steals++;
+			return true;
+		}
+	}
+
+	return false;
+}
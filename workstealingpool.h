@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs tasks on a fixed set of threads. Each thread has a queue of its own and
+// takes its newest task first. Once that is empty, it steals the oldest task of
+// another thread. Tasks of very different length, like sweeps of different
+// size, keep all threads busy to the end that way, without all of them
+// contending for one queue.
+class WorkStealingPool
+{
+public:
+	typedef std::function<void()> Task;
+
+	// 0 for one thread per core
+	explicit WorkStealingPool(unsigned threads = 0);
+	WorkStealingPool(const WorkStealingPool&) = delete;
+	WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+	// Runs what is still queued, then ends the threads
+	~WorkStealingPool();
+
+	unsigned threadCount() const;
+
+	// From within a task to the queue of its own thread, otherwise round robin.
+	// Exceptions of task are logged and dropped.
+	void submit(Task task);
+	// Blocks, until every task submitted so far is done
+	void wait();
+
+	// Tasks run by another thread than the one they were queued for
+	size_t steals() const;
+
+private:
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	std::vector<std::unique_ptr<Queue>> m_queues;
+	std::vector<std::thread> m_threads;
+
+	std::mutex m_mutex;
+	std::condition_variable m_wakeup;
+	std::condition_variable m_done;
+	std::atomic<size_t> m_queued;	// Increased with m_mutex held, so no wakeup is lost
+	std::atomic<size_t> m_pending;	// Submitted and not done yet
+	std::atomic<size_t> m_steals;
+	std::atomic<unsigned> m_next;
+	bool m_stop;
+
+	void work(unsigned index);
+	bool take(unsigned index, Task *task);
+};